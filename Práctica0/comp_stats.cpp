@@ -20,6 +20,8 @@
 #include <opencv2/imgproc/imgproc.hpp>
 //#include <opencv2/calib3d/calib3d.hpp>
 
+#include "fsiv_core.hpp"
+
 const cv::String keys =
     "{help h usage ? |      | print this message.   }"
     "{@image         |<none>| input image.          }"            
@@ -197,6 +199,7 @@ main (int argc, char* const* argv)
           parser.printErrors();
           return 0;
       }
+      std::cout << "fsiv_core: usando los kernels " << fsiv_core_isa() << "." << std::endl;
 
 
       //Carga la imagen desde archivo.
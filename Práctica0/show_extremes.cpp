@@ -10,6 +10,7 @@
 
 
 #include "common_code.hpp"
+#include "fsiv_core.hpp"
 
 const char * keys =
     "{help h usage ? |      | print this message}"
@@ -45,6 +46,7 @@ main (int argc, char* const* argv)
           parser.printErrors();
           return 0;
       }
+      std::cout << "fsiv_core: usando los kernels " << fsiv_core_isa() << "." << std::endl;
 
     // TODO
         cv::Mat img = cv::imread(input, cv::IMREAD_ANYCOLOR);
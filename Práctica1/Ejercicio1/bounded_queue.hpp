@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * @brief Cola acotada para comunicar las etapas de un pipeline.
+ *
+ * push() se bloquea si la cola está llena y pop() si está vacía, de forma
+ * que la etapa más lenta frena a las demás sin acumular frames en memoria.
+ * Tras close() push() falla y pop() devuelve lo que quede antes de fallar.
+ *
+ * @tparam T tipo de los elementos.
+ */
+template <class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {}
+
+    /**
+     * @brief Añade un elemento esperando si la cola está llena.
+     * @return false si la cola se ha cerrado (el elemento no se añade).
+     */
+    bool push(T &&v)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_full_.wait(lk, [this]() { return closed_ || items_.size() < capacity_; });
+        if (closed_)
+            return false;
+        items_.push_back(std::move(v));
+        lk.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Extrae un elemento esperando si la cola está vacía.
+     * @return false si la cola está cerrada y vacía.
+     */
+    bool pop(T &v)
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_empty_.wait(lk, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty())
+            return false;
+        v = std::move(items_.front());
+        items_.pop_front();
+        lk.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Cierra la cola y despierta a quien esté esperando.
+     */
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    bool closed_;
+    std::deque<T> items_;
+    std::mutex mtx_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
@@ -0,0 +1,344 @@
+#include "cbg_batch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <map>
+#include <set>
+#include <thread>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "bounded_queue.hpp"
+
+namespace
+{
+
+struct BatchJob
+{
+    size_t index;       /*< posición en la lista de entradas.*/
+    std::string name;   /*< ruta de entrada.*/
+    cv::Mat input;
+    cv::Mat output;
+};
+
+bool
+read_file(const std::string &path, std::vector<uchar> &buf)
+{
+    std::ifstream f(path.c_str(), std::ios::binary);
+    if (!f)
+        return false;
+    f.seekg(0, std::ios::end);
+    buf.resize(size_t(f.tellg()));
+    f.seekg(0, std::ios::beg);
+    return bool(f.read(reinterpret_cast<char *>(buf.data()), buf.size()));
+}
+
+bool
+write_file(const std::string &path, const std::vector<uchar> &buf)
+{
+    std::ofstream f(path.c_str(), std::ios::binary);
+    return f && f.write(reinterpret_cast<const char *>(buf.data()), buf.size());
+}
+
+/**
+ * @brief Componentes de una ruta, sin los vacíos ni ".".
+ */
+std::vector<std::string>
+split_path(const std::string &path)
+{
+    std::vector<std::string> parts;
+    size_t begin = 0;
+    while (begin <= path.size())
+    {
+        size_t end = path.find_first_of("/\\", begin);
+        if (end == std::string::npos)
+            end = path.size();
+        const std::string part = path.substr(begin, end - begin);
+        if (!part.empty() && part != ".")
+            parts.push_back(part);
+        begin = end + 1;
+    }
+    return parts;
+}
+
+/**
+ * @brief Ruta de salida de cada entrada: su ruta relativa al directorio
+ * común a todas, dentro de out_dir.
+ *
+ * Así, entradas de directorios distintos con el mismo nombre no se pisan.
+ * Los ".." que queden se cambian por "__" para no salir de out_dir.
+ */
+std::vector<std::string>
+output_names(const std::vector<std::string> &inputs, const std::string &out_dir)
+{
+    std::vector<std::vector<std::string>> parts;
+    for (const std::string &in : inputs)
+        parts.push_back(split_path(in));
+    // Componentes de directorio comunes (el nombre del fichero no cuenta).
+    size_t common = parts.empty() ? 0 : parts[0].size() - 1;
+    for (const std::vector<std::string> &p : parts)
+    {
+        size_t n = 0;
+        while (n < common && n + 1 < p.size() && p[n] == parts[0][n])
+            ++n;
+        common = n;
+    }
+    std::vector<std::string> names;
+    for (const std::vector<std::string> &p : parts)
+    {
+        std::string name = out_dir;
+        for (size_t i = common; i < p.size(); ++i)
+            name = cv::utils::fs::join(name, p[i] == ".." ? std::string("__") : p[i]);
+        names.push_back(name);
+    }
+    return names;
+}
+
+std::string
+parent_dir(const std::string &path)
+{
+    const size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? std::string(".") : path.substr(0, pos);
+}
+
+std::string
+extension(const std::string &path)
+{
+    const size_t pos = path.find_last_of('.');
+    return pos == std::string::npos ? std::string(".png") : path.substr(pos);
+}
+
+bool
+is_list_file(const std::string &source)
+{
+    std::string ext = extension(source);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".txt" || ext == ".lst";
+}
+
+} // namespace
+
+std::vector<std::string>
+cbg_batch_list_inputs(const std::string &source)
+{
+    std::vector<std::string> inputs;
+    if (is_list_file(source))
+    {
+        std::ifstream list(source.c_str());
+        if (!list)
+            return inputs;
+        std::string line;
+        while (std::getline(list, line))
+        {
+            // Admitimos ficheros con fin de línea de Windows.
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            if (!line.empty() && line[0] != '#')
+                inputs.push_back(line);
+        }
+    }
+    else
+    {
+        std::vector<cv::String> found;
+        cv::glob(source, found, false);
+        inputs.assign(found.begin(), found.end());
+    }
+    return inputs;
+}
+
+int
+cbg_batch_process(const std::vector<std::string> &inputs,
+                  const std::string &out_dir, const CbgParams &params,
+                  const CbgBatchOptions &opts)
+{
+    CV_Assert(opts.queue_size > 0);
+    CV_Assert(opts.jpeg_quality >= 0 && opts.jpeg_quality <= 100);
+    CV_Assert(opts.png_compression >= 0 && opts.png_compression <= 9);
+    if (!cv::utils::fs::createDirectories(out_dir))
+    {
+        std::cerr << "Error: could not create the output directory '" << out_dir << "'." << std::endl;
+        return int(inputs.size());
+    }
+    // Dos entradas con la misma ruta de salida se pisarían: no se procesa nada.
+    const std::vector<std::string> out_names = output_names(inputs, out_dir);
+    std::set<std::string> out_dirs;
+    {
+        std::map<std::string, size_t> seen;
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            auto it = seen.insert(std::make_pair(out_names[i], i));
+            if (!it.second)
+            {
+                std::cerr << "Error: '" << inputs[it.first->second] << "' and '" << inputs[i]
+                          << "' would both be saved as '" << out_names[i] << "'." << std::endl;
+                return int(inputs.size());
+            }
+            out_dirs.insert(parent_dir(out_names[i]));
+        }
+    }
+    for (const std::string &dir : out_dirs)
+        if (!cv::utils::fs::createDirectories(dir))
+        {
+            std::cerr << "Error: could not create the output directory '" << dir << "'." << std::endl;
+            return int(inputs.size());
+        }
+
+    // Cada etapa (lectura/decodificación, proceso y codificación/escritura)
+    // tiene n_threads hilos, separados por colas acotadas.
+    unsigned n_threads = opts.threads > 0 ? unsigned(opts.threads)
+                                          : std::max(1u, std::thread::hardware_concurrency() / 2);
+    n_threads = std::min<unsigned>(n_threads, std::max<size_t>(1, inputs.size()));
+    const std::vector<int> write_params = {cv::IMWRITE_JPEG_QUALITY, opts.jpeg_quality,
+                                           cv::IMWRITE_PNG_COMPRESSION, opts.png_compression};
+
+    BoundedQueue<BatchJob> decoded(opts.queue_size);
+    BoundedQueue<BatchJob> processed(opts.queue_size);
+    std::atomic<size_t> next(0);
+    std::atomic<unsigned> live_decoders(n_threads), live_processors(n_threads);
+    std::atomic<size_t> done(0), failed(0);
+    std::atomic<unsigned long long> bytes_in(0), bytes_out(0);
+    std::mutex log_mtx;
+    // El hilo principal espera en progress_cv a que acabe el lote o toque
+    // informar del progreso.
+    std::mutex progress_mtx;
+    std::condition_variable progress_cv;
+    auto finish_one = [&](std::atomic<size_t> &counter)
+    {
+        ++counter;
+        // Pasar por el mutex evita que el aviso se pierda entre la
+        // comprobación del hilo principal y su espera.
+        {
+            std::lock_guard<std::mutex> lk(progress_mtx);
+        }
+        progress_cv.notify_all();
+    };
+    auto report_error = [&](const std::string &msg)
+    {
+        {
+            std::lock_guard<std::mutex> lk(log_mtx);
+            std::cerr << "Error: " << msg << std::endl;
+        }
+        finish_one(failed);
+    };
+
+    auto decode_loop = [&]()
+    {
+        std::vector<uchar> buf;
+        for (size_t i = next++; i < inputs.size(); i = next++)
+        {
+            BatchJob job;
+            job.index = i;
+            job.name = inputs[i];
+            if (!read_file(job.name, buf))
+            {
+                report_error("could not read '" + job.name + "'.");
+                continue;
+            }
+            bytes_in += buf.size();
+            job.input = cv::imdecode(buf, cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH);
+            if (job.input.empty())
+            {
+                report_error("could not decode '" + job.name + "'.");
+                continue;
+            }
+            if (!decoded.push(std::move(job)))
+                break;
+        }
+        if (--live_decoders == 0)
+            decoded.close();
+    };
+
+    auto process_loop = [&]()
+    {
+        FsivCbgWorkspace ws;
+        BatchJob job;
+        while (decoded.pop(job))
+        {
+            try
+            {
+                cbg_render(job.input, job.output, cbg_auto_params(job.input, params), ws);
+            }
+            catch (cv::Exception &e)
+            {
+                report_error("could not process '" + job.name + "': " + e.what());
+                continue;
+            }
+            job.input.release();
+            if (!processed.push(std::move(job)))
+                break;
+        }
+        if (--live_processors == 0)
+            processed.close();
+    };
+
+    auto encode_loop = [&]()
+    {
+        std::vector<uchar> buf;
+        BatchJob job;
+        while (processed.pop(job))
+        {
+            const std::string &out_name = out_names[job.index];
+            bool ok = false;
+            try
+            {
+                ok = cv::imencode(extension(job.name), job.output, buf, write_params) &&
+                     write_file(out_name, buf);
+            }
+            catch (cv::Exception &)
+            {
+            }
+            if (!ok)
+            {
+                report_error("could not save the result in file '" + out_name + "'.");
+                continue;
+            }
+            bytes_out += buf.size();
+            finish_one(done);
+        }
+    };
+
+    const int64_t start = cv::getTickCount();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < n_threads; ++i)
+        threads.emplace_back(decode_loop);
+    for (unsigned i = 0; i < n_threads; ++i)
+        threads.emplace_back(process_loop);
+    for (unsigned i = 0; i < n_threads; ++i)
+        threads.emplace_back(encode_loop);
+
+    auto print_progress = [&](const char *label)
+    {
+        const double s = std::max(1e-6, (cv::getTickCount() - start) / cv::getTickFrequency());
+        std::lock_guard<std::mutex> lk(log_mtx);
+        std::cout << label << done << '/' << inputs.size() << " images"
+                  << std::fixed << std::setprecision(1)
+                  << ", " << done / s << " images/s"
+                  << ", read " << bytes_in / s / 1.0e6 << " MB/s"
+                  << ", written " << bytes_out / s / 1.0e6 << " MB/s"
+                  << std::defaultfloat << std::endl;
+    };
+    auto finished = [&]() { return done + failed >= inputs.size(); };
+    {
+        std::unique_lock<std::mutex> lk(progress_mtx);
+        if (opts.report_every_s > 0.0)
+        {
+            const std::chrono::duration<double> period(opts.report_every_s);
+            while (!progress_cv.wait_for(lk, period, finished))
+                print_progress("Progress: ");
+        }
+        else
+            progress_cv.wait(lk, finished);
+    }
+    for (auto &t : threads)
+        t.join();
+    print_progress("Done: ");
+    if (failed > 0)
+        std::cerr << failed << " images could not be processed." << std::endl;
+    return int(failed);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cbg_renderer.hpp"
+
+/**
+ * @brief Opciones del modo por lotes.
+ */
+struct CbgBatchOptions
+{
+    int threads = 0;          /*< hilos de cada etapa: decodificación, proceso y codificación (0: auto).*/
+    int jpeg_quality = 95;    /*< calidad JPEG [0,100].*/
+    int png_compression = 3;  /*< compresión PNG [0,9].*/
+    size_t queue_size = 8;    /*< imágenes en vuelo entre cada par de etapas.*/
+    double report_every_s = 1.0; /*< periodo del informe de progreso.*/
+};
+
+/**
+ * @brief Obtiene la lista de imágenes a procesar.
+ * @param source un patrón de cv::glob (un directorio seguido de *.jpg, por
+ *        ejemplo) o un fichero .txt/.lst con una ruta por línea.
+ * @return las rutas encontradas.
+ */
+std::vector<std::string> cbg_batch_list_inputs(const std::string &source);
+
+/**
+ * @brief Procesa un lote de imágenes y las guarda en out_dir.
+ *
+ * Las imágenes pasan por un pipeline acotado: varios hilos leen y
+ * decodifican, varios hilos (cada uno con su FsivCbgWorkspace) aplican el
+ * proceso contraste/brillo/gamma y varios hilos codifican y escriben el
+ * resultado en out_dir. Cada salida conserva su ruta relativa al directorio
+ * común a todas las entradas, de modo que ficheros de directorios distintos
+ * con el mismo nombre no se pisan; si aun así dos entradas dieran la misma
+ * salida no se procesa nada. Periódicamente se informa del progreso en
+ * imágenes/s y MB/s.
+ *
+ * @param inputs rutas de las imágenes de entrada.
+ * @param out_dir directorio de salida (se crea si no existe).
+ * @param params parámetros del proceso. Con auto_cbg se estiman para cada
+ *        imagen por separado.
+ * @param opts opciones del lote.
+ * @return el número de imágenes que no se pudieron procesar.
+ */
+int cbg_batch_process(const std::vector<std::string> &inputs,
+                      const std::string &out_dir, const CbgParams &params,
+                      const CbgBatchOptions &opts = CbgBatchOptions());
@@ -0,0 +1,346 @@
+/*!
+  Benchmark de las funciones fsiv del módulo cbg.
+
+  Mide el tiempo medio por imagen y cuenta cuántas reservas de memoria de
+  cv::Mat se hacen en cada llamada.
+
+  Uso: cbg_bench [-n=<iters>] <bench_name> [<input>]
+*/
+
+#include <iostream>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "common_code.hpp"
+#include "cbg_sweep.hpp"
+#include "counting_allocator.hpp"
+
+const cv::String keys =
+    "{help h usage ? |      | print this message.}"
+    "{n iters        |100   | number of iterations.}"
+    "{@bench         |into  | benchmark to run: into, lut, fixed, half, channels, linear, sweep, estimate, hsv.}"
+    "{@input         |data/ciclista_original.jpg| input image.}";
+
+static CountingAllocator allocator;
+
+/**
+ * @brief Ejecuta f iters veces e informa de tiempo y reservas por iteración.
+ */
+template <class F>
+static void
+run(const std::string &name, int iters, F f)
+{
+    f(); // calentamiento: la primera llamada puede reservar los buffers.
+    const long allocs0 = allocator.count();
+    cv::TickMeter tm;
+    tm.start();
+    for (int i = 0; i < iters; ++i)
+        f();
+    tm.stop();
+    const double allocs = double(allocator.count() - allocs0) / iters;
+    std::cout << name << ": " << tm.getTimeMilli() / iters << " ms/img, "
+              << allocs << " allocs/img." << std::endl;
+}
+
+static void
+bench_into(const cv::Mat &img, int iters)
+{
+    const double c = 1.2, b = 0.05, g = 0.8;
+    cv::Mat out;
+    FsivCbgWorkspace ws;
+    for (int luma = 0; luma < 2; ++luma)
+    {
+        const std::string mode = luma ? " (luma)" : "";
+        run("fsiv_cbg_process" + mode, iters, [&]()
+            { out = fsiv_cbg_process(img, c, b, g, luma); });
+        run("fsiv_cbg_process_into" + mode, iters, [&]()
+            { fsiv_cbg_process_into(img, out, c, b, g, luma, &ws); });
+    }
+}
+
+static void
+bench_lut(const cv::Mat &img, int iters)
+{
+    cv::Mat out;
+    FsivCbgWorkspace ws;
+    double c = 1.2;
+    for (int luma = 0; luma < 2; ++luma)
+    {
+        const std::string mode = luma ? " (luma)" : "";
+        // Simula el arrastre de un deslizador: cambia un parámetro cada vez.
+        run("fsiv_cbg_process_into" + mode, iters, [&]()
+            { c = 2.2 - c; fsiv_cbg_process_into(img, out, c, 0.05, 0.8, luma, &ws); });
+        fsiv_cbg_prepare(img, luma, ws);
+        run("fsiv_cbg_apply" + mode, iters, [&]()
+            { c = 2.2 - c; fsiv_cbg_apply(ws, out, c, 0.05, 0.8); });
+        run("fsiv_cbg_process_lut_into" + mode, iters, [&]()
+            { c = 2.2 - c; fsiv_cbg_process_lut_into(img, out, c, 0.05, 0.8, luma, &ws); });
+    }
+}
+
+/**
+ * @brief Camino en float para cualquier profundidad (la referencia de
+ * fsiv_cbg_process sólo admite 8 bits).
+ */
+static cv::Mat
+float_reference(const cv::Mat &img, double c, double b, double g, bool luma)
+{
+    const double max_v = img.depth() == CV_8U ? 255.0 : 65535.0;
+    cv::Mat flt, out;
+    img.convertTo(flt, CV_32F, 1.0 / max_v);
+    if (luma && img.channels() == 3)
+    {
+        std::vector<cv::Mat> planes;
+        cv::cvtColor(flt, flt, cv::COLOR_BGR2HSV);
+        cv::split(flt, planes);
+        cv::pow(planes[2], g, planes[2]);
+        planes[2].convertTo(planes[2], CV_32F, c, b);
+        cv::merge(planes, flt);
+        cv::cvtColor(flt, flt, cv::COLOR_HSV2BGR);
+    }
+    else
+    {
+        cv::pow(flt, g, flt);
+        flt.convertTo(flt, CV_32F, c, b);
+    }
+    flt.convertTo(out, img.depth(), max_v);
+    return out;
+}
+
+/**
+ * @brief Informa del error de result respecto de expected.
+ */
+static void
+report_error(const std::string &name, const cv::Mat &result, const cv::Mat &expected)
+{
+    cv::Mat diff;
+    cv::absdiff(result, expected, diff);
+    const double max_err = cv::norm(diff, cv::NORM_INF);
+    const double mean_err = cv::mean(diff.reshape(1))[0];
+    const double differing = double(cv::countNonZero(diff.reshape(1))) / diff.total() / diff.channels();
+    std::cout << name << ": max. error " << max_err << ", mean error " << mean_err
+              << ", " << 100.0 * differing << "% samples differ." << std::endl;
+}
+
+static void
+bench_fixed(const cv::Mat &img, int iters)
+{
+    cv::Mat img16, out;
+    img.convertTo(img16, CV_16U, 257.0); // 0..255 -> 0..65535
+    FsivCbgWorkspace ws;
+    // f(V) <= 1 para que el recorte de V no influya en el error.
+    const double c = 0.8, b = 0.1, g = 0.7;
+    for (int luma = 0; luma < 2; ++luma)
+    {
+        const std::string mode = luma ? " (luma)" : "";
+        run("fsiv_cbg_process_into" + mode, iters, [&]()
+            { fsiv_cbg_process_into(img, out, c, b, g, luma, &ws); });
+        run("fsiv_cbg_process_lut_into" + mode, iters, [&]()
+            { fsiv_cbg_process_lut_into(img, out, c, b, g, luma, &ws); });
+        run("fsiv_cbg_process_fixed_into" + mode, iters, [&]()
+            { fsiv_cbg_process_fixed_into(img, out, c, b, g, luma, &ws); });
+        report_error("  8 bits vs float" + mode, out, float_reference(img, c, b, g, luma));
+        run("float 16 bits" + mode, iters, [&]()
+            { out = float_reference(img16, c, b, g, luma); });
+        run("fsiv_cbg_process_fixed_into 16 bits" + mode, iters, [&]()
+            { fsiv_cbg_process_fixed_into(img16, out, c, b, g, luma, &ws); });
+        report_error("  16 bits vs float" + mode, out, float_reference(img16, c, b, g, luma));
+    }
+}
+
+static void
+bench_half(const cv::Mat &img, int iters)
+{
+    cv::Mat out, expected;
+    const double c = 1.2, b = 0.05, g = 0.8;
+    const int depths[] = {CV_32F, CV_16F};
+    for (int luma = 0; luma < 2; ++luma)
+    {
+        const std::string mode = luma ? " (luma)" : "";
+        for (int depth : depths)
+        {
+            FsivCbgWorkspace ws;
+            ws.flt_depth = depth;
+            const std::string name = depth == CV_16F ? " CV_16F" : " CV_32F";
+            run("fsiv_convert_image_byte_to_float_into" + name, iters, [&]()
+                { fsiv_convert_image_byte_to_float_into(img, ws.flt, depth); });
+            run("fsiv_cbg_prepare" + name + mode, iters, [&]()
+                { fsiv_cbg_prepare(img, luma, ws); });
+            run("fsiv_cbg_apply" + name + mode, iters, [&]()
+                { fsiv_cbg_apply(ws, out, c, b, g); });
+            size_t bytes = ws.flt.total() * ws.flt.elemSize();
+            if (luma)
+                bytes += ws.hsv.total() * ws.hsv.elemSize() * 2; // hsv y planes.
+            std::cout << "  intermediate buffers: " << bytes / 1.0e6 << " MB" << std::endl;
+            if (depth == CV_32F)
+                expected = out.clone();
+            else
+                report_error("  CV_16F vs CV_32F" + mode, out, expected);
+        }
+    }
+}
+
+static void
+bench_channels(const cv::Mat &img, int iters)
+{
+    cv::Mat out;
+    FsivCbgWorkspace ws;
+    const cv::Vec3d c(1.1, 1.0, 0.9), b(0.02, 0.0, -0.02), g(0.9, 1.0, 1.1);
+    run("fsiv_cbg_process_lut_into (one curve)", iters, [&]()
+        { fsiv_cbg_process_lut_into(img, out, c[0], b[0], g[0], false, &ws); });
+    run("fsiv_cbg_process_channels_into", iters, [&]()
+        { fsiv_cbg_process_channels_into(img, out, c, b, g, &ws); });
+    // Lo que se quiere evitar: separar los canales, tres tablas y unir.
+    std::vector<cv::Mat> planes;
+    cv::Mat luts[3];
+    for (int i = 0; i < 3; ++i)
+        fsiv_cbg_build_lut(c[i], b[i], g[i], luts[i]);
+    run("split + 3 x cv::LUT + merge", iters, [&]()
+        {
+            cv::split(img, planes);
+            for (int i = 0; i < 3; ++i)
+                cv::LUT(planes[i], luts[i], planes[i]);
+            cv::merge(planes, out);
+        });
+}
+
+static void
+bench_linear(const cv::Mat &img, int iters)
+{
+    cv::Mat out;
+    FsivCbgWorkspace ws;
+    double c = 1.2;
+    for (int luma = 0; luma < 2; ++luma)
+    {
+        const std::string mode = luma ? " (luma)" : "";
+        // Cambia un parámetro en cada iteración, como al mover un deslizador.
+        run("fsiv_cbg_process_lut_into" + mode, iters, [&]()
+            { c = 2.2 - c; fsiv_cbg_process_lut_into(img, out, c, 0.05, 0.8, luma, &ws); });
+        run("fsiv_cbg_process_linear_into" + mode, iters, [&]()
+            { c = 2.2 - c; fsiv_cbg_process_linear_into(img, out, c, 0.05, 0.8, luma, &ws); });
+    }
+}
+
+static void
+bench_sweep(const cv::Mat &img, int iters)
+{
+    CbgSweepGrid grid;
+    const std::vector<CbgParams> cells = grid.cells(CbgParams());
+    std::vector<cv::Mat> outs(cells.size());
+    std::vector<FsivCbgWorkspace> ws(cells.size());
+    run("cbg_render x " + std::to_string(cells.size()), iters, [&]()
+        {
+            for (size_t i = 0; i < cells.size(); ++i)
+                cbg_render(img, outs[i], cells[i], ws[i]);
+        });
+    run("cbg_render_sweep (read once, write N)", iters, [&]()
+        { cbg_render_sweep(img, cells, outs); });
+    cv::Mat sheet;
+    run("cbg_render_contact_sheet (1600 px)", iters, [&]()
+        { cbg_render_contact_sheet(img, grid, CbgParams(), 1600, sheet); });
+}
+
+static void
+bench_estimate(const cv::Mat &img, int iters)
+{
+    cv::Mat out;
+    FsivCbgWorkspace ws;
+    FsivCbgAutoState state;
+    double c = 1.0, b = 0.0, g = 1.0;
+    run("fsiv_estimate_cbg_params", iters, [&]()
+        { fsiv_estimate_cbg_params(img, c, b, g, &state); });
+    // Referencia: lo que cuesta aplicar los parámetros a la misma imagen.
+    run("fsiv_cbg_process_lut_into", iters, [&]()
+        { fsiv_cbg_process_lut_into(img, out, c, b, g, true, &ws); });
+    std::cout << "Estimated: contrast " << c << ", bright " << b << ", gamma " << g << std::endl;
+}
+
+static void
+bench_hsv(const cv::Mat &img, int iters)
+{
+    cv::Mat flt, hsv, v;
+    std::vector<cv::Mat> planes;
+    img.convertTo(flt, CV_32F, 1.0 / 255.0);
+    run("cvtColor BGR2HSV (8U)", iters, [&]()
+        { cv::cvtColor(img, hsv, cv::COLOR_BGR2HSV); });
+    run("fsiv_convert_bgr_to_v_into (8U)", iters, [&]()
+        { fsiv_convert_bgr_to_v_into(img, v); });
+    run("cvtColor BGR2HSV + split (32F)", iters, [&]()
+        {
+            cv::cvtColor(flt, hsv, cv::COLOR_BGR2HSV);
+            cv::split(hsv, planes);
+        });
+    run("fsiv_convert_bgr_to_hsv_planes_into (32F)", iters, [&]()
+        { fsiv_convert_bgr_to_hsv_planes_into(flt, planes); });
+    run("fsiv_convert_bgr_to_v_into (32F)", iters, [&]()
+        { fsiv_convert_bgr_to_v_into(flt, v); });
+}
+
+int main(int argc, char *const *argv)
+{
+    int retCode = EXIT_SUCCESS;
+    try
+    {
+        cv::CommandLineParser parser(argc, argv, keys);
+        parser.about("Benchmark the fsiv cbg functions.");
+        if (parser.has("help"))
+        {
+            parser.printMessage();
+            return 0;
+        }
+        const int iters = parser.get<int>("n");
+        const std::string bench = parser.get<std::string>("@bench");
+        const std::string input_name = parser.get<std::string>("@input");
+        if (!parser.check())
+        {
+            parser.printErrors();
+            return EXIT_FAILURE;
+        }
+
+        cv::Mat::setDefaultAllocator(&allocator);
+        cv::Mat img = cv::imread(input_name, cv::IMREAD_COLOR);
+        if (img.empty())
+        {
+            std::cerr << "Error: could not open the input image '" << input_name << "'." << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Input: " << input_name << " " << img.size() << std::endl;
+
+        if (bench == "into")
+            bench_into(img, iters);
+        else if (bench == "lut")
+            bench_lut(img, iters);
+        else if (bench == "fixed")
+            bench_fixed(img, iters);
+        else if (bench == "half")
+            bench_half(img, iters);
+        else if (bench == "channels")
+            bench_channels(img, iters);
+        else if (bench == "linear")
+            bench_linear(img, iters);
+        else if (bench == "sweep")
+            bench_sweep(img, iters);
+        else if (bench == "estimate")
+            bench_estimate(img, iters);
+        else if (bench == "hsv")
+            bench_hsv(img, iters);
+        else
+        {
+            std::cerr << "Error: unknown benchmark '" << bench << "'." << std::endl;
+            retCode = EXIT_FAILURE;
+        }
+        cv::Mat::setDefaultAllocator(nullptr);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        retCode = EXIT_FAILURE;
+    }
+    return retCode;
+}
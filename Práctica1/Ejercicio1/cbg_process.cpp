@@ -10,7 +10,10 @@
 */
 
 #include <iostream>
+#include <cstdio>
 #include <exception>
+#include <memory>
+#include <sstream>
 
 // Includes para OpenCV, Descomentar según los módulo utilizados.
 #include <opencv2/core/core.hpp>
@@ -20,31 +23,161 @@
 // #include <opencv2/calib3d/calib3d.hpp>
 
 #include "common_code.hpp"
+#include "cbg_renderer.hpp"
+#include "coalescing_scheduler.hpp"
+#include "cbg_stream.hpp"
+#include "cbg_batch.hpp"
+#include "cbg_strip.hpp"
+#include "cbg_sweep.hpp"
 
 const cv::String keys =
     "{help h usage ? |      | print this message.}"
     "{i interactive  |      | Activate interactive mode.}"
     "{l luma         |      | process only \"luma\" if color image.}"
+    "{f float        |      | use the float path instead of lookup tables.}"
+    "{half           |      | use half-precision (CV_16F) intermediates in the float path.}"
+    "{L linear       |      | apply contrast/bright/gamma in linear light (sRGB decoded).}"
+    "{a auto         |      | estimate contrast/bright/gamma from the luma histogram (every frame in video mode).}"
+    "{x fixed        |      | use the fixed-point integer path (always used for 16-bit images).}"
     "{c contrast     |1.0   | contrast parameter.}"
     "{b bright       |0.0   | bright parameter.}"
     "{g gamma        |1.0   | gamma parameter.}"
+    "{c3             |      | per-channel contrast B,G,R (e.g. 1.1,1.0,0.9).}"
+    "{b3             |      | per-channel bright B,G,R.}"
+    "{g3             |      | per-channel gamma B,G,R.}"
+    "{v video        |      | the input is a video file.}"
+    "{C camera       |      | the input is a camera index.}"
+    "{fourcc         |MJPG  | fourcc code of the output video.}"
+    "{B batch        |      | batch mode: @input is a glob pattern or a .txt/.lst list of images and @output an output folder.}"
+    "{S strips       |      | strip mode for huge images: @input and @output are binary PPM/PGM files processed in horizontal strips.}"
+    "{sweep          |      | contact sheet of contrast x gamma variants \"c0:c1:nc,g0:g1:ng\" saved in @output.}"
+    "{sweep_width    |1600  | width of the contact sheet.}"
+    "{sweep_all      |      | also save every sweep variant at full resolution as <output>_cC_gG.<ext>.}"
+    "{memory         |256   | memory budget (MB) for the strips in strip mode.}"
+    "{threads        |0     | threads per stage (decode, process, encode) in batch mode, processing threads in strip mode (0: auto).}"
+    "{jpeg_quality   |95    | JPEG quality [0, 100] in batch mode.}"
+    "{png_compression|3     | PNG compression level [0, 9] in batch mode.}"
     "{@input         |<none>| input image.}"
     "{@output        |<none>| output image.}";
 
+typedef CoalescingScheduler<CbgParams, cv::Mat> CbgScheduler;
+
+// Tiempo mínimo entre dos renders del proxy en modo interactivo.
+const int FRAME_BUDGET_MS = 33;
+
+struct UserData;
+
+// Identifica el deslizador de un parámetro de un canal.
+struct ChannelTrackbar
+{
+    UserData *data;
+    int param;   // 0: contraste, 1: brillo, 2: gamma.
+    int channel; // 0: B, 1: G, 2: R.
+};
+
 struct UserData
 {
     cv::Mat input;
     cv::Mat output;
-    double contrast;
-    double bright;
-    double gamma;
-    bool luma_is_set;
+    cv::Mat proxy_input;  // input reducida al tamaño de la ventana.
+    cv::Mat proxy_output; // lo que se muestra mientras se mueven los deslizadores.
+    double contrast = 1.0;
+    double bright = 0.0;
+    double gamma = 1.0;
+    bool luma_is_set = false;
+    bool use_float = false;
+    bool use_fixed = false;
+    bool use_half = false;
+    bool linear = false;
+    bool per_channel = false;   // curvas distintas para B, G y R.
+    bool auto_cbg = false;      // estimar c, b y g de cada imagen/frame.
+    cv::Vec3d channel_contrast = cv::Vec3d::all(1.0);
+    cv::Vec3d channel_bright = cv::Vec3d::all(0.0);
+    cv::Vec3d channel_gamma = cv::Vec3d::all(1.0);
+    ChannelTrackbar channel_bars[9];
+    CbgScheduler *scheduler = nullptr; // render del proxy en un hilo (modo interactivo).
+    CbgRenderer *renderer = nullptr;   // render a resolución completa en segundo plano.
+    CbgStream *stream = nullptr;       // pipeline de vídeo (modo vídeo/cámara).
+    bool output_is_current = false;    // output corresponde a los parámetros actuales.
+
+    // Estado del render del proxy. Sólo lo usa el hilo de scheduler.
+    FsivCbgWorkspace ws;    // buffers reutilizados entre llamadas.
+    int prepared_luma = -1; // modo luma con el que se preparó ws (-1: ninguno).
 };
 
+CbgParams get_params(const UserData *p)
+{
+    CbgParams params;
+    params.contrast = p->contrast;
+    params.bright = p->bright;
+    params.gamma = p->gamma;
+    params.luma_is_set = p->luma_is_set;
+    params.use_float = p->use_float;
+    params.use_fixed = p->use_fixed;
+    params.use_half = p->use_half;
+    params.linear = p->linear;
+    params.per_channel = p->per_channel;
+    params.auto_cbg = p->auto_cbg;
+    params.channel_contrast = p->channel_contrast;
+    params.channel_bright = p->channel_bright;
+    params.channel_gamma = p->channel_gamma;
+    return params;
+}
+
+void render_proxy(UserData *p, const CbgParams &params, cv::Mat &out)
+{
+    if (params.use_float && !params.use_fixed && !params.per_channel && !params.linear &&
+        p->proxy_input.depth() == CV_8U)
+    {
+        // La conversión a float/HSV no depende de los deslizadores C/B/G,
+        // así que sólo se rehace cuando cambia el modo luma.
+        if (p->prepared_luma != int(params.luma_is_set))
+        {
+            p->ws.flt_depth = params.use_half ? CV_16F : CV_32F;
+            fsiv_cbg_prepare(p->proxy_input, params.luma_is_set, p->ws);
+            p->prepared_luma = params.luma_is_set;
+        }
+        fsiv_cbg_apply(p->ws, out, params.contrast, params.bright, params.gamma);
+    }
+    else
+        // Cada cambio sólo recalcula las tablas.
+        cbg_render(p->proxy_input, out, params, p->ws);
+}
+
+/**
+ * @brief Anota los parámetros actuales para que se rendericen.
+ *
+ * Se llama desde las callbacks, así que no procesa nada: el proxy lo
+ * renderiza el hilo de scheduler y la resolución completa el de renderer.
+ */
 void process_image(UserData *p)
 {
-    p->output = fsiv_cbg_process(p->input, p->contrast, p->bright,
-                                 p->gamma, p->luma_is_set);
+    const CbgParams params = get_params(p);
+    if (p->stream != nullptr)
+    {
+        // Se aplica a partir del siguiente frame.
+        p->stream->set_params(params);
+        return;
+    }
+    p->output_is_current = false;
+    if (p->scheduler != nullptr)
+        p->scheduler->post(params);
+    else
+        render_proxy(p, params, p->proxy_output);
+    if (p->renderer != nullptr)
+        p->renderer->request(params);
+}
+
+/**
+ * @brief Asegura que output está procesada a resolución completa.
+ */
+void commit_full_resolution(UserData *p)
+{
+    if (p->output_is_current)
+        return;
+    FsivCbgWorkspace ws;
+    cbg_render(p->input, p->output, get_params(p), ws);
+    p->output_is_current = true;
 }
 
 void contrast_trackbar(int pos, void *userdata)
@@ -53,7 +186,6 @@ void contrast_trackbar(int pos, void *userdata)
     d->contrast = float(pos) / 200.0 * 2.0;
     std::cout << "Set contrast to " << d->contrast << std::endl;
     process_image(d);
-    cv::imshow("PROCESSED", d->output);
 }
 
 void bright_trackbar(int pos, void *userdata)
@@ -62,7 +194,6 @@ void bright_trackbar(int pos, void *userdata)
     d->bright = (float(pos) - 100.0) / 100.0;
     std::cout << "Set bright to " << d->bright << std::endl;
     process_image(d);
-    cv::imshow("PROCESSED", d->output);
 }
 
 void gamma_trackbar(int pos, void *userdata)
@@ -71,7 +202,6 @@ void gamma_trackbar(int pos, void *userdata)
     d->gamma = float(pos) / 200.0 * 2.0;
     std::cout << "Set gamma to " << d->gamma << std::endl;
     process_image(d);
-    cv::imshow("PROCESSED", d->output);
 }
 
 void luma_trackbar(int pos, void *userdata)
@@ -80,7 +210,150 @@ void luma_trackbar(int pos, void *userdata)
     d->luma_is_set = (pos == 1);
     std::cout << "Set luma mode to state " << d->luma_is_set << std::endl;
     process_image(d);
-    cv::imshow("PROCESSED", d->output);
+}
+
+void channel_trackbar(int pos, void *userdata)
+{
+    const ChannelTrackbar *t = static_cast<const ChannelTrackbar *>(userdata);
+    UserData *d = t->data;
+    static const char *const names[] = {"contrast", "bright", "gamma"};
+    static const char *const channels[] = {"B", "G", "R"};
+    double v;
+    if (t->param == 0)
+        v = d->channel_contrast[t->channel] = float(pos) / 200.0 * 2.0;
+    else if (t->param == 1)
+        v = d->channel_bright[t->channel] = (float(pos) - 100.0) / 100.0;
+    else
+        v = d->channel_gamma[t->channel] = float(pos) / 200.0 * 2.0;
+    std::cout << "Set " << names[t->param] << " of channel " << channels[t->channel]
+              << " to " << v << std::endl;
+    process_image(d);
+}
+
+/**
+ * @brief Crea los deslizadores de los parámetros.
+ *
+ * En modo por canal hay un deslizador por parámetro y canal y no hay modo
+ * luma.
+ *
+ * @param pos posiciones de los deslizadores globales (C, B, G, Luma).
+ * @param channel_pos posiciones de los deslizadores por canal.
+ */
+void create_trackbars(UserData &data, int pos[4], int channel_pos[9])
+{
+    if (!data.per_channel)
+    {
+        cv::createTrackbar("C", "PARAMETERS", &pos[0], 200, contrast_trackbar, &data);
+        cv::createTrackbar("B", "PARAMETERS", &pos[1], 200, bright_trackbar, &data);
+        cv::createTrackbar("G", "PARAMETERS", &pos[2], 200, gamma_trackbar, &data);
+        cv::createTrackbar("Luma", "PARAMETERS", &pos[3], 1, luma_trackbar, &data);
+        return;
+    }
+    static const char *const names[] = {"C", "B", "G"};
+    static const char *const channels[] = {" blue", " green", " red"};
+    for (int param = 0; param < 3; ++param)
+        for (int c = 0; c < 3; ++c)
+        {
+            const int i = 3 * param + c;
+            ChannelTrackbar &t = data.channel_bars[i];
+            t.data = &data;
+            t.param = param;
+            t.channel = c;
+            if (param == 0)
+                channel_pos[i] = int(data.channel_contrast[c] / 2.0 * 200);
+            else if (param == 1)
+                channel_pos[i] = int((data.channel_bright[c] + 1.0) / 2.0 * 200);
+            else
+                channel_pos[i] = int(data.channel_gamma[c] / 2.0 * 200);
+            cv::createTrackbar(std::string(names[param]) + channels[c], "PARAMETERS",
+                               &channel_pos[i], 200, channel_trackbar, &t);
+        }
+}
+
+/**
+ * @brief Lee un parámetro por canal de la forma "B,G,R".
+ * @param v recibe el valor. Si el parámetro no se dio, no se cambia.
+ * @return false si el formato es incorrecto.
+ */
+bool get_vec3(const cv::CommandLineParser &parser, const std::string &name, cv::Vec3d &v)
+{
+    if (!parser.has(name))
+        return true;
+    const std::string text = parser.get<std::string>(name);
+    char sep1 = 0, sep2 = 0;
+    std::istringstream in(text);
+    return bool(in >> v[0] >> sep1 >> v[1] >> sep2 >> v[2]) && sep1 == ',' && sep2 == ',';
+}
+
+/**
+ * @brief Procesa un vídeo o una cámara y guarda el resultado.
+ *
+ * Decodificación, proceso y codificación se hacen en hilos distintos para
+ * que se solapen. Los deslizadores cambian los parámetros en caliente.
+ *
+ * @return el código de salida del programa.
+ */
+int process_stream(UserData &data, cv::VideoCapture &capt,
+                   const std::string &output_name, const std::string &fourcc)
+{
+    double fps = capt.get(cv::CAP_PROP_FPS);
+    if (fps <= 0.0)
+        fps = 25.0; // algunas cámaras no lo informan.
+
+    cv::VideoWriter writer;
+    CbgStream stream(capt, get_params(&data));
+    data.stream = &stream;
+
+    CbgStreamFrame f;
+    int frames = 0;
+    double decode_ms = 0.0, process_ms = 0.0, encode_ms = 0.0, latency_ms = 0.0;
+    const double ms_per_tick = 1000.0 / cv::getTickFrequency();
+    const int64_t start = cv::getTickCount();
+    int key = 0;
+    bool ok = true;
+    cv::Vec3d last_params;
+    while (key != 27 && stream.next(f))
+    {
+        if (!writer.isOpened() &&
+            !writer.open(output_name,
+                         cv::VideoWriter::fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]),
+                         fps, f.output.size(), f.output.channels() == 3))
+        {
+            std::cerr << "Error: could not open the output video '" << output_name << "'." << std::endl;
+            ok = false;
+            break;
+        }
+        const int64_t t0 = cv::getTickCount();
+        writer.write(f.output);
+        const int64_t t1 = cv::getTickCount();
+
+        ++frames;
+        decode_ms += f.decode_ms;
+        process_ms += f.process_ms;
+        encode_ms += (t1 - t0) * ms_per_tick;
+        latency_ms += (t1 - f.start) * ms_per_tick;
+        last_params = f.params;
+
+        cv::imshow("ORIGINAL", f.input);
+        cv::imshow("PROCESSED", f.output);
+        key = cv::waitKey(1) & 0xff;
+        stream.recycle(std::move(f));
+    }
+    stream.stop();
+    data.stream = nullptr;
+
+    const double wall_s = (cv::getTickCount() - start) * ms_per_tick / 1000.0;
+    if (frames > 0)
+        std::cout << "Frames: " << frames << ", sustained FPS: " << frames / wall_s
+                  << ". Mean latency (ms): decode " << decode_ms / frames
+                  << ", process " << process_ms / frames
+                  << ", encode " << encode_ms / frames
+                  << ", end-to-end " << latency_ms / frames
+                  << ". LUT rebuilds: " << stream.lut_rebuilds() << "." << std::endl;
+    if (frames > 0 && data.auto_cbg)
+        std::cout << "Last estimated parameters: contrast " << last_params[0]
+                  << ", bright " << last_params[1] << ", gamma " << last_params[2] << std::endl;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char *const *argv)
@@ -106,22 +379,23 @@ int main(int argc, char *const *argv)
             parser.printErrors();
             return 0;
         }
-
-        cv::namedWindow("ORIGINAL", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
-        cv::resizeWindow("ORIGINAL", cv::Size(800, 600));
-        cv::namedWindow("PROCESSED", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
-        cv::resizeWindow("PROCESSED", cv::Size(800, 600));
-        cv::namedWindow("PARAMETERS", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_AUTOSIZE);
+        std::cout << "fsiv_core: using the " << fsiv_core_isa() << " kernels." << std::endl;
 
         UserData data;
         data.contrast = parser.get<double>("c");
         data.bright = parser.get<double>("b");
         data.gamma = parser.get<double>("g");
         data.luma_is_set = parser.has("l");
-        int c_int = data.contrast / 2.0 * 200;
-        int b_int = (data.bright + 1.0) / 2.0 * 200;
-        int g_int = data.gamma / 2.0 * 200;
-        int l_int = data.luma_is_set ? 1 : 0;
+        data.use_float = parser.has("f");
+        data.use_fixed = parser.has("x");
+        data.use_half = parser.has("half");
+        data.linear = parser.has("L");
+        data.auto_cbg = parser.has("a");
+        int trackbar_pos[4] = {int(data.contrast / 2.0 * 200),
+                               int((data.bright + 1.0) / 2.0 * 200),
+                               int(data.gamma / 2.0 * 200),
+                               data.luma_is_set ? 1 : 0};
+        int channel_pos[9];
 
         if (data.contrast < 0.0 || data.contrast > 2.0)
         {
@@ -139,7 +413,149 @@ int main(int argc, char *const *argv)
             return EXIT_FAILURE;
         }
 
-        data.input = cv::imread(input_name, cv::IMREAD_ANYCOLOR);
+        // Los parámetros por canal que no se den valen como los globales.
+        data.channel_contrast = cv::Vec3d::all(data.contrast);
+        data.channel_bright = cv::Vec3d::all(data.bright);
+        data.channel_gamma = cv::Vec3d::all(data.gamma);
+        data.per_channel = parser.has("c3") || parser.has("b3") || parser.has("g3");
+        if (!get_vec3(parser, "c3", data.channel_contrast) ||
+            !get_vec3(parser, "b3", data.channel_bright) ||
+            !get_vec3(parser, "g3", data.channel_gamma))
+        {
+            std::cerr << "Error: per-channel parameters must have the form B,G,R." << std::endl;
+            return EXIT_FAILURE;
+        }
+        for (int c = 0; c < 3; ++c)
+            if (data.channel_contrast[c] < 0.0 || data.channel_contrast[c] > 2.0 ||
+                data.channel_bright[c] < -1.0 || data.channel_bright[c] > 1.0 ||
+                data.channel_gamma[c] < 0.0 || data.channel_gamma[c] > 2.0)
+            {
+                std::cerr << "Error: per-channel parameters must be in the same intervals as c, b and g." << std::endl;
+                return EXIT_FAILURE;
+            }
+
+        if (parser.has("S"))
+        {
+            if (data.auto_cbg)
+            {
+                // Cada franja daría una estimación distinta.
+                std::cerr << "Error: auto is not available in strip mode." << std::endl;
+                return EXIT_FAILURE;
+            }
+            const double budget_mb = parser.get<double>("memory");
+            if (budget_mb <= 0.0)
+            {
+                std::cerr << "Error: memory must be positive." << std::endl;
+                return EXIT_FAILURE;
+            }
+            const bool ok = cbg_process_strips(input_name, output_name, get_params(&data),
+                                               size_t(budget_mb * 1024.0 * 1024.0),
+                                               parser.get<int>("threads"));
+            return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (parser.has("B"))
+        {
+            // Sin ventanas: el modo por lotes puede usarse sin display.
+            const std::vector<std::string> inputs = cbg_batch_list_inputs(input_name);
+            if (inputs.empty())
+            {
+                std::cerr << "Error: no input images found in '" << input_name << "'." << std::endl;
+                return EXIT_FAILURE;
+            }
+            CbgBatchOptions opts;
+            opts.threads = parser.get<int>("threads");
+            opts.jpeg_quality = parser.get<int>("jpeg_quality");
+            opts.png_compression = parser.get<int>("png_compression");
+            if (opts.jpeg_quality < 0 || opts.jpeg_quality > 100 ||
+                opts.png_compression < 0 || opts.png_compression > 9)
+            {
+                std::cerr << "Error: jpeg_quality has values in [0, 100] and png_compression in [0, 9]." << std::endl;
+                return EXIT_FAILURE;
+            }
+            const int failed = cbg_batch_process(inputs, output_name, get_params(&data), opts);
+            return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (parser.has("sweep"))
+        {
+            CbgSweepGrid grid;
+            if (!cbg_parse_sweep(parser.get<std::string>("sweep"), grid))
+            {
+                std::cerr << "Error: sweep must have the form c0:c1:nc,g0:g1:ng." << std::endl;
+                return EXIT_FAILURE;
+            }
+            const int sheet_width = parser.get<int>("sweep_width");
+            if (sheet_width < grid.nc)
+            {
+                std::cerr << "Error: sweep_width is too small for " << grid.nc << " columns." << std::endl;
+                return EXIT_FAILURE;
+            }
+            const cv::Mat img = cv::imread(input_name, cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH);
+            if (img.empty())
+            {
+                std::cerr << "Error: could not open the input image '" << input_name << "'." << std::endl;
+                return EXIT_FAILURE;
+            }
+            const CbgParams base = get_params(&data);
+            cv::Mat sheet;
+            cbg_render_contact_sheet(img, grid, base, sheet_width, sheet);
+            if (!cv::imwrite(output_name, sheet))
+            {
+                std::cerr << "Error: could not save the result in file '" << output_name << "'." << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (parser.has("sweep_all"))
+            {
+                const std::vector<CbgParams> cells = grid.cells(base);
+                std::vector<cv::Mat> outs;
+                cbg_render_sweep(img, cells, outs);
+                const size_t dot = output_name.find_last_of('.');
+                const std::string stem = output_name.substr(0, dot);
+                const std::string ext = dot == std::string::npos ? ".png" : output_name.substr(dot);
+                for (size_t i = 0; i < cells.size(); ++i)
+                {
+                    char suffix[64];
+                    std::snprintf(suffix, sizeof(suffix), "_c%.2f_g%.2f", cells[i].contrast, cells[i].gamma);
+                    if (!cv::imwrite(stem + suffix + ext, outs[i]))
+                    {
+                        std::cerr << "Error: could not save the result in file '" << stem + suffix + ext << "'." << std::endl;
+                        return EXIT_FAILURE;
+                    }
+                }
+            }
+            return EXIT_SUCCESS;
+        }
+
+        cv::namedWindow("ORIGINAL", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
+        cv::resizeWindow("ORIGINAL", cv::Size(800, 600));
+        cv::namedWindow("PROCESSED", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
+        cv::resizeWindow("PROCESSED", cv::Size(800, 600));
+        cv::namedWindow("PARAMETERS", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_AUTOSIZE);
+
+        if (parser.has("v") || parser.has("C"))
+        {
+            const std::string fourcc = parser.get<std::string>("fourcc");
+            if (fourcc.size() != 4)
+            {
+                std::cerr << "Error: fourcc must have 4 characters." << std::endl;
+                return EXIT_FAILURE;
+            }
+            cv::VideoCapture capt;
+            if (parser.has("v"))
+                capt.open(input_name);
+            else
+                capt.open(std::stoi(input_name));
+            if (!capt.isOpened())
+            {
+                std::cerr << "Error: could not open the video stream '" << input_name << "'." << std::endl;
+                return EXIT_FAILURE;
+            }
+            create_trackbars(data, trackbar_pos, channel_pos);
+            return process_stream(data, capt, output_name, fourcc);
+        }
+
+        data.input = cv::imread(input_name, cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH);
 
         if (data.input.empty())
         {
@@ -147,31 +563,84 @@ int main(int argc, char *const *argv)
             return EXIT_FAILURE;
         }
 
-        data.input.copyTo(data.output);
+        if (data.auto_cbg)
+        {
+            // Una imagen fija se estima una vez; luego se ajusta a mano.
+            fsiv_estimate_cbg_params(data.input, data.contrast, data.bright, data.gamma);
+            data.auto_cbg = false;
+            data.channel_contrast = cv::Vec3d::all(data.contrast);
+            data.channel_bright = cv::Vec3d::all(data.bright);
+            data.channel_gamma = cv::Vec3d::all(data.gamma);
+            trackbar_pos[0] = int(data.contrast / 2.0 * 200);
+            trackbar_pos[1] = int((data.bright + 1.0) / 2.0 * 200);
+            trackbar_pos[2] = int(data.gamma / 2.0 * 200);
+            std::cout << "Estimated parameters: contrast " << data.contrast
+                      << ", bright " << data.bright << ", gamma " << data.gamma << std::endl;
+        }
+
+        data.proxy_input = data.input;
 
         int key = 0;
+        std::unique_ptr<CbgRenderer> renderer;
+        std::unique_ptr<CbgScheduler> scheduler;
 
         if (parser.has("i"))
         {
+            // Mientras se mueven los deslizadores se procesa una versión
+            // reducida al tamaño de la ventana. La resolución completa se
+            // calcula en segundo plano cuando se dejan quietos.
+            const cv::Size proxy_size = cbg_proxy_size(data.input.size(), cv::Size(800, 600));
+            if (proxy_size != data.input.size())
+            {
+                cv::resize(data.input, data.proxy_input, proxy_size, 0, 0, cv::INTER_AREA);
+                renderer.reset(new CbgRenderer(data.input));
+                data.renderer = renderer.get();
+            }
+            render_proxy(&data, get_params(&data), data.proxy_output);
+
+            // Las callbacks sólo anotan parámetros; el render lo hace un hilo.
+            scheduler.reset(new CbgScheduler(
+                [&data](const CbgParams &p, cv::Mat &out)
+                { render_proxy(&data, p, out); },
+                FRAME_BUDGET_MS));
+            data.scheduler = scheduler.get();
+
             cv::imshow("ORIGINAL", data.input);
-            cv::createTrackbar("C", "PARAMETERS", &c_int, 200, contrast_trackbar, &data);
-            cv::createTrackbar("B", "PARAMETERS", &b_int, 200, bright_trackbar, &data);
-            cv::createTrackbar("G", "PARAMETERS", &g_int, 200, gamma_trackbar, &data);
-            cv::createTrackbar("Luma", "PARAMETERS", &l_int, 1, luma_trackbar, &data);
+            create_trackbars(data, trackbar_pos, channel_pos);
+        }
+        else
+        {
+            commit_full_resolution(&data);
+            data.proxy_output = data.output;
         }
-
-        process_image(&data);
 
         cv::imshow("ORIGINAL", data.input);
-        cv::imshow("PROCESSED", data.output);
+        cv::imshow("PROCESSED", data.proxy_output);
         std::cout << "Press '<ENTER>' key to save the result, or '<ESC>' key to exit without saving." << std::endl;
         do
         {
-            key = cv::waitKey(0) & 0xff;
+            key = cv::waitKey(data.scheduler ? FRAME_BUDGET_MS : 0) & 0xff;
+            if (data.scheduler && data.scheduler->fetch(data.proxy_output))
+                cv::imshow("PROCESSED", data.proxy_output);
+            if (data.renderer && data.renderer->fetch(data.output))
+            {
+                data.output_is_current = true;
+                cv::imshow("PROCESSED", data.output);
+            }
         } while (key != 27 && key != 13);
 
+        if (data.scheduler)
+            std::cout << "Trackbar events: " << data.scheduler->posted()
+                      << ", renders: " << data.scheduler->rendered()
+                      << ", coalesced: " << data.scheduler->coalesced() << std::endl;
+        data.scheduler = nullptr;
+        scheduler.reset();
+        data.renderer = nullptr;
+        renderer.reset();
+
         if (key != 27)
         {
+            commit_full_resolution(&data);
             if (!cv::imwrite(output_name, data.output))
             {
                 std::cerr << "Error: could not save the result in file '" << output_name << "'." << std::endl;
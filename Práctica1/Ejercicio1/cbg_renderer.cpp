@@ -0,0 +1,146 @@
+#include "cbg_renderer.hpp"
+#include <algorithm>
+#include <chrono>
+
+void
+cbg_render(const cv::Mat &img, cv::Mat &out, const CbgParams &p,
+           FsivCbgWorkspace &ws)
+{
+    if (p.per_channel)
+        fsiv_cbg_process_channels_into(img, out, p.channel_contrast, p.channel_bright,
+                                       p.channel_gamma, &ws);
+    else if (p.linear && img.depth() == CV_8U)
+        fsiv_cbg_process_linear_into(img, out, p.contrast, p.bright, p.gamma,
+                                     p.luma_is_set, &ws);
+    else if (p.use_fixed || img.depth() == CV_16U)
+        fsiv_cbg_process_fixed_into(img, out, p.contrast, p.bright, p.gamma,
+                                    p.luma_is_set, &ws);
+    else if (p.use_float)
+    {
+        ws.flt_depth = p.use_half ? CV_16F : CV_32F;
+        fsiv_cbg_process_into(img, out, p.contrast, p.bright, p.gamma,
+                              p.luma_is_set, &ws);
+    }
+    else
+        fsiv_cbg_process_lut_into(img, out, p.contrast, p.bright, p.gamma,
+                                  p.luma_is_set, &ws);
+}
+
+CbgParams
+cbg_auto_params(const cv::Mat &img, const CbgParams &p, FsivCbgAutoState *state)
+{
+    CbgParams q = p;
+    if (!p.auto_cbg)
+        return q;
+    fsiv_estimate_cbg_params(img, q.contrast, q.bright, q.gamma, state);
+    q.channel_contrast = cv::Vec3d::all(q.contrast);
+    q.channel_bright = cv::Vec3d::all(q.bright);
+    q.channel_gamma = cv::Vec3d::all(q.gamma);
+    q.auto_cbg = false;
+    return q;
+}
+
+cv::Size
+cbg_proxy_size(const cv::Size &img_size, const cv::Size &display)
+{
+    const double scale = std::min(1.0, std::min(double(display.width) / img_size.width,
+                                                 double(display.height) / img_size.height));
+    if (scale >= 1.0)
+        return img_size;
+    return cv::Size(std::max(1, cvRound(img_size.width * scale)),
+                    std::max(1, cvRound(img_size.height * scale)));
+}
+
+CbgRenderer::CbgRenderer(const cv::Mat &input, int idle_ms, int strip_rows)
+    : input_(input), idle_ms_(idle_ms), strip_rows_(strip_rows),
+      generation_(0), pending_(false), ready_(false), stop_(false),
+      cancelled_(0)
+{
+    CV_Assert(!input.empty() && strip_rows > 0);
+    thread_ = std::thread(&CbgRenderer::run, this);
+}
+
+CbgRenderer::~CbgRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stop_ = true;
+        ++generation_; // cancela el render en curso.
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+void
+CbgRenderer::request(const CbgParams &p)
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        params_ = p;
+        ++generation_;
+        pending_ = true;
+        ready_ = false;
+    }
+    cond_.notify_all();
+}
+
+bool
+CbgRenderer::fetch(cv::Mat &out)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!ready_)
+        return false;
+    result_.copyTo(out);
+    ready_ = false;
+    return true;
+}
+
+void
+CbgRenderer::run()
+{
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (!stop_)
+    {
+        cond_.wait(lk, [this]() { return stop_ || pending_; });
+        if (stop_)
+            break;
+
+        // Esperamos a que la entrada quede quieta idle_ms.
+        unsigned gen = generation_;
+        while (cond_.wait_for(lk, std::chrono::milliseconds(idle_ms_),
+                              [&]() { return stop_ || generation_ != gen; }))
+        {
+            if (stop_)
+                return;
+            gen = generation_;
+        }
+
+        const CbgParams p = params_;
+        pending_ = false;
+        lk.unlock();
+        const bool done = render(p, gen);
+        lk.lock();
+        if (done && gen == generation_)
+        {
+            cv::swap(work_, result_);
+            ready_ = true;
+        }
+        else
+            ++cancelled_;
+    }
+}
+
+bool
+CbgRenderer::render(const CbgParams &p, unsigned generation)
+{
+    work_.create(input_.size(), input_.type());
+    for (int y = 0; y < input_.rows; y += strip_rows_)
+    {
+        if (generation_ != generation)
+            return false;
+        const int y1 = std::min(input_.rows, y + strip_rows_);
+        cv::Mat strip = work_.rowRange(y, y1);
+        cbg_render(input_.rowRange(y, y1), strip, p, ws_);
+    }
+    return true;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <opencv2/core/core.hpp>
+
+#include "common_code.hpp"
+
+/**
+ * @brief Parámetros del proceso contraste/brillo/gamma.
+ */
+struct CbgParams
+{
+    double contrast = 1.0;
+    double bright = 0.0;
+    double gamma = 1.0;
+    bool luma_is_set = false;
+    bool use_float = false; /*< usar el camino en float en vez de tablas.*/
+    bool use_fixed = false; /*< usar el camino en punto fijo (siempre con 16 bits).*/
+    bool use_half = false;  /*< intermedios CV_16F en el camino en float.*/
+    bool linear = false;    /*< procesar en luz lineal (sólo imágenes de 8 bits).*/
+    bool per_channel = false; /*< curvas distintas para B, G y R (channel_xxx).*/
+    bool auto_cbg = false;  /*< estimar c, b y g de cada imagen (ver cbg_auto_params).*/
+    cv::Vec3d channel_contrast = cv::Vec3d(1.0, 1.0, 1.0);
+    cv::Vec3d channel_bright = cv::Vec3d(0.0, 0.0, 0.0);
+    cv::Vec3d channel_gamma = cv::Vec3d(1.0, 1.0, 1.0);
+};
+
+/**
+ * @brief Procesa img según los parámetros dados.
+ *
+ * Usa fsiv_cbg_process_lut_into o, si p.use_float, fsiv_cbg_process_into.
+ * Las imágenes de 16 bits, o si p.use_fixed, usan fsiv_cbg_process_fixed_into.
+ * Si p.per_channel se usa fsiv_cbg_process_channels_into en todos los casos
+ * y si p.linear, con 8 bits, fsiv_cbg_process_linear_into.
+ *
+ * @param img imagen de entrada.
+ * @param out imagen de salida.
+ * @param p parámetros.
+ * @param ws espacio de trabajo.
+ */
+void cbg_render(const cv::Mat &img, cv::Mat &out, const CbgParams &p,
+                FsivCbgWorkspace &ws);
+
+/**
+ * @brief Sustituye c, b y g por los estimados de img si p.auto_cbg.
+ *
+ * Los parámetros devueltos tienen auto_cbg a false y, si p.per_channel,
+ * los tres canales con los valores estimados.
+ *
+ * @param img imagen de la que se estiman los parámetros.
+ * @param p parámetros dados.
+ * @param state estado para suavizar entre frames (ver fsiv_estimate_cbg_params).
+ */
+CbgParams cbg_auto_params(const cv::Mat &img, const CbgParams &p,
+                          FsivCbgAutoState *state = nullptr);
+
+/**
+ * @brief Calcula el tamaño de una imagen reducida para caber en display.
+ * @return el tamaño reducido o img_size si ya cabe.
+ */
+cv::Size cbg_proxy_size(const cv::Size &img_size, const cv::Size &display);
+
+/**
+ * @brief Renderiza la imagen a resolución completa en segundo plano.
+ *
+ * Cada llamada a request() anota unos parámetros nuevos. Cuando dejan de
+ * llegar peticiones durante idle_ms milisegundos, un hilo procesa la imagen
+ * completa por franjas horizontales. Si llega una petición nueva mientras
+ * tanto, el render en curso se cancela en la siguiente franja.
+ *
+ * El resultado se recoge con fetch() desde el hilo de la GUI.
+ */
+class CbgRenderer
+{
+public:
+    /**
+     * @brief Arranca el hilo de render.
+     * @param input imagen a resolución completa (no se copia, no debe cambiar).
+     * @param idle_ms tiempo sin peticiones antes de empezar a renderizar.
+     * @param strip_rows filas por franja (granularidad de cancelación).
+     */
+    CbgRenderer(const cv::Mat &input, int idle_ms = 250, int strip_rows = 128);
+
+    /**
+     * @brief Detiene el hilo de render.
+     */
+    ~CbgRenderer();
+
+    CbgRenderer(const CbgRenderer &) = delete;
+    CbgRenderer &operator=(const CbgRenderer &) = delete;
+
+    /**
+     * @brief Anota nuevos parámetros y cancela el render en curso.
+     */
+    void request(const CbgParams &p);
+
+    /**
+     * @brief Recoge el último render completo, si lo hay.
+     * @param out donde copiar el render.
+     * @return true si había un render nuevo para los últimos parámetros.
+     */
+    bool fetch(cv::Mat &out);
+
+    /**
+     * @brief Número de renders cancelados por llegar parámetros nuevos.
+     */
+    unsigned cancelled() const { return cancelled_; }
+
+private:
+    void run();
+    bool render(const CbgParams &p, unsigned generation);
+
+    const cv::Mat input_;
+    const int idle_ms_;
+    const int strip_rows_;
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    CbgParams params_;              /*< últimos parámetros pedidos.*/
+    std::atomic<unsigned> generation_; /*< se incrementa en cada petición.*/
+    bool pending_;                  /*< hay una petición sin renderizar.*/
+    bool ready_;                    /*< result_ tiene un render sin recoger.*/
+    bool stop_;
+    std::atomic<unsigned> cancelled_;
+
+    cv::Mat work_;   /*< render en curso (sólo lo toca el hilo).*/
+    cv::Mat result_; /*< último render completo.*/
+    FsivCbgWorkspace ws_;
+    std::thread thread_;
+};
@@ -0,0 +1,92 @@
+#include "cbg_stream.hpp"
+
+CbgStream::CbgStream(cv::VideoCapture &capt, const CbgParams &params,
+                     size_t queue_size)
+    : capt_(capt), params_(params), free_(2 * queue_size + 3),
+      decoded_(queue_size), processed_(queue_size), lut_rebuilds_(0)
+{
+    CV_Assert(capt.isOpened() && queue_size > 0);
+    // Frames en vuelo: los de las dos colas más uno por etapa.
+    for (size_t i = 0; i < 2 * queue_size + 3; ++i)
+        free_.push(CbgStreamFrame());
+    decoder_ = std::thread(&CbgStream::decode_loop, this);
+    processor_ = std::thread(&CbgStream::process_loop, this);
+}
+
+CbgStream::~CbgStream()
+{
+    stop();
+    decoder_.join();
+    processor_.join();
+}
+
+void
+CbgStream::set_params(const CbgParams &p)
+{
+    std::lock_guard<std::mutex> lk(params_mtx_);
+    params_ = p;
+}
+
+bool
+CbgStream::next(CbgStreamFrame &frame)
+{
+    return processed_.pop(frame);
+}
+
+void
+CbgStream::recycle(CbgStreamFrame &&frame)
+{
+    free_.push(std::move(frame));
+}
+
+void
+CbgStream::stop()
+{
+    free_.close();
+    decoded_.close();
+    processed_.close();
+}
+
+void
+CbgStream::decode_loop()
+{
+    CbgStreamFrame f;
+    while (free_.pop(f))
+    {
+        f.start = cv::getTickCount();
+        // read() reutiliza el buffer de f.input si el tamaño no cambia.
+        if (!capt_.read(f.input) || f.input.empty())
+            break;
+        f.decode_ms = (cv::getTickCount() - f.start) * 1000.0 / cv::getTickFrequency();
+        if (!decoded_.push(std::move(f)))
+            break;
+    }
+    decoded_.close();
+}
+
+void
+CbgStream::process_loop()
+{
+    FsivCbgWorkspace ws;
+    FsivCbgAutoState auto_state;
+    CbgStreamFrame f;
+    while (decoded_.pop(f))
+    {
+        CbgParams p;
+        {
+            std::lock_guard<std::mutex> lk(params_mtx_);
+            p = params_;
+        }
+        const int64_t t0 = cv::getTickCount();
+        p = cbg_auto_params(f.input, p, &auto_state);
+        f.params = cv::Vec3d(p.contrast, p.bright, p.gamma);
+        const unsigned old_builds = ws.table_builds;
+        cbg_render(f.input, f.output, p, ws);
+        if (ws.table_builds != old_builds)
+            ++lut_rebuilds_;
+        f.process_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+        if (!processed_.push(std::move(f)))
+            break;
+    }
+    processed_.close();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "bounded_queue.hpp"
+#include "cbg_renderer.hpp"
+
+/**
+ * @brief Un frame que circula por el pipeline de CbgStream.
+ *
+ * Los frames se reciclan: los buffers input y output se reutilizan para
+ * frames posteriores, así que no se reserva memoria en régimen permanente.
+ */
+struct CbgStreamFrame
+{
+    cv::Mat input;      /*< frame decodificado.*/
+    cv::Mat output;     /*< frame procesado.*/
+    int64_t start = 0;  /*< ticks (cv::getTickCount) al empezar a decodificar.*/
+    double decode_ms = 0.0;
+    double process_ms = 0.0;
+    cv::Vec3d params;   /*< (c,b,g) aplicados, estimados si CbgParams::auto_cbg.*/
+};
+
+/**
+ * @brief Pipeline decodificación -> proceso para vídeo o cámara.
+ *
+ * Un hilo decodifica los frames de la fuente y otro les aplica el proceso
+ * contraste/brillo/gamma con los últimos parámetros dados por
+ * set_params(). Las tablas de 256 entradas sólo se recalculan cuando
+ * cambian los parámetros. Con CbgParams::auto_cbg se estiman en cada frame
+ * (fsiv_estimate_cbg_params), suavizados entre frames. La etapa final
+ * (codificar, mostrar) la hace quien llama a next(), que debe devolver
+ * cada frame con recycle().
+ */
+class CbgStream
+{
+public:
+    /**
+     * @brief Arranca los hilos del pipeline.
+     * @param capt fuente ya abierta. No se debe usar mientras dure el stream.
+     * @param params parámetros iniciales.
+     * @param queue_size frames en vuelo entre cada par de etapas.
+     */
+    CbgStream(cv::VideoCapture &capt, const CbgParams &params, size_t queue_size = 4);
+
+    /**
+     * @brief Detiene y espera a los hilos.
+     */
+    ~CbgStream();
+
+    CbgStream(const CbgStream &) = delete;
+    CbgStream &operator=(const CbgStream &) = delete;
+
+    /**
+     * @brief Cambia los parámetros para los frames siguientes.
+     */
+    void set_params(const CbgParams &p);
+
+    /**
+     * @brief Obtiene el siguiente frame procesado, en orden.
+     * @return false si la fuente se ha terminado.
+     */
+    bool next(CbgStreamFrame &frame);
+
+    /**
+     * @brief Devuelve un frame al pipeline para reutilizar sus buffers.
+     */
+    void recycle(CbgStreamFrame &&frame);
+
+    /**
+     * @brief Detiene el pipeline sin esperar a que se acabe la fuente.
+     */
+    void stop();
+
+    /** @brief Frames en los que el camino elegido recalculó alguna de sus tablas. */
+    unsigned lut_rebuilds() const { return lut_rebuilds_; }
+
+private:
+    void decode_loop();
+    void process_loop();
+
+    cv::VideoCapture &capt_;
+    std::mutex params_mtx_;
+    CbgParams params_;
+    BoundedQueue<CbgStreamFrame> free_;
+    BoundedQueue<CbgStreamFrame> decoded_;
+    BoundedQueue<CbgStreamFrame> processed_;
+    std::atomic<unsigned> lut_rebuilds_;
+    std::thread decoder_;
+    std::thread processor_;
+};
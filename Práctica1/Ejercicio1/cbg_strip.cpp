@@ -0,0 +1,290 @@
+#include "cbg_strip.hpp"
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/imgproc.hpp>
+
+#include "bounded_queue.hpp"
+
+namespace
+{
+
+struct CbgStrip
+{
+    int index = 0;
+    cv::Mat input;   /*< filas tal y como están en el fichero.*/
+    cv::Mat output;
+    cv::Mat work;    /*< las filas en BGR (color): entrada y después salida.*/
+    cv::Mat result;  /*< output o work: lo que se escribe en el fichero.*/
+};
+
+/**
+ * @brief Lee un entero de la cabecera saltando espacios y comentarios.
+ */
+bool
+read_pnm_int(std::istream &in, int &v)
+{
+    int c;
+    while ((c = in.peek()) != EOF)
+    {
+        if (std::isspace(c))
+            in.get();
+        else if (c == '#')
+        {
+            std::string comment;
+            std::getline(in, comment);
+        }
+        else
+            break;
+    }
+    return bool(in >> v);
+}
+
+bool
+is_little_endian()
+{
+    const uint16_t one = 1;
+    return *reinterpret_cast<const uchar *>(&one) == 1;
+}
+
+/**
+ * @brief Cambia el orden de bytes de una imagen de 16 bits (PNM es big endian).
+ */
+void
+swap_bytes(cv::Mat &img)
+{
+    CV_Assert(img.depth() == CV_16U && img.isContinuous());
+    ushort *p = img.ptr<ushort>();
+    const size_t n = img.total() * img.channels();
+    for (size_t i = 0; i < n; ++i)
+        p[i] = ushort((p[i] >> 8) | (p[i] << 8));
+}
+
+/**
+ * @brief Buffers del tamaño de una franja: entrada y salida, más el de la
+ * conversión RGB <-> BGR en color.
+ */
+int
+strip_buffers(const CbgPnmInfo &info)
+{
+    return info.channels == 3 ? 3 : 2;
+}
+
+} // namespace
+
+bool
+cbg_read_pnm_header(std::istream &in, CbgPnmInfo &info)
+{
+    char magic[2] = {0, 0};
+    if (!in.read(magic, 2) || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+        return false;
+    info.channels = magic[1] == '5' ? 1 : 3;
+    if (!read_pnm_int(in, info.width) || !read_pnm_int(in, info.height) ||
+        !read_pnm_int(in, info.maxval))
+        return false;
+    if (info.width <= 0 || info.height <= 0 || info.maxval <= 0 || info.maxval > 65535)
+        return false;
+    info.depth = info.maxval <= 255 ? CV_8U : CV_16U;
+    in.get(); // un único espacio separa la cabecera de los datos.
+    return bool(in);
+}
+
+void
+cbg_write_pnm_header(std::ostream &out, const CbgPnmInfo &info)
+{
+    out << (info.channels == 1 ? "P5" : "P6") << '\n'
+        << info.width << ' ' << info.height << '\n'
+        << info.maxval << '\n';
+}
+
+int
+cbg_strip_rows(const CbgPnmInfo &info, const CbgParams &params,
+               size_t budget_bytes, int strips)
+{
+    CV_Assert(strips > 0);
+    // Entrada, salida y, en color, la conversión RGB <-> BGR de cada franja.
+    // El camino en float añade unas cinco copias en float (flt, hsv, planes,
+    // tmp, v); las tablas son despreciables.
+    size_t row_bytes = strip_buffers(info) * info.row_bytes();
+    const bool float_path = params.use_float && !params.use_fixed && !params.per_channel &&
+                            !params.linear && info.depth == CV_8U;
+    if (float_path)
+        row_bytes += size_t(info.width) * info.channels * (params.use_half ? 2 : 4) * 5;
+    const size_t rows = budget_bytes / (row_bytes * strips);
+    return int(std::min<size_t>(rows, size_t(info.height)));
+}
+
+bool
+cbg_process_strips(const std::string &input_name,
+                   const std::string &output_name,
+                   const CbgParams &params, size_t budget_bytes, int threads)
+{
+    std::ifstream in(input_name.c_str(), std::ios::binary);
+    CbgPnmInfo info;
+    if (!in || !cbg_read_pnm_header(in, info))
+    {
+        std::cerr << "Error: '" << input_name << "' is not a binary PGM/PPM file." << std::endl;
+        return false;
+    }
+    std::ofstream out(output_name.c_str(), std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Error: could not create the output file '" << output_name << "'." << std::endl;
+        return false;
+    }
+
+    const int n_workers = threads > 0 ? threads
+                                      : int(std::max(1u, std::thread::hardware_concurrency()));
+    // Una franja por hilo de proceso más la que se lee y la que se escribe.
+    const int pool_size = n_workers + 2;
+    const int strip_rows = cbg_strip_rows(info, params, budget_bytes, pool_size);
+    if (strip_rows < 1)
+    {
+        std::cerr << "Error: the memory budget is too small for " << pool_size
+                  << " strips of one row." << std::endl;
+        return false;
+    }
+    const int n_strips = (info.height + strip_rows - 1) / strip_rows;
+    const int type = CV_MAKETYPE(info.depth, info.channels);
+    const bool swap = info.depth == CV_16U && is_little_endian();
+    // El proceso supone el rango completo del tipo: otro maxval se escala a
+    // ese rango a la entrada y se deshace a la salida.
+    const double full = info.depth == CV_8U ? 255.0 : 65535.0;
+    const bool rescale = info.maxval != int(full);
+
+    BoundedQueue<CbgStrip> free_strips(pool_size);
+    BoundedQueue<CbgStrip> read_strips(pool_size);
+    for (int i = 0; i < pool_size; ++i)
+        free_strips.push(CbgStrip());
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::map<int, CbgStrip> processed; // franjas listas pendientes de escribir en orden.
+    bool aborted = false;
+    std::string error;
+    auto abort = [&](const std::string &msg)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (!aborted)
+                error = msg;
+            aborted = true;
+        }
+        cond.notify_all();
+        free_strips.close();
+        read_strips.close();
+    };
+
+    std::thread reader([&]()
+    {
+        CbgStrip s;
+        for (int i = 0; i < n_strips && free_strips.pop(s); ++i)
+        {
+            s.index = i;
+            const int rows = std::min(strip_rows, info.height - i * strip_rows);
+            s.input.create(rows, info.width, type);
+            if (!in.read(reinterpret_cast<char *>(s.input.data), rows * info.row_bytes()))
+            {
+                abort("unexpected end of file in '" + input_name + "'.");
+                break;
+            }
+            if (!read_strips.push(std::move(s)))
+                break;
+        }
+        read_strips.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n_workers; ++i)
+        workers.emplace_back([&]()
+        {
+            FsivCbgWorkspace ws;
+            CbgStrip s;
+            while (read_strips.pop(s))
+            {
+                try
+                {
+                    // Los datos PNM van en RGB y big endian. Las conversiones
+                    // escriben en los buffers de la franja: cvtColor en el
+                    // sitio haría una copia de la franja en cada llamada.
+                    if (swap)
+                        swap_bytes(s.input);
+                    if (rescale)
+                        s.input.convertTo(s.input, -1, full / info.maxval);
+                    if (info.channels == 3)
+                    {
+                        cv::cvtColor(s.input, s.work, cv::COLOR_RGB2BGR);
+                        cbg_render(s.work, s.output, params, ws);
+                        cv::cvtColor(s.output, s.work, cv::COLOR_BGR2RGB);
+                        s.result = s.work;
+                    }
+                    else
+                    {
+                        cbg_render(s.input, s.output, params, ws);
+                        s.result = s.output;
+                    }
+                    if (rescale)
+                        s.result.convertTo(s.result, -1, info.maxval / full);
+                    if (swap)
+                        swap_bytes(s.result);
+                }
+                catch (cv::Exception &e)
+                {
+                    abort(e.what());
+                    break;
+                }
+                {
+                    std::lock_guard<std::mutex> lk(mtx);
+                    const int index = s.index;
+                    processed[index] = std::move(s);
+                }
+                cond.notify_all();
+            }
+        });
+
+    const int64_t start = cv::getTickCount();
+    cbg_write_pnm_header(out, info);
+    for (int i = 0; i < n_strips; ++i)
+    {
+        CbgStrip s;
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            cond.wait(lk, [&]() { return aborted || processed.count(i) > 0; });
+            if (aborted)
+                break;
+            s = std::move(processed[i]);
+            processed.erase(i);
+        }
+        if (!out.write(reinterpret_cast<const char *>(s.result.data),
+                       s.result.rows * info.row_bytes()))
+        {
+            abort("could not write to '" + output_name + "'.");
+            break;
+        }
+        free_strips.push(std::move(s));
+    }
+    free_strips.close();
+    reader.join();
+    for (auto &t : workers)
+        t.join();
+
+    if (aborted)
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+    const double s = (cv::getTickCount() - start) / cv::getTickFrequency();
+    const double mb = 2.0 * info.row_bytes() * info.height / 1.0e6;
+    std::cout << "Strips: " << n_strips << " of " << strip_rows << " rows, "
+              << n_workers << " threads, "
+              << double(strip_buffers(info)) * pool_size * strip_rows * info.row_bytes() / 1.0e6
+              << " MB of strip buffers. " << mb / s << " MB/s (read + written)." << std::endl;
+    return true;
+}
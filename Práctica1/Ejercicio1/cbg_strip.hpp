@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+#include "cbg_renderer.hpp"
+
+/**
+ * @brief Cabecera de una imagen PNM binaria (P5 gris o P6 color).
+ */
+struct CbgPnmInfo
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;     /*< 1 (P5) o 3 (P6).*/
+    int depth = CV_8U;    /*< CV_8U (maxval <= 255) o CV_16U.*/
+    int maxval = 255;
+
+    /** @brief Bytes de una fila en el fichero. */
+    size_t row_bytes() const { return size_t(width) * channels * (depth == CV_8U ? 1 : 2); }
+};
+
+/**
+ * @brief Lee la cabecera de un fichero PNM binario.
+ *
+ * Tras leerla el flujo queda al principio de los datos.
+ *
+ * @return false si no es un P5/P6 válido.
+ */
+bool cbg_read_pnm_header(std::istream &in, CbgPnmInfo &info);
+
+/**
+ * @brief Escribe la cabecera de un fichero PNM binario.
+ */
+void cbg_write_pnm_header(std::ostream &out, const CbgPnmInfo &info);
+
+/**
+ * @brief Calcula cuántas filas caben en cada franja.
+ * @param info cabecera de la imagen.
+ * @param params parámetros (el camino en float necesita más memoria).
+ * @param budget_bytes memoria total para las franjas.
+ * @param strips franjas en vuelo a la vez.
+ * @return filas por franja, o 0 si no cabe ni una fila.
+ */
+int cbg_strip_rows(const CbgPnmInfo &info, const CbgParams &params,
+                   size_t budget_bytes, int strips);
+
+/**
+ * @brief Procesa una imagen PNM por franjas horizontales sin cargarla entera.
+ *
+ * Un hilo lee franjas del fichero de entrada, varios hilos las procesan en
+ * paralelo y el hilo que llama las escribe en orden en el de salida. Las
+ * franjas se reciclan, así que la memoria usada no pasa de budget_bytes
+ * sea cual sea el tamaño de la imagen.
+ *
+ * @param input_name fichero PPM/PGM binario de entrada (8 o 16 bits).
+ * @param output_name fichero de salida (mismo formato).
+ * @param params parámetros del proceso.
+ * @param budget_bytes memoria para las franjas.
+ * @param threads hilos de proceso (0: auto).
+ * @return true si todo fue bien.
+ */
+bool cbg_process_strips(const std::string &input_name,
+                        const std::string &output_name,
+                        const CbgParams &params, size_t budget_bytes,
+                        int threads = 0);
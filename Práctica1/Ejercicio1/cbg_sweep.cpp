@@ -0,0 +1,158 @@
+#include "cbg_sweep.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <opencv2/imgproc.hpp>
+
+// Filas por bloque en cbg_render_sweep: un bloque de 8K en color ocupa
+// unos 400 KB y sigue en caché mientras se escriben las N salidas.
+static const int SWEEP_BLOCK_ROWS = 16;
+
+/**
+ * @brief true si cbg_render usaría el camino en float, que se puede separar
+ * en fsiv_cbg_prepare + fsiv_cbg_apply.
+ */
+static bool
+is_float_path(const CbgParams &p, int depth)
+{
+    return p.use_float && !p.use_fixed && !p.per_channel && !p.linear && depth == CV_8U;
+}
+
+static double
+grid_value(double v0, double v1, int n, int i)
+{
+    return n > 1 ? v0 + (v1 - v0) * i / (n - 1) : v0;
+}
+
+std::vector<CbgParams>
+CbgSweepGrid::cells(const CbgParams &base) const
+{
+    std::vector<CbgParams> cells;
+    for (int r = 0; r < ng; ++r)
+        for (int c = 0; c < nc; ++c)
+        {
+            CbgParams p = base;
+            p.auto_cbg = false;
+            p.contrast = grid_value(c0, c1, nc, c);
+            p.gamma = grid_value(g0, g1, ng, r);
+            cells.push_back(p);
+        }
+    return cells;
+}
+
+bool
+cbg_parse_sweep(const std::string &text, CbgSweepGrid &grid)
+{
+    std::istringstream in(text);
+    char s[5] = {0, 0, 0, 0, 0};
+    CbgSweepGrid g;
+    if (!(in >> g.c0 >> s[0] >> g.c1 >> s[1] >> g.nc >> s[2] >> g.g0 >> s[3] >> g.g1 >> s[4] >> g.ng))
+        return false;
+    if (s[0] != ':' || s[1] != ':' || s[2] != ',' || s[3] != ':' || s[4] != ':' ||
+        g.nc < 1 || g.ng < 1)
+        return false;
+    grid = g;
+    return true;
+}
+
+void
+cbg_render_contact_sheet(const cv::Mat &img, const CbgSweepGrid &grid,
+                         const CbgParams &base, int sheet_width, cv::Mat &sheet)
+{
+    CV_Assert(!img.empty() && grid.nc > 0 && grid.ng > 0 && sheet_width >= grid.nc);
+    const std::vector<CbgParams> cells = grid.cells(base);
+
+    // Reducir y convertir una sola vez para todas las celdas.
+    const cv::Size cell_size = cbg_proxy_size(img.size(), cv::Size(sheet_width / grid.nc, img.rows));
+    cv::Mat small;
+    if (cell_size != img.size())
+        cv::resize(img, small, cell_size, 0, 0, cv::INTER_AREA);
+    else
+        small = img;
+    const bool float_path = is_float_path(base, small.depth());
+    FsivCbgWorkspace prepared;
+    if (float_path)
+    {
+        prepared.flt_depth = base.use_half ? CV_16F : CV_32F;
+        fsiv_cbg_prepare(small, base.luma_is_set, prepared);
+    }
+
+    sheet.create(cell_size.height * grid.ng, cell_size.width * grid.nc, small.type());
+    cv::parallel_for_(cv::Range(0, int(cells.size())), [&](const cv::Range &r)
+    {
+        for (int i = r.start; i < r.end; ++i)
+        {
+            const CbgParams &p = cells[i];
+            cv::Mat cell = sheet(cv::Rect(cell_size.width * (i % grid.nc),
+                                          cell_size.height * (i / grid.nc),
+                                          cell_size.width, cell_size.height));
+            FsivCbgWorkspace ws;
+            if (float_path)
+            {
+                // Compartimos los intermedios ya preparados; apply sólo los lee.
+                ws.flt = prepared.flt;
+                ws.planes = prepared.planes;
+                ws.luma = prepared.luma;
+                fsiv_cbg_apply(ws, cell, p.contrast, p.bright, p.gamma);
+            }
+            else
+                cbg_render(small, cell, p, ws);
+
+            char label[64];
+            std::snprintf(label, sizeof(label), "c=%.2f g=%.2f", p.contrast, p.gamma);
+            const double white = small.depth() == CV_16U ? 65535.0 : 255.0;
+            cv::putText(cell, label, cv::Point(4, 16), cv::FONT_HERSHEY_SIMPLEX, 0.45,
+                        cv::Scalar::all(0), 3, cv::LINE_AA);
+            cv::putText(cell, label, cv::Point(4, 16), cv::FONT_HERSHEY_SIMPLEX, 0.45,
+                        cv::Scalar::all(white), 1, cv::LINE_AA);
+        }
+    });
+}
+
+void
+cbg_render_sweep(const cv::Mat &img, const std::vector<CbgParams> &cells,
+                 std::vector<cv::Mat> &outs)
+{
+    CV_Assert(!img.empty());
+    outs.resize(cells.size());
+    for (cv::Mat &out : outs)
+        out.create(img.size(), img.type());
+    const int blocks = (img.rows + SWEEP_BLOCK_ROWS - 1) / SWEEP_BLOCK_ROWS;
+    // parallel_for_ crea un espacio de trabajo por trozo del rango. Con un
+    // trozo por hilo cada tabla (la de 65536 entradas de 16 bits incluida)
+    // se calcula una vez por hilo y no una vez por cada pocos bloques.
+    const int stripes = std::min(blocks, std::max(1, cv::getNumThreads()));
+    cv::parallel_for_(cv::Range(0, blocks), [&](const cv::Range &r)
+    {
+        // Un espacio de trabajo por variante, reutilizado en todo el trozo.
+        std::vector<FsivCbgWorkspace> ws(cells.size());
+        // En el camino en float, la conversión a float/HSV de cada bloque se
+        // hace una vez y todas las variantes la comparten, como en la hoja.
+        FsivCbgWorkspace prepared;
+        for (int b = r.start; b < r.end; ++b)
+        {
+            const int y0 = b * SWEEP_BLOCK_ROWS;
+            const int y1 = std::min(img.rows, y0 + SWEEP_BLOCK_ROWS);
+            const cv::Mat in = img.rowRange(y0, y1);
+            int prepared_mode = -1; // (luma, half) con que se preparó el bloque.
+            for (size_t i = 0; i < cells.size(); ++i)
+            {
+                const CbgParams &p = cells[i];
+                cv::Mat out = outs[i].rowRange(y0, y1);
+                if (!is_float_path(p, in.depth()))
+                {
+                    cbg_render(in, out, p, ws[i]);
+                    continue;
+                }
+                const int mode = (p.luma_is_set ? 1 : 0) | (p.use_half ? 2 : 0);
+                if (mode != prepared_mode)
+                {
+                    prepared.flt_depth = p.use_half ? CV_16F : CV_32F;
+                    fsiv_cbg_prepare(in, p.luma_is_set, prepared);
+                    prepared_mode = mode;
+                }
+                fsiv_cbg_apply(prepared, out, p.contrast, p.bright, p.gamma);
+            }
+        }
+    }, stripes);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "cbg_renderer.hpp"
+
+/**
+ * @brief Rejilla de variantes contraste x gamma.
+ *
+ * Las filas recorren la gamma y las columnas el contraste, ambos con pasos
+ * uniformes entre el primer y el último valor.
+ */
+struct CbgSweepGrid
+{
+    double c0 = 0.5;  /*< primer contraste.*/
+    double c1 = 1.5;  /*< último contraste.*/
+    int nc = 5;       /*< número de columnas.*/
+    double g0 = 0.5;  /*< primera gamma.*/
+    double g1 = 1.5;  /*< última gamma.*/
+    int ng = 5;       /*< número de filas.*/
+
+    /**
+     * @brief Parámetros de cada celda por filas.
+     * @param base parámetros comunes (brillo, luma, camino...).
+     */
+    std::vector<CbgParams> cells(const CbgParams &base) const;
+};
+
+/**
+ * @brief Lee una rejilla de la forma "c0:c1:nc,g0:g1:ng".
+ * @return false si el formato es incorrecto.
+ */
+bool cbg_parse_sweep(const std::string &text, CbgSweepGrid &grid);
+
+/**
+ * @brief Genera una hoja de contactos con todas las variantes de la rejilla.
+ *
+ * La entrada se reduce (y, en el camino en float, se convierte a float/HSV)
+ * una única vez. Cada celda sólo calcula su tabla y se renderiza en
+ * paralelo con las demás directamente en su zona de la hoja, con una
+ * etiqueta con su contraste y su gamma.
+ *
+ * @param img imagen de entrada.
+ * @param grid rejilla de variantes.
+ * @param base parámetros comunes.
+ * @param sheet_width ancho máximo de la hoja.
+ * @param sheet hoja de salida.
+ */
+void cbg_render_contact_sheet(const cv::Mat &img, const CbgSweepGrid &grid,
+                              const CbgParams &base, int sheet_width,
+                              cv::Mat &sheet);
+
+/**
+ * @brief Aplica todas las variantes a resolución completa en una pasada.
+ *
+ * La imagen se recorre una vez por bloques de filas: cada bloque se lee a
+ * caché y se escribe en las N salidas antes de pasar al siguiente, en vez
+ * de leer la entrada N veces.
+ *
+ * @param img imagen de entrada.
+ * @param cells parámetros de cada variante.
+ * @param outs salidas, una por variante.
+ */
+void cbg_render_sweep(const cv::Mat &img, const std::vector<CbgParams> &cells,
+                      std::vector<cv::Mat> &outs);
@@ -1,4 +1,23 @@
 #include "common_code.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "fsiv_half.hpp"
+#include "srgb_tables.hpp"
+
+void
+fsiv_convert_image_byte_to_float_into(const cv::Mat &img, cv::Mat &out, int depth)
+{
+    CV_Assert(img.depth() == CV_8U);
+    CV_Assert(depth == CV_32F || depth == CV_16F);
+    // convertTo usa F16C (o NEON) para CV_16F si OpenCV se compiló con ello.
+    img.convertTo(out, depth, 1.0/255.0);
+    CV_Assert(out.rows == img.rows && out.cols == img.cols);
+    CV_Assert(out.depth() == depth);
+    CV_Assert(img.channels() == out.channels());
+}
 
 cv::Mat
 fsiv_convert_image_byte_to_float(const cv::Mat &img)
@@ -7,7 +26,7 @@ fsiv_convert_image_byte_to_float(const cv::Mat &img)
     cv::Mat out;
     //! TODO
     // Hint: use cv::Mat::convertTo().
-        img.convertTo(out, CV_32F, 1.0/255.0);
+        fsiv_convert_image_byte_to_float_into(img, out);
     //
     CV_Assert(out.rows == img.rows && out.cols == img.cols);
     CV_Assert(out.depth() == CV_32F);
@@ -15,6 +34,16 @@ fsiv_convert_image_byte_to_float(const cv::Mat &img)
     return out;
 }
 
+void
+fsiv_convert_image_float_to_byte_into(const cv::Mat &img, cv::Mat &out)
+{
+    CV_Assert(img.depth() == CV_32F || img.depth() == CV_16F);
+    img.convertTo(out, CV_8U, 255.0);
+    CV_Assert(out.rows == img.rows && out.cols == img.cols);
+    CV_Assert(out.depth() == CV_8U);
+    CV_Assert(img.channels() == out.channels());
+}
+
 cv::Mat
 fsiv_convert_image_float_to_byte(const cv::Mat &img)
 {
@@ -22,7 +51,7 @@ fsiv_convert_image_float_to_byte(const cv::Mat &img)
     cv::Mat out;
     //! TODO
     // Hint: use cv::Mat::convertTo()
-        img.convertTo(out, CV_8U, 255.0);
+        fsiv_convert_image_float_to_byte_into(img, out);
     //
     CV_Assert(out.rows == img.rows && out.cols == img.cols);
     CV_Assert(out.depth() == CV_8U);
@@ -30,32 +59,84 @@ fsiv_convert_image_float_to_byte(const cv::Mat &img)
     return out;
 }
 
-cv::Mat
-fsiv_convert_bgr_to_hsv(const cv::Mat &img)
+void
+fsiv_cbg_prepare(const cv::Mat &in, bool only_luma, FsivCbgWorkspace &ws)
 {
-    CV_Assert(img.channels() == 3);
-    cv::Mat out;
-    //! TODO
-    // Hint: use cvtColor.
-    // Remember: the input color scheme is assumed to be BGR.
-        cv::cvtColor(img, out, cv::COLOR_BGR2HSV);
-    //
-    CV_Assert(out.channels() == 3);
-    return out;
+    CV_Assert(in.depth() == CV_8U);
+    ws.luma = only_luma && in.channels() == 3;
+    fsiv_convert_image_byte_to_float_into(in, ws.flt, ws.flt_depth);
+    if (ws.luma && ws.flt.depth() == CV_32F)
+        fsiv_convert_bgr_to_hsv_planes_into(ws.flt, ws.planes);
+    else if (ws.luma)
+    {
+        fsiv_convert_bgr_to_hsv_into(ws.flt, ws.hsv);
+        cv::split(ws.hsv, ws.planes);
+    }
 }
 
-cv::Mat
-fsiv_convert_hsv_to_bgr(const cv::Mat &img)
+/**
+ * @brief dst = alpha * src^gamma + beta convertido a dtype.
+ *
+ * cv::pow sólo admite float, así que con CV_16F se trabaja por bloques.
+ *
+ * @param tmp buffer para src^gamma cuando src es CV_32F.
+ */
+static void
+pow_affine(const cv::Mat &src, cv::Mat &dst, double gamma, double alpha,
+           double beta, int dtype, cv::Mat &tmp)
 {
-    CV_Assert(img.channels() == 3);
-    cv::Mat out;
-    //! TODO
-    // Hint: use cvtColor.
-    // Remember: the ouput color scheme is assumed to be BGR.
-        cv::cvtColor(img, out, cv::COLOR_HSV2BGR);
-    //
-    CV_Assert(out.channels() == 3);
-    return out;
+    if (src.depth() != CV_16F)
+    {
+        cv::pow(src, gamma, tmp);
+        tmp.convertTo(dst, dtype, alpha, beta);
+        return;
+    }
+    dst.create(src.size(), CV_MAKETYPE(dtype, src.channels()));
+    fsiv_for_each_half_block(src, dst, [=](cv::Mat &flt, cv::Mat &d)
+    {
+        cv::pow(flt, gamma, flt);
+        flt.convertTo(d, dtype, alpha, beta);
+    });
+}
+
+void
+fsiv_cbg_apply(FsivCbgWorkspace &ws, cv::Mat &out,
+               double contrast, double brightness, double gamma)
+{
+    CV_Assert(!ws.flt.empty());
+    if (ws.luma)
+    {
+        // O = c * I^g + b en una sola pasada.
+        pow_affine(ws.planes[2], ws.v, gamma, contrast, brightness,
+                   ws.planes[2].depth(), ws.v);
+        const cv::Mat hsv[] = {ws.planes[0], ws.planes[1], ws.v};
+        cv::merge(hsv, 3, ws.hsv);
+        fsiv_convert_hsv_to_bgr_into(ws.hsv, ws.tmp);
+        fsiv_convert_image_float_to_byte_into(ws.tmp, out);
+    }
+    else
+        // Fusionamos c, b y el escalado a [0,255] en la conversión a byte.
+        pow_affine(ws.flt, out, gamma, 255.0 * contrast, 255.0 * brightness,
+                   CV_8U, ws.tmp);
+    CV_Assert(out.size() == ws.flt.size());
+    CV_Assert(out.depth() == CV_8U);
+    CV_Assert(out.channels() == ws.flt.channels());
+}
+
+void
+fsiv_cbg_process_into(const cv::Mat &in, cv::Mat &out,
+                      double contrast, double brightness, double gamma,
+                      bool only_luma, FsivCbgWorkspace *ws)
+{
+    CV_Assert(in.depth() == CV_8U);
+    FsivCbgWorkspace local_ws;
+    if (ws == nullptr)
+        ws = &local_ws;
+    fsiv_cbg_prepare(in, only_luma, *ws);
+    fsiv_cbg_apply(*ws, out, contrast, brightness, gamma);
+    CV_Assert(out.rows == in.rows && out.cols == in.cols);
+    CV_Assert(out.depth() == CV_8U);
+    CV_Assert(out.channels() == in.channels());
 }
 
 cv::Mat
@@ -70,28 +151,725 @@ fsiv_cbg_process(const cv::Mat &in,
     // Hint: use cv::pow() to apply the gamma parameter.
     // Hint: if input channels is 3 and only luma is required, convert to HSV
     //       color space and process only de V (luma) channel.
-        std::vector<cv::Mat> mv;
-        out=fsiv_convert_image_byte_to_float(in);
-        if(only_luma){
-            out=fsiv_convert_bgr_to_hsv(out);
-            cv::split(out,mv);
-            out=mv[2];
-        }
+        fsiv_cbg_process_into(in, out, contrast, brightness, gamma, only_luma);
+    //
+    CV_Assert(out.rows == in.rows && out.cols == in.cols);
+    CV_Assert(out.depth() == CV_8U);
+    CV_Assert(out.channels() == in.channels());
+    return out;
+}
+
+void
+fsiv_cbg_build_lut(double contrast, double brightness, double gamma,
+                   cv::Mat &lut)
+{
+    lut.create(1, 256, CV_8UC1);
+    uchar *t = lut.ptr<uchar>();
+    for (int i = 0; i < 256; ++i)
+        t[i] = cv::saturate_cast<uchar>(
+            255.0 * (contrast * std::pow(i / 255.0, gamma) + brightness));
+}
 
-            
-        cv::pow(out,gamma,out);
-        out*=contrast;
-        out+=cv::Scalar::all(brightness);
-        
-        if(only_luma){
-            cv::merge(mv,out);
-            out=fsiv_convert_hsv_to_bgr(out);
+void
+fsiv_cbg_build_luma_gain(double contrast, double brightness, double gamma,
+                         cv::Mat &gain)
+{
+    gain.create(1, 256, CV_32FC1);
+    float *t = gain.ptr<float>();
+    t[0] = float(255.0 * (contrast * std::pow(0.0, gamma) + brightness));
+    for (int i = 1; i < 256; ++i)
+    {
+        const double v = i / 255.0;
+        t[i] = float((contrast * std::pow(v, gamma) + brightness) / v);
+    }
+}
+
+/**
+ * @brief Escala cada píxel BGR por la ganancia de su V = max(B,G,R).
+ */
+static void
+apply_luma_gain(const cv::Mat &in, cv::Mat &out, const cv::Mat &gain)
+{
+    CV_Assert(in.type() == CV_8UC3);
+    out.create(in.size(), in.type());
+    const float *g = gain.ptr<float>();
+    const uchar black = cv::saturate_cast<uchar>(g[0]);
+    cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range &r)
+    {
+        for (int y = r.start; y < r.end; ++y)
+        {
+            const uchar *src = in.ptr<uchar>(y);
+            uchar *dst = out.ptr<uchar>(y);
+            for (int x = 0; x < in.cols; ++x, src += 3, dst += 3)
+            {
+                const int m = std::max(src[0], std::max(src[1], src[2]));
+                if (m == 0)
+                    dst[0] = dst[1] = dst[2] = black;
+                else
+                {
+                    const float k = g[m];
+                    dst[0] = cv::saturate_cast<uchar>(src[0] * k);
+                    dst[1] = cv::saturate_cast<uchar>(src[1] * k);
+                    dst[2] = cv::saturate_cast<uchar>(src[2] * k);
+                }
+            }
         }
-        out=fsiv_convert_image_float_to_byte(out);
+    });
+}
 
-    //
+void
+fsiv_cbg_process_lut_into(const cv::Mat &in, cv::Mat &out,
+                          double contrast, double brightness, double gamma,
+                          bool only_luma, FsivCbgWorkspace *ws)
+{
+    CV_Assert(in.depth() == CV_8U);
+    FsivCbgWorkspace local_ws;
+    if (ws == nullptr)
+        ws = &local_ws;
+
+    const cv::Vec3d params(contrast, brightness, gamma);
+    if (ws->lut.empty() || ws->lut_params != params)
+    {
+        fsiv_cbg_build_lut(contrast, brightness, gamma, ws->lut);
+        fsiv_cbg_build_luma_gain(contrast, brightness, gamma, ws->gain);
+        ws->lut_params = params;
+        ++ws->table_builds;
+    }
+
+    if (only_luma && in.channels() == 3)
+        apply_luma_gain(in, out, ws->gain);
+    else
+        cv::LUT(in, ws->lut, out);
     CV_Assert(out.rows == in.rows && out.cols == in.cols);
     CV_Assert(out.depth() == CV_8U);
     CV_Assert(out.channels() == in.channels());
-    return out;
+}
+
+void
+fsiv_cbg_build_lut16(double contrast, double brightness, double gamma,
+                     cv::Mat &lut)
+{
+    lut.create(1, 65536, CV_16UC1);
+    ushort *t = lut.ptr<ushort>();
+    for (int i = 0; i < 65536; ++i)
+        t[i] = cv::saturate_cast<ushort>(
+            65535.0 * (contrast * std::pow(i / 65535.0, gamma) + brightness));
+}
+
+void
+fsiv_cbg_build_luma_gain_q16(double contrast, double brightness, double gamma,
+                             int depth, std::vector<unsigned> &gain)
+{
+    CV_Assert(depth == CV_8U || depth == CV_16U);
+    const int max_v = depth == CV_8U ? 255 : 65535;
+    gain.resize(max_v + 1);
+    const double black = max_v * (contrast * std::pow(0.0, gamma) + brightness);
+    gain[0] = unsigned(cvRound(std::min<double>(max_v, std::max(0.0, black))));
+    for (int m = 1; m <= max_v; ++m)
+    {
+        const double v = double(m) / max_v;
+        const double f = std::min(1.0, std::max(0.0, contrast * std::pow(v, gamma) + brightness));
+        // Con f <= 1, m * gain[m] <= M * 2^16 y no desborda 32 bits.
+        gain[m] = unsigned(std::min(std::floor(max_v * 65536.0 / m),
+                                    std::floor(f / v * 65536.0 + 0.5)));
+    }
+}
+
+/**
+ * @brief Aplica una tabla de 65536 entradas a una imagen de 16 bits.
+ *
+ * cv::LUT sólo admite entradas de 8 bits. La tabla puede tener un canal
+ * (común) o tantos como la imagen (una curva por canal).
+ */
+static void
+apply_lut16(const cv::Mat &in, cv::Mat &out, const cv::Mat &lut)
+{
+    CV_Assert(in.depth() == CV_16U && lut.total() == 65536 && lut.depth() == CV_16U);
+    CV_Assert(lut.channels() == 1 || lut.channels() == in.channels());
+    out.create(in.size(), in.type());
+    const ushort *t = lut.ptr<ushort>();
+    const int n = in.cols * in.channels();
+    if (lut.channels() == 3)
+    {
+        cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range &r)
+        {
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const ushort *src = in.ptr<ushort>(y);
+                ushort *dst = out.ptr<ushort>(y);
+                for (int x = 0; x < n; x += 3)
+                {
+                    dst[x] = t[3 * src[x]];
+                    dst[x + 1] = t[3 * src[x + 1] + 1];
+                    dst[x + 2] = t[3 * src[x + 2] + 2];
+                }
+            }
+        });
+        return;
+    }
+    cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range &r)
+    {
+        for (int y = r.start; y < r.end; ++y)
+        {
+            const ushort *src = in.ptr<ushort>(y);
+            ushort *dst = out.ptr<ushort>(y);
+            int x = 0;
+            for (; x <= n - 4; x += 4)
+            {
+                const ushort a0 = t[src[x]], a1 = t[src[x + 1]];
+                const ushort a2 = t[src[x + 2]], a3 = t[src[x + 3]];
+                dst[x] = a0;
+                dst[x + 1] = a1;
+                dst[x + 2] = a2;
+                dst[x + 3] = a3;
+            }
+            for (; x < n; ++x)
+                dst[x] = t[src[x]];
+        }
+    });
+}
+
+#if CV_SIMD
+/**
+ * @brief Multiplica cada canal por su ganancia Q16 redondeando: (c*g + 2^15) >> 16.
+ */
+static inline cv::v_uint16
+mul_q16(const cv::v_uint16 &c, const cv::v_uint32 &g0, const cv::v_uint32 &g1)
+{
+    const cv::v_uint32 half = cv::vx_setall_u32(1u << 15);
+    cv::v_uint32 c0, c1;
+    cv::v_expand(c, c0, c1);
+    return cv::v_pack((c0 * g0 + half) >> 16, (c1 * g1 + half) >> 16);
+}
+
+/**
+ * @brief Parte SIMD de una fila de apply_luma_gain_q16 para 16 bits.
+ * @return el número de píxeles procesados.
+ */
+static int
+luma_gain_q16_row(const ushort *src, ushort *dst, int cols,
+                  const unsigned *gain, ushort black)
+{
+    const int n = cv::v_uint16::nlanes;
+    const cv::v_uint16 vzero = cv::vx_setzero_u16(), vblack = cv::vx_setall_u16(black);
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) ushort m[cv::v_uint16::nlanes];
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) unsigned k[cv::v_uint16::nlanes];
+    int x = 0;
+    for (; x <= cols - n; x += n)
+    {
+        cv::v_uint16 b, g, r;
+        cv::v_load_deinterleave(src + 3 * x, b, g, r);
+        const cv::v_uint16 vm = cv::v_max(b, cv::v_max(g, r));
+        cv::v_store_aligned(m, vm);
+        for (int i = 0; i < n; ++i) // no hay gather en las intrínsecas universales.
+            k[i] = gain[m[i]];
+        const cv::v_uint32 k0 = cv::vx_load_aligned(k), k1 = cv::vx_load_aligned(k + n / 2);
+        const cv::v_uint16 is_black = vm == vzero;
+        b = cv::v_select(is_black, vblack, mul_q16(b, k0, k1));
+        g = cv::v_select(is_black, vblack, mul_q16(g, k0, k1));
+        r = cv::v_select(is_black, vblack, mul_q16(r, k0, k1));
+        cv::v_store_interleave(dst + 3 * x, b, g, r);
+    }
+    return x;
+}
+
+/**
+ * @brief Parte SIMD de una fila de apply_luma_gain_q16 para 8 bits.
+ * @return el número de píxeles procesados.
+ */
+static int
+luma_gain_q16_row(const uchar *src, uchar *dst, int cols,
+                  const unsigned *gain, uchar black)
+{
+    const int n = cv::v_uint8::nlanes;
+    const cv::v_uint8 vzero = cv::vx_setzero_u8(), vblack = cv::vx_setall_u8(black);
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) uchar m[cv::v_uint8::nlanes];
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) unsigned k[cv::v_uint8::nlanes];
+    int x = 0;
+    for (; x <= cols - n; x += n)
+    {
+        cv::v_uint8 c[3];
+        cv::v_load_deinterleave(src + 3 * x, c[0], c[1], c[2]);
+        const cv::v_uint8 vm = cv::v_max(c[0], cv::v_max(c[1], c[2]));
+        cv::v_store_aligned(m, vm);
+        for (int i = 0; i < n; ++i)
+            k[i] = gain[m[i]];
+        const cv::v_uint32 k0 = cv::vx_load_aligned(k), k1 = cv::vx_load_aligned(k + n / 4);
+        const cv::v_uint32 k2 = cv::vx_load_aligned(k + n / 2), k3 = cv::vx_load_aligned(k + 3 * n / 4);
+        const cv::v_uint8 is_black = vm == vzero;
+        for (int j = 0; j < 3; ++j)
+        {
+            cv::v_uint16 lo, hi;
+            cv::v_expand(c[j], lo, hi);
+            c[j] = cv::v_select(is_black, vblack,
+                                cv::v_pack(mul_q16(lo, k0, k1), mul_q16(hi, k2, k3)));
+        }
+        cv::v_store_interleave(dst + 3 * x, c[0], c[1], c[2]);
+    }
+    return x;
+}
+#endif
+
+/**
+ * @brief Escala cada píxel BGR por la ganancia Q16 de su V = max(B,G,R).
+ */
+template <class T>
+static void
+apply_luma_gain_q16(const cv::Mat &in, cv::Mat &out, const std::vector<unsigned> &gain)
+{
+    CV_Assert(in.channels() == 3 && gain.size() == size_t(std::numeric_limits<T>::max()) + 1);
+    out.create(in.size(), in.type());
+    const unsigned *g = gain.data();
+    const T black = T(g[0]);
+    cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range &r)
+    {
+        for (int y = r.start; y < r.end; ++y)
+        {
+            const T *src = in.ptr<T>(y);
+            T *dst = out.ptr<T>(y);
+            int x = 0;
+#if CV_SIMD
+            x = luma_gain_q16_row(src, dst, in.cols, g, black);
+#endif
+            for (src += 3 * x, dst += 3 * x; x < in.cols; ++x, src += 3, dst += 3)
+            {
+                const int m = std::max(src[0], std::max(src[1], src[2]));
+                if (m == 0)
+                    dst[0] = dst[1] = dst[2] = black;
+                else
+                {
+                    const unsigned k = g[m];
+                    dst[0] = T((src[0] * k + (1u << 15)) >> 16);
+                    dst[1] = T((src[1] * k + (1u << 15)) >> 16);
+                    dst[2] = T((src[2] * k + (1u << 15)) >> 16);
+                }
+            }
+        }
+    });
+}
+
+void
+fsiv_cbg_process_fixed_into(const cv::Mat &in, cv::Mat &out,
+                            double contrast, double brightness, double gamma,
+                            bool only_luma, FsivCbgWorkspace *ws)
+{
+    CV_Assert(in.depth() == CV_8U || in.depth() == CV_16U);
+    CV_Assert(in.channels() == 1 || in.channels() == 3);
+    FsivCbgWorkspace local_ws;
+    if (ws == nullptr)
+        ws = &local_ws;
+
+    const bool luma = only_luma && in.channels() == 3;
+    const cv::Vec3d params(contrast, brightness, gamma);
+    if (ws->fixed_depth != in.depth() || ws->fixed_params != params)
+    {
+        // Sólo se construye la tabla que se va a usar; la de ganancias de
+        // 16 bits tiene 65536 entradas y cuesta lo mismo que la de muestras.
+        ws->lut8.release();
+        ws->lut16.release();
+        ws->gain_q16.clear();
+        ws->fixed_depth = in.depth();
+        ws->fixed_params = params;
+    }
+    if (luma && ws->gain_q16.empty())
+    {
+        fsiv_cbg_build_luma_gain_q16(contrast, brightness, gamma, in.depth(), ws->gain_q16);
+        ++ws->table_builds;
+    }
+
+    if (luma && in.depth() == CV_8U)
+        apply_luma_gain_q16<uchar>(in, out, ws->gain_q16);
+    else if (luma)
+        apply_luma_gain_q16<ushort>(in, out, ws->gain_q16);
+    else if (in.depth() == CV_8U)
+    {
+        if (ws->lut8.empty())
+        {
+            fsiv_cbg_build_lut(contrast, brightness, gamma, ws->lut8);
+            ++ws->table_builds;
+        }
+        cv::LUT(in, ws->lut8, out);
+    }
+    else
+    {
+        if (ws->lut16.empty())
+        {
+            fsiv_cbg_build_lut16(contrast, brightness, gamma, ws->lut16);
+            ++ws->table_builds;
+        }
+        apply_lut16(in, out, ws->lut16);
+    }
+    CV_Assert(out.rows == in.rows && out.cols == in.cols);
+    CV_Assert(out.type() == in.type());
+}
+
+void
+fsiv_cbg_build_lut3(const cv::Vec3d &contrast, const cv::Vec3d &brightness,
+                    const cv::Vec3d &gamma, int depth, cv::Mat &lut)
+{
+    CV_Assert(depth == CV_8U || depth == CV_16U);
+    const int n = depth == CV_8U ? 256 : 65536;
+    const double max_v = n - 1;
+    lut.create(1, n, CV_MAKETYPE(depth, 3));
+    for (int c = 0; c < 3; ++c)
+        for (int i = 0; i < n; ++i)
+        {
+            const double v = max_v * (contrast[c] * std::pow(i / max_v, gamma[c]) + brightness[c]);
+            if (depth == CV_8U)
+                lut.ptr<uchar>()[3 * i + c] = cv::saturate_cast<uchar>(v);
+            else
+                lut.ptr<ushort>()[3 * i + c] = cv::saturate_cast<ushort>(v);
+        }
+}
+
+void
+fsiv_cbg_process_channels_into(const cv::Mat &in, cv::Mat &out,
+                               const cv::Vec3d &contrast,
+                               const cv::Vec3d &brightness,
+                               const cv::Vec3d &gamma, FsivCbgWorkspace *ws)
+{
+    CV_Assert(in.depth() == CV_8U || in.depth() == CV_16U);
+    CV_Assert(in.channels() == 1 || in.channels() == 3);
+    FsivCbgWorkspace local_ws;
+    if (ws == nullptr)
+        ws = &local_ws;
+
+    if (in.channels() == 1)
+    {
+        if (in.depth() == CV_8U)
+            fsiv_cbg_process_lut_into(in, out, contrast[0], brightness[0], gamma[0], false, ws);
+        else
+            fsiv_cbg_process_fixed_into(in, out, contrast[0], brightness[0], gamma[0], false, ws);
+        return;
+    }
+
+    const cv::Matx33d params(contrast[0], contrast[1], contrast[2],
+                             brightness[0], brightness[1], brightness[2],
+                             gamma[0], gamma[1], gamma[2]);
+    if (ws->lut3.empty() || ws->lut3.depth() != in.depth() || ws->lut3_params != params)
+    {
+        fsiv_cbg_build_lut3(contrast, brightness, gamma, in.depth(), ws->lut3);
+        ws->lut3_params = params;
+        ++ws->table_builds;
+    }
+    // cv::LUT con una tabla de 3 canales aplica cada curva a su canal en
+    // la misma pasada.
+    if (in.depth() == CV_8U)
+        cv::LUT(in, ws->lut3, out);
+    else
+        apply_lut16(in, out, ws->lut3);
+    CV_Assert(out.rows == in.rows && out.cols == in.cols);
+    CV_Assert(out.type() == in.type());
+}
+
+/**
+ * @brief Pasa un valor lineal de 16 bits a sRGB con la tabla de 12 bits.
+ */
+static inline uchar
+linear16_to_srgb(unsigned y)
+{
+    return FSIV_LINEAR12_TO_SRGB[std::min(4095u, (y + 8) >> 4)];
+}
+
+void
+fsiv_cbg_build_linear_lut(double contrast, double brightness, double gamma,
+                          cv::Mat &lut)
+{
+    lut.create(1, 256, CV_8UC1);
+    uchar *t = lut.ptr<uchar>();
+    for (int i = 0; i < 256; ++i)
+    {
+        const double l = FSIV_SRGB_TO_LINEAR16[i] / 65535.0;
+        const double f = std::min(1.0, std::max(0.0, contrast * std::pow(l, gamma) + brightness));
+        t[i] = linear16_to_srgb(unsigned(cvRound(f * 65535.0)));
+    }
+}
+
+void
+fsiv_cbg_build_linear_gain(double contrast, double brightness, double gamma,
+                           std::vector<unsigned> &gain)
+{
+    gain.resize(256);
+    const double black = std::min(1.0, std::max(0.0, contrast * std::pow(0.0, gamma) + brightness));
+    gain[0] = linear16_to_srgb(unsigned(cvRound(black * 65535.0)));
+    for (int m = 1; m < 256; ++m)
+    {
+        const unsigned l16 = FSIV_SRGB_TO_LINEAR16[m];
+        const double l = l16 / 65535.0;
+        const double f = std::min(1.0, std::max(0.0, contrast * std::pow(l, gamma) + brightness));
+        // Con f <= 1, L16 * gain[m] <= 65535 * 2^16 y no desborda 32 bits.
+        gain[m] = unsigned(std::min(std::floor(65535.0 * 65536.0 / l16),
+                                    std::floor(f / l * 65536.0 + 0.5)));
+    }
+}
+
+#if CV_SIMD
+/**
+ * @brief Parte SIMD de una fila de apply_linear_luma_gain.
+ *
+ * V, el producto Q16 y el índice de la tabla lineal -> sRGB se calculan en
+ * vectores; las lecturas de las tres tablas siguen siendo escalares, ya que
+ * no hay gather en las intrínsecas universales.
+ * @return el número de píxeles procesados.
+ */
+static int
+linear_luma_gain_row(const uchar *src, uchar *dst, int cols,
+                     const unsigned *gain, uchar black)
+{
+    const int n = cv::v_uint8::nlanes, n4 = n / 4;
+    const ushort *dec = FSIV_SRGB_TO_LINEAR16;
+    const cv::v_uint8 vzero = cv::vx_setzero_u8(), vblack = cv::vx_setall_u8(black);
+    const cv::v_uint32 half = cv::vx_setall_u32(1u << 15), eight = cv::vx_setall_u32(8);
+    const cv::v_uint32 top = cv::vx_setall_u32(4095);
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) uchar c[3][cv::v_uint8::nlanes];
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) uchar m[cv::v_uint8::nlanes];
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) unsigned k[cv::v_uint8::nlanes];
+    CV_DECL_ALIGNED(CV_SIMD_WIDTH) unsigned l[cv::v_uint8::nlanes];
+    int x = 0;
+    for (; x <= cols - n; x += n)
+    {
+        cv::v_uint8 v[3];
+        cv::v_load_deinterleave(src + 3 * x, v[0], v[1], v[2]);
+        const cv::v_uint8 vm = cv::v_max(v[0], cv::v_max(v[1], v[2]));
+        cv::v_store_aligned(m, vm);
+        for (int i = 0; i < n; ++i)
+            k[i] = gain[m[i]];
+        const cv::v_uint8 is_black = vm == vzero;
+        for (int j = 0; j < 3; ++j)
+        {
+            cv::v_store_aligned(c[j], v[j]);
+            for (int i = 0; i < n; ++i)
+                l[i] = dec[c[j][i]];
+            // min(4095, (((L16 * k + 2^15) >> 16) + 8) >> 4), como linear16_to_srgb.
+            for (int q = 0; q < n; q += n4)
+            {
+                const cv::v_uint32 y = (cv::vx_load_aligned(l + q) * cv::vx_load_aligned(k + q) + half) >> 16;
+                cv::v_store_aligned(l + q, cv::v_min((y + eight) >> 4, top));
+            }
+            for (int i = 0; i < n; ++i)
+                c[j][i] = FSIV_LINEAR12_TO_SRGB[l[i]];
+            v[j] = cv::v_select(is_black, vblack, cv::vx_load_aligned(c[j]));
+        }
+        cv::v_store_interleave(dst + 3 * x, v[0], v[1], v[2]);
+    }
+    return x;
+}
+#endif
+
+/**
+ * @brief Escala en luz lineal cada píxel BGR por la ganancia de su V.
+ */
+static void
+apply_linear_luma_gain(const cv::Mat &in, cv::Mat &out, const std::vector<unsigned> &gain)
+{
+    CV_Assert(in.type() == CV_8UC3 && gain.size() == 256);
+    out.create(in.size(), in.type());
+    const unsigned *g = gain.data();
+    const uchar black = uchar(g[0]);
+    const ushort *dec = FSIV_SRGB_TO_LINEAR16;
+    cv::parallel_for_(cv::Range(0, in.rows), [&](const cv::Range &r)
+    {
+        for (int y = r.start; y < r.end; ++y)
+        {
+            const uchar *src = in.ptr<uchar>(y);
+            uchar *dst = out.ptr<uchar>(y);
+            int x = 0;
+#if CV_SIMD
+            x = linear_luma_gain_row(src, dst, in.cols, g, black);
+#endif
+            for (src += 3 * x, dst += 3 * x; x < in.cols; ++x, src += 3, dst += 3)
+            {
+                const int m = std::max(src[0], std::max(src[1], src[2]));
+                if (m == 0)
+                {
+                    dst[0] = dst[1] = dst[2] = black;
+                    continue;
+                }
+                const unsigned k = g[m];
+                dst[0] = linear16_to_srgb((dec[src[0]] * k + (1u << 15)) >> 16);
+                dst[1] = linear16_to_srgb((dec[src[1]] * k + (1u << 15)) >> 16);
+                dst[2] = linear16_to_srgb((dec[src[2]] * k + (1u << 15)) >> 16);
+            }
+        }
+    });
+}
+
+void
+fsiv_cbg_process_linear_into(const cv::Mat &in, cv::Mat &out,
+                             double contrast, double brightness, double gamma,
+                             bool only_luma, FsivCbgWorkspace *ws)
+{
+    CV_Assert(in.depth() == CV_8U);
+    FsivCbgWorkspace local_ws;
+    if (ws == nullptr)
+        ws = &local_ws;
+
+    const bool luma = only_luma && in.channels() == 3;
+    const cv::Vec3d params(contrast, brightness, gamma);
+    if (ws->linear_params != params)
+    {
+        ws->linear_lut.release();
+        ws->linear_gain.clear();
+        ws->linear_params = params;
+    }
+    if (luma)
+    {
+        if (ws->linear_gain.empty())
+        {
+            fsiv_cbg_build_linear_gain(contrast, brightness, gamma, ws->linear_gain);
+            ++ws->table_builds;
+        }
+        apply_linear_luma_gain(in, out, ws->linear_gain);
+    }
+    else
+    {
+        if (ws->linear_lut.empty())
+        {
+            fsiv_cbg_build_linear_lut(contrast, brightness, gamma, ws->linear_lut);
+            ++ws->table_builds;
+        }
+        cv::LUT(in, ws->linear_lut, out);
+    }
+    CV_Assert(out.rows == in.rows && out.cols == in.cols);
+    CV_Assert(out.type() == in.type());
+}
+
+/**
+ * @brief Histograma de V con una fila y una columna de cada cuatro.
+ * @return número de muestras.
+ */
+template <typename T>
+static int
+subsampled_luma_histogram(const cv::Mat &img, int shift, int hist[256])
+{
+    const int cn = img.channels();
+    int n = 0;
+    for (int y = 0; y < img.rows; y += 4)
+    {
+        const T *src = img.ptr<T>(y);
+        for (int x = 0; x < img.cols; x += 4, ++n)
+        {
+            const T *px = src + x * cn;
+            const int v = cn == 1 ? px[0] : std::max(px[0], std::max(px[1], px[2]));
+            ++hist[v >> shift];
+        }
+    }
+    return n;
+}
+
+static double
+histogram_percentile(const int hist[256], int n, double pct)
+{
+    const double target = pct * n;
+    int acc = 0;
+    for (int i = 0; i < 256; ++i)
+    {
+        acc += hist[i];
+        if (acc >= target)
+            return i / 255.0;
+    }
+    return 1.0;
+}
+
+void
+fsiv_estimate_cbg_params(const cv::Mat &img, double &contrast,
+                         double &brightness, double &gamma,
+                         FsivCbgAutoState *state)
+{
+    CV_Assert(!img.empty() && (img.depth() == CV_8U || img.depth() == CV_16U));
+    CV_Assert(img.channels() == 1 || img.channels() == 3);
+    const double low_pct = state ? state->low_pct : 0.01;
+    const double high_pct = state ? state->high_pct : 0.99;
+
+    int hist[256] = {0};
+    const int n = img.depth() == CV_8U ? subsampled_luma_histogram<uchar>(img, 0, hist)
+                                       : subsampled_luma_histogram<ushort>(img, 8, hist);
+    cv::Vec3d pct(histogram_percentile(hist, n, low_pct),
+                  histogram_percentile(hist, n, 0.5),
+                  histogram_percentile(hist, n, high_pct));
+    if (state)
+    {
+        if (state->valid)
+            pct = state->smoothing * state->percentiles + (1.0 - state->smoothing) * pct;
+        state->percentiles = pct;
+    }
+    const double lo = pct[0], mid = pct[1], hi = pct[2];
+
+    cv::Vec3d params(1.0, 0.0, 1.0);
+    if (hi - lo > 1.0 / 255.0)
+    {
+        // (mid^g - lo^g) / (hi^g - lo^g) decrece con g: buscamos por
+        // bisección la gamma que deja la mediana en 0.5.
+        const double g_min = 0.25, g_max = 2.0;
+        auto mid_level = [&](double g)
+        { return (std::pow(mid, g) - std::pow(lo, g)) / (std::pow(hi, g) - std::pow(lo, g)); };
+        double g;
+        if (mid_level(g_min) <= 0.5)
+            g = g_min;
+        else if (mid_level(g_max) >= 0.5)
+            g = g_max;
+        else
+        {
+            double a = g_min, b = g_max;
+            for (int i = 0; i < 30; ++i)
+            {
+                const double m = 0.5 * (a + b);
+                if (mid_level(m) > 0.5)
+                    a = m;
+                else
+                    b = m;
+            }
+            g = 0.5 * (a + b);
+        }
+        // Con c <= 2 sólo se estira todo [lo, hi] si hi^g - lo^g >= 0.5.
+        // Esa diferencia no crece siempre con g: con hi < 1 (imágenes oscuras)
+        // sube hasta un máximo y luego baja (con hi = 1 sólo sube y con lo = 0
+        // sólo baja). Como es unimodal, buscamos su máximo en [g_min, g_max]
+        // y, si llega a 0.5, movemos g hacia él lo justo, a costa de alejar
+        // algo la mediana de 0.5.
+        auto spread = [&](double g) { return std::pow(hi, g) - std::pow(lo, g); };
+        double a = g_min, b = g_max;
+        for (int i = 0; i < 60; ++i)
+        {
+            const double m1 = a + (b - a) / 3.0, m2 = b - (b - a) / 3.0;
+            if (spread(m1) < spread(m2))
+                a = m1;
+            else
+                b = m2;
+        }
+        const double g_peak = 0.5 * (a + b);
+        double gs = g;
+        if (spread(gs) < 0.5 && spread(g_peak) >= 0.5)
+        {
+            // Entre g y g_peak la diferencia es monótona: bisección.
+            double below = g, above = g_peak;
+            for (int i = 0; i < 30; ++i)
+            {
+                const double m = 0.5 * (below + above);
+                if (spread(m) >= 0.5)
+                    above = m;
+                else
+                    below = m;
+            }
+            gs = above;
+        }
+        if (spread(gs) >= 0.5)
+        {
+            const double c = 1.0 / spread(gs);
+            params = cv::Vec3d(c, std::max(-1.0, -c * std::pow(lo, gs)), gs);
+        }
+        else // rango demasiado estrecho: estiramos lo posible centrando la mediana.
+            params = cv::Vec3d(2.0, std::max(-1.0, 0.5 - 2.0 * std::pow(mid, g)), g);
+    }
+
+    if (state)
+    {
+        if (state->valid && cv::norm(params - state->params, cv::NORM_INF) < state->min_change)
+            params = state->params;
+        state->params = params;
+        state->valid = true;
+    }
+    contrast = params[0];
+    brightness = params[1];
+    gamma = params[2];
 }
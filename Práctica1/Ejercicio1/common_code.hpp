@@ -5,6 +5,69 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <iostream>
+#include <vector>
+
+#include "fsiv_core.hpp"
+
+/**
+ * @brief Espacio de trabajo para reutilizar los buffers intermedios.
+ *
+ * Las variantes fsiv_xxx_into() guardan aquí sus imágenes intermedias de
+ * forma que, si se llama de nuevo con imágenes del mismo tamaño y tipo
+ * (p.e. en un bucle de vídeo), no se vuelve a reservar memoria.
+ */
+struct FsivCbgWorkspace
+{
+    // Etapa independiente de los parámetros (ver fsiv_cbg_prepare).
+    cv::Mat flt;                /*< imagen de entrada en float [0,1].*/
+    cv::Mat hsv;                /*< imagen en el espacio HSV.*/
+    std::vector<cv::Mat> planes; /*< planos H, S y V de la entrada.*/
+    bool luma = false;          /*< true si se preparó para procesar sólo V.*/
+    int flt_depth = CV_32F;     /*< CV_32F o CV_16F (mitad de memoria) para flt, hsv y planes.*/
+
+    // Etapa dependiente de los parámetros (ver fsiv_cbg_apply).
+    cv::Mat tmp;                /*< resultado en float antes de pasar a byte.*/
+    cv::Mat v;                  /*< canal V procesado.*/
+
+    // Tablas para el camino con tablas (ver fsiv_cbg_process_lut_into).
+    cv::Mat lut;                /*< tabla 1x256 CV_8U con O = c*I^g + b.*/
+    cv::Mat gain;               /*< tabla 1x256 CV_32F de ganancias de V.*/
+    cv::Vec3d lut_params = cv::Vec3d(-1.0, -1.0, -1.0); /*< (c,b,g) de las tablas.*/
+
+    // Tablas del camino en punto fijo (ver fsiv_cbg_process_fixed_into).
+    cv::Mat lut8;               /*< tabla 1x256 CV_8U para imágenes de 8 bits.*/
+    cv::Mat lut16;              /*< tabla 1x65536 CV_16U para imágenes de 16 bits.*/
+    std::vector<unsigned> gain_q16; /*< ganancias de V en Q16 (65536 = 1.0).*/
+    cv::Vec3d fixed_params = cv::Vec3d(-1.0, -1.0, -1.0); /*< (c,b,g) de las tablas.*/
+    int fixed_depth = -1;       /*< profundidad (CV_8U o CV_16U) de las tablas.*/
+
+    // Tabla por canal (ver fsiv_cbg_process_channels_into).
+    cv::Mat lut3;               /*< tabla 1x256 CV_8UC3 o 1x65536 CV_16UC3.*/
+    cv::Matx33d lut3_params = cv::Matx33d::all(-1.0); /*< filas c, b y g de lut3.*/
+
+    // Tablas del modo en luz lineal (ver fsiv_cbg_process_linear_into).
+    cv::Mat linear_lut;         /*< tabla 1x256 CV_8U sRGB -> f(lineal) -> sRGB.*/
+    std::vector<unsigned> linear_gain; /*< ganancias Q16 de la V lineal.*/
+    cv::Vec3d linear_params = cv::Vec3d(-1.0, -1.0, -1.0); /*< (c,b,g) de las tablas.*/
+
+    unsigned table_builds = 0;  /*< tablas calculadas hasta ahora (en cualquier camino).*/
+};
+
+/**
+ * @brief Estado de fsiv_estimate_cbg_params entre frames de un vídeo.
+ *
+ * Guarda los percentiles suavizados y los últimos parámetros devueltos.
+ */
+struct FsivCbgAutoState
+{
+    double low_pct = 0.01;      /*< percentil que se lleva a 0.*/
+    double high_pct = 0.99;     /*< percentil que se lleva a 1.*/
+    double smoothing = 0.9;     /*< peso del pasado en la media exponencial [0,1).*/
+    double min_change = 0.01;   /*< cambio mínimo en c, b o g para devolver parámetros nuevos.*/
+    bool valid = false;         /*< false hasta el primer frame.*/
+    cv::Vec3d percentiles;      /*< percentiles bajo, mediana y alto suavizados en [0,1].*/
+    cv::Vec3d params;           /*< últimos (c,b,g) devueltos.*/
+};
 
 /**
  * @brief Convierte una imagen con tipo byte a flotante [0,1].
@@ -15,26 +78,32 @@
 cv::Mat fsiv_convert_image_byte_to_float(const cv::Mat &img);
 
 /**
- * @brief Convierte una imagen con tipo float [0,1] a byte [0,255].
+ * @brief Igual que fsiv_convert_image_byte_to_float pero escribiendo en out.
  * @param img imagen de entrada.
- * @return la imagen de salida.
- * @warning la imagen de entrada puede ser monocroma o RGB.
+ * @param out imagen de salida. Sólo se reserva memoria si cambia el tamaño o
+ *        el tipo.
+ * @param depth CV_32F o CV_16F. Con CV_16F la salida ocupa la mitad y la
+ *        precisión es de unos 3 decimales (sobra para valores en [0,1]
+ *        que vienen de 8 bits).
  */
-cv::Mat fsiv_convert_image_float_to_byte(const cv::Mat &img);
+void fsiv_convert_image_byte_to_float_into(const cv::Mat &img, cv::Mat &out,
+                                           int depth = CV_32F);
 
 /**
- * @brief Convierte una imagen en color BGR a HSV.
+ * @brief Convierte una imagen con tipo float [0,1] a byte [0,255].
  * @param img imagen de entrada.
  * @return la imagen de salida.
+ * @warning la imagen de entrada puede ser monocroma o RGB.
  */
-cv::Mat fsiv_convert_bgr_to_hsv(const cv::Mat &img);
+cv::Mat fsiv_convert_image_float_to_byte(const cv::Mat &img);
 
 /**
- * @brief Convierte una imagen en color HSV a BGR.
- * @param img imagen de entrada.
- * @return la imagen de salida.
+ * @brief Igual que fsiv_convert_image_float_to_byte pero escribiendo en out.
+ * @param img imagen de entrada (CV_32F o CV_16F).
+ * @param out imagen de salida. Sólo se reserva memoria si cambia el tamaño o
+ *        el tipo.
  */
-cv::Mat fsiv_convert_hsv_to_bgr(const cv::Mat &img);
+void fsiv_convert_image_float_to_byte_into(const cv::Mat &img, cv::Mat &out);
 
 /**
  * @brief Realiza un control del brillo/contraste/gamma de la imagen.
@@ -56,3 +125,249 @@ cv::Mat fsiv_convert_hsv_to_bgr(const cv::Mat &img);
 cv::Mat fsiv_cbg_process(const cv::Mat &img,
                          double contrast = 1.0, double brightness = 0.0, double gamma = 1.0,
                          bool only_luma = true);
+
+/**
+ * @brief Igual que fsiv_cbg_process pero escribiendo en out.
+ *
+ * Los buffers intermedios se toman de ws, por lo que en llamadas sucesivas
+ * con imágenes del mismo tamaño no se reserva memoria.
+ *
+ * @param img  imagen de entrada.
+ * @param out  imagen de salida (mismo tamaño y tipo que img).
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param only_luma si es true sólo se procesa el canal Luma.
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ */
+void fsiv_cbg_process_into(const cv::Mat &img, cv::Mat &out,
+                           double contrast = 1.0, double brightness = 0.0,
+                           double gamma = 1.0, bool only_luma = true,
+                           FsivCbgWorkspace *ws = nullptr);
+
+/**
+ * @brief Prepara la etapa del proceso cbg que no depende de los parámetros.
+ *
+ * Convierte la entrada a float (ws.flt_depth) y, si se procesa sólo la
+ * luma, a planos HSV. El resultado queda en ws y puede reutilizarse con
+ * fsiv_cbg_apply() para distintos valores de contraste/brillo/gamma.
+ *
+ * @param img imagen de entrada (CV_8U).
+ * @param only_luma si es true y la imagen es RGB sólo se procesará el canal V.
+ * @param ws espacio de trabajo donde se guardan los intermedios.
+ */
+void fsiv_cbg_prepare(const cv::Mat &img, bool only_luma, FsivCbgWorkspace &ws);
+
+/**
+ * @brief Aplica la etapa del proceso cbg que depende de los parámetros.
+ * @pre ws se ha preparado con fsiv_cbg_prepare().
+ * @param ws espacio de trabajo preparado. Los intermedios no se modifican.
+ * @param out imagen de salida (CV_8U).
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ */
+void fsiv_cbg_apply(FsivCbgWorkspace &ws, cv::Mat &out,
+                    double contrast, double brightness, double gamma);
+
+/**
+ * @brief Calcula la tabla de 256 entradas O = c * I^g + b para imágenes byte.
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param lut tabla de salida 1x256 CV_8U, usable con cv::LUT.
+ */
+void fsiv_cbg_build_lut(double contrast, double brightness, double gamma,
+                        cv::Mat &lut);
+
+/**
+ * @brief Calcula la tabla de ganancias para procesar sólo la luma.
+ *
+ * Al cambiar sólo V en HSV los canales B, G y R quedan escalados por
+ * f(V)/V, siendo V = max(B,G,R) y f(V) = c * V^g + b. La entrada m>0 de la
+ * tabla es esa ganancia para V=m/255. La entrada 0 es el valor (en [0,255])
+ * que toman los píxeles negros.
+ *
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param gain tabla de salida 1x256 CV_32F.
+ */
+void fsiv_cbg_build_luma_gain(double contrast, double brightness, double gamma,
+                              cv::Mat &gain);
+
+/**
+ * @brief Igual que fsiv_cbg_process_into pero usando tablas de 256 entradas.
+ *
+ * Las tablas se guardan en ws y sólo se recalculan cuando cambian los
+ * parámetros, por lo que cada llamada es una única pasada sobre la imagen
+ * sin conversiones a float ni a HSV.
+ *
+ * @param img  imagen de entrada (CV_8U, 1 o 3 canales).
+ * @param out  imagen de salida (mismo tamaño y tipo que img).
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param only_luma si es true sólo se procesa el canal Luma.
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ */
+void fsiv_cbg_process_lut_into(const cv::Mat &img, cv::Mat &out,
+                               double contrast = 1.0, double brightness = 0.0,
+                               double gamma = 1.0, bool only_luma = true,
+                               FsivCbgWorkspace *ws = nullptr);
+
+/**
+ * @brief Calcula la tabla de 65536 entradas O = c * I^g + b para imágenes de
+ * 16 bits.
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param lut tabla de salida 1x65536 CV_16U.
+ */
+void fsiv_cbg_build_lut16(double contrast, double brightness, double gamma,
+                          cv::Mat &lut);
+
+/**
+ * @brief Calcula la tabla de ganancias de V en punto fijo Q16.
+ *
+ * Como fsiv_cbg_build_luma_gain, pero la entrada m>0 es
+ * round(65536 * f(V)/V) con V=m/M, M el máximo de la profundidad y f(V)
+ * recortado a [0,1]. Así B*g, G*g y R*g (todos <= m) caben en 32 bits y
+ * el resultado no pasa de M. La entrada 0 es el valor (en [0,M]) que
+ * toman los píxeles negros.
+ *
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param depth CV_8U o CV_16U.
+ * @param gain tabla de salida con M+1 entradas.
+ */
+void fsiv_cbg_build_luma_gain_q16(double contrast, double brightness, double gamma,
+                                  int depth, std::vector<unsigned> &gain);
+
+/**
+ * @brief Igual que fsiv_cbg_process_into pero sólo con aritmética entera.
+ *
+ * Admite imágenes CV_8U y CV_16U y devuelve la misma profundidad, sin pasar
+ * por float. Sin only_luma cada muestra se transforma con una tabla (256 o
+ * 65536 entradas). Con only_luma cada píxel se escala por la ganancia Q16
+ * de su V = max(B,G,R) con SIMD. Difiere del camino en float en 1 nivel
+ * como mucho, salvo en píxeles con c*V^g + b > 1: aquí se recorta V (se
+ * conserva el tono) y en float se recorta cada canal por separado.
+ *
+ * @param img  imagen de entrada (CV_8U o CV_16U, 1 o 3 canales).
+ * @param out  imagen de salida (mismo tamaño y tipo que img).
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param only_luma si es true sólo se procesa el canal Luma.
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ */
+void fsiv_cbg_process_fixed_into(const cv::Mat &img, cv::Mat &out,
+                                 double contrast = 1.0, double brightness = 0.0,
+                                 double gamma = 1.0, bool only_luma = true,
+                                 FsivCbgWorkspace *ws = nullptr);
+
+/**
+ * @brief Calcula una tabla con una curva O = c * I^g + b distinta por canal.
+ * @param contrast contraste de B, G y R.
+ * @param brightness brillo de B, G y R.
+ * @param gamma gamma de B, G y R.
+ * @param depth CV_8U (256 entradas) o CV_16U (65536 entradas).
+ * @param lut tabla de salida de 3 canales, usable con cv::LUT si es CV_8U.
+ */
+void fsiv_cbg_build_lut3(const cv::Vec3d &contrast, const cv::Vec3d &brightness,
+                         const cv::Vec3d &gamma, int depth, cv::Mat &lut);
+
+/**
+ * @brief Contraste/brillo/gamma independientes para B, G y R.
+ *
+ * Una única pasada sobre la imagen entrelazada: cada muestra se busca en la
+ * tabla de su canal (3 x 256 bytes, que caben en L1). La tabla sólo se
+ * recalcula cuando cambian los parámetros. No hay modo luma: cada canal
+ * tiene su propia curva. Con imágenes de un canal se usa la curva de B.
+ *
+ * @param img  imagen de entrada (CV_8U o CV_16U, 1 o 3 canales).
+ * @param out  imagen de salida (mismo tamaño y tipo que img).
+ * @param contrast contraste de B, G y R.
+ * @param brightness brillo de B, G y R.
+ * @param gamma gamma de B, G y R.
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ */
+void fsiv_cbg_process_channels_into(const cv::Mat &img, cv::Mat &out,
+                                    const cv::Vec3d &contrast,
+                                    const cv::Vec3d &brightness,
+                                    const cv::Vec3d &gamma,
+                                    FsivCbgWorkspace *ws = nullptr);
+
+/**
+ * @brief Calcula la tabla del modo en luz lineal sin luma.
+ *
+ * Cada valor sRGB se pasa a lineal (16 bits, FSIV_SRGB_TO_LINEAR16), se le
+ * aplica f(L) = c * L^g + b recortado a [0,1] y se vuelve a sRGB con la
+ * tabla inversa de 12 bits (FSIV_LINEAR12_TO_SRGB).
+ *
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param lut tabla de salida 1x256 CV_8U, usable con cv::LUT.
+ */
+void fsiv_cbg_build_linear_lut(double contrast, double brightness, double gamma,
+                               cv::Mat &lut);
+
+/**
+ * @brief Calcula las ganancias Q16 del modo en luz lineal con luma.
+ *
+ * La entrada m>0 es round(65536 * f(L)/L) con L el valor lineal de m. La
+ * entrada 0 es el valor sRGB que toman los píxeles negros.
+ *
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param gain tabla de salida con 256 entradas.
+ */
+void fsiv_cbg_build_linear_gain(double contrast, double brightness, double gamma,
+                                std::vector<unsigned> &gain);
+
+/**
+ * @brief Igual que fsiv_cbg_process_lut_into pero en luz lineal.
+ *
+ * El contraste, el brillo y la gamma se aplican a los valores lineales y
+ * no a los codificados en sRGB, así que los cambios de brillo son
+ * perceptualmente uniformes. Todo el proceso es una pasada: sin luma una
+ * tabla de 256 entradas ya compuesta; con luma, por píxel, se busca la
+ * ganancia de la V lineal y cada canal se pasa a lineal, se escala y se
+ * vuelve a sRGB con las tablas constantes de srgb_tables.hpp.
+ *
+ * @param img  imagen de entrada (CV_8U en sRGB, 1 o 3 canales).
+ * @param out  imagen de salida (mismo tamaño y tipo que img).
+ * @param contrast controla el ajuste del contraste.
+ * @param brightness controla el ajuste del brillo.
+ * @param gamma controla el ajuste de la gamma.
+ * @param only_luma si es true sólo se procesa el canal Luma.
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ */
+void fsiv_cbg_process_linear_into(const cv::Mat &img, cv::Mat &out,
+                                  double contrast = 1.0, double brightness = 0.0,
+                                  double gamma = 1.0, bool only_luma = true,
+                                  FsivCbgWorkspace *ws = nullptr);
+
+/**
+ * @brief Estima contraste, brillo y gamma a partir del histograma de la luma.
+ *
+ * Se calcula el histograma de V = max(B,G,R) con uno de cada 16 píxeles
+ * (una fila y una columna de cada cuatro) y se eligen los parámetros de
+ * O = c*I^g + b que llevan el percentil bajo a 0, el alto a 1 y la mediana
+ * a 0.5. Con state los percentiles se suavizan entre llamadas y los
+ * parámetros sólo cambian si lo hacen más de state->min_change, así que
+ * puede llamarse en cada frame sin parpadeos ni recalcular tablas.
+ *
+ * @param img imagen de entrada (CV_8U o CV_16U, gris o BGR).
+ * @param contrast contraste estimado en [0, 2].
+ * @param brightness brillo estimado en [-1, 1].
+ * @param gamma gamma estimada en [0.25, 2].
+ * @param state estado para vídeo. Si es nulo no se suaviza.
+ */
+void fsiv_estimate_cbg_params(const cv::Mat &img, double &contrast,
+                              double &brightness, double &gamma,
+                              FsivCbgAutoState *state = nullptr);
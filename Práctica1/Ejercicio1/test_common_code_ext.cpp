@@ -0,0 +1,917 @@
+/*!
+  Tests de las extensiones de common_code que no cubre test_common_code.
+
+  Cada test compara la versión rápida de una función con la versión de
+  referencia sobre imágenes sintéticas, por lo que no depende de ficheros.
+
+  Uso: test_common_code_ext <nombre_del_test>
+*/
+
+#include <iostream>
+#include <exception>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "common_code.hpp"
+#include "cbg_renderer.hpp"
+#include "coalescing_scheduler.hpp"
+#include "bounded_queue.hpp"
+#include "cbg_batch.hpp"
+#include "cbg_strip.hpp"
+#include "cbg_sweep.hpp"
+
+static cv::Mat
+make_test_image(int type, cv::Size size = cv::Size(97, 61))
+{
+    cv::Mat img(size, type);
+    cv::theRNG() = cv::RNG(0x5EED);
+    cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(256));
+    return img;
+}
+
+/**
+ * @brief Comprueba que dos imágenes son iguales salvo una tolerancia.
+ */
+static bool
+check_equal(const std::string &what, const cv::Mat &result,
+            const cv::Mat &expected, double tolerance = 0.0)
+{
+    if (result.size() != expected.size() || result.type() != expected.type())
+    {
+        std::cerr << what << ": wrong size or type." << std::endl;
+        return false;
+    }
+    const double err = cv::norm(result, expected, cv::NORM_INF);
+    if (err > tolerance)
+    {
+        std::cerr << what << ": max. error " << err << " > " << tolerance
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool
+test_into_variants()
+{
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    cv::Mat out;
+
+    fsiv_convert_image_byte_to_float_into(bgr, out);
+    ok &= check_equal("byte_to_float", out, fsiv_convert_image_byte_to_float(bgr));
+    const cv::Mat flt = out.clone();
+    fsiv_convert_image_float_to_byte_into(flt, out);
+    ok &= check_equal("float_to_byte", out, fsiv_convert_image_float_to_byte(flt));
+    fsiv_convert_bgr_to_hsv_into(flt, out);
+    ok &= check_equal("bgr_to_hsv", out, fsiv_convert_bgr_to_hsv(flt));
+    const cv::Mat hsv = out.clone();
+    fsiv_convert_hsv_to_bgr_into(hsv, out);
+    ok &= check_equal("hsv_to_bgr", out, fsiv_convert_hsv_to_bgr(hsv));
+    return ok;
+}
+
+/**
+ * @brief El proceso cbg de referencia en float, escrito aparte de
+ * common_code: O = c * I^g + b sobre BGR o sobre la V de HSV.
+ */
+static cv::Mat
+cbg_reference(const cv::Mat &in, double c, double b, double g, bool only_luma)
+{
+    cv::Mat flt;
+    in.convertTo(flt, CV_32F, 1.0 / 255.0);
+    const bool luma = only_luma && in.channels() == 3;
+    std::vector<cv::Mat> planes;
+    if (luma)
+    {
+        cv::cvtColor(flt, flt, cv::COLOR_BGR2HSV);
+        cv::split(flt, planes);
+        flt = planes[2];
+    }
+    cv::Mat v;
+    cv::pow(flt, g, v);
+    v.convertTo(v, CV_32F, c, b);
+    if (luma)
+    {
+        planes[2] = v;
+        cv::merge(planes, v);
+        cv::cvtColor(v, v, cv::COLOR_HSV2BGR);
+    }
+    cv::Mat out;
+    v.convertTo(out, CV_8U, 255.0);
+    return out;
+}
+
+static bool
+test_cbg_process_into()
+{
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    const cv::Mat gray = make_test_image(CV_8UC1);
+    FsivCbgWorkspace ws;
+    cv::Mat out;
+
+    fsiv_cbg_process_into(bgr, out, 1.3, -0.1, 0.7, false, &ws);
+    ok &= check_equal("cbg rgb", out, cbg_reference(bgr, 1.3, -0.1, 0.7, false), 1.0);
+    const uchar *data = out.data;
+    fsiv_cbg_process_into(bgr, out, 0.8, 0.2, 1.4, true, &ws);
+    ok &= check_equal("cbg luma", out, cbg_reference(bgr, 0.8, 0.2, 1.4, true), 1.0);
+    if (out.data != data)
+    {
+        std::cerr << "cbg: the output buffer was reallocated." << std::endl;
+        ok = false;
+    }
+    fsiv_cbg_process_into(gray, out, 1.3, -0.1, 0.7, false, &ws);
+    ok &= check_equal("cbg gray", out, cbg_reference(gray, 1.3, -0.1, 0.7, false), 1.0);
+    return ok;
+}
+
+static bool
+test_cbg_prepare_apply()
+{
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    FsivCbgWorkspace ws;
+    cv::Mat out;
+
+    for (int luma = 0; luma < 2; ++luma)
+    {
+        fsiv_cbg_prepare(bgr, luma, ws);
+        const cv::Mat flt = ws.flt.clone();
+        fsiv_cbg_apply(ws, out, 1.3, -0.1, 0.7);
+        ok &= check_equal("apply 1", out, cbg_reference(bgr, 1.3, -0.1, 0.7, luma), 1.0);
+        fsiv_cbg_apply(ws, out, 0.6, 0.3, 1.8);
+        ok &= check_equal("apply 2", out, cbg_reference(bgr, 0.6, 0.3, 1.8, luma), 1.0);
+        ok &= check_equal("cached input", ws.flt, flt);
+    }
+    return ok;
+}
+
+static bool
+test_cbg_process_lut_into()
+{
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    const cv::Mat gray = make_test_image(CV_8UC1);
+    FsivCbgWorkspace ws;
+    cv::Mat out;
+
+    const double params[][3] = {{1.0, 0.0, 1.0}, {1.3, -0.1, 0.7},
+                                {0.6, 0.3, 1.8}, {2.0, 1.0, 0.0}};
+    for (const auto &p : params)
+    {
+        for (int luma = 0; luma < 2; ++luma)
+        {
+            fsiv_cbg_process_lut_into(bgr, out, p[0], p[1], p[2], luma, &ws);
+            ok &= check_equal("lut rgb", out,
+                              fsiv_cbg_process(bgr, p[0], p[1], p[2], luma), 1.0);
+        }
+        fsiv_cbg_process_lut_into(gray, out, p[0], p[1], p[2], false, &ws);
+        ok &= check_equal("lut gray", out,
+                          fsiv_cbg_process(gray, p[0], p[1], p[2], false), 1.0);
+    }
+    return ok;
+}
+
+/**
+ * @brief Referencia en double del proceso en punto fijo: en modo luma se
+ * recorta V a [0,1] y se escalan B, G y R por V'/V.
+ */
+static cv::Mat
+fixed_reference(const cv::Mat &in, double c, double b, double g, bool only_luma)
+{
+    const double max_v = in.depth() == CV_8U ? 255.0 : 65535.0;
+    cv::Mat in_d, out_d;
+    in.convertTo(in_d, CV_64F, 1.0 / max_v);
+    out_d.create(in_d.size(), in_d.type());
+    const int cn = in.channels();
+    for (int y = 0; y < in.rows; ++y)
+        for (int x = 0; x < in.cols; ++x)
+        {
+            const double *s = in_d.ptr<double>(y) + cn * x;
+            double *d = out_d.ptr<double>(y) + cn * x;
+            if (only_luma && cn == 3)
+            {
+                const double v = std::max(s[0], std::max(s[1], s[2]));
+                const double f = std::min(1.0, std::max(0.0, c * std::pow(v, g) + b));
+                for (int i = 0; i < 3; ++i)
+                    d[i] = v > 0.0 ? s[i] * f / v : f;
+            }
+            else
+                for (int i = 0; i < cn; ++i)
+                    d[i] = c * std::pow(s[i], g) + b;
+        }
+    cv::Mat out;
+    out_d.convertTo(out, in.depth(), max_v);
+    return out;
+}
+
+static bool
+test_cbg_process_fixed_into()
+{
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    const cv::Mat gray = make_test_image(CV_8UC1);
+    cv::Mat bgr16(bgr.size(), CV_16UC3), gray16(gray.size(), CV_16UC1);
+    cv::randu(bgr16, cv::Scalar::all(0), cv::Scalar::all(65536));
+    cv::randu(gray16, cv::Scalar::all(0), cv::Scalar::all(65536));
+    bgr16.at<cv::Vec3w>(0, 0) = cv::Vec3w(0, 0, 0); // el caso de los negros.
+    FsivCbgWorkspace ws;
+    cv::Mat out;
+
+    const double params[][3] = {{1.0, 0.0, 1.0}, {1.3, -0.1, 0.7},
+                                {0.6, 0.3, 1.8}, {0.8, 0.1, 0.5}};
+    for (const auto &p : params)
+    {
+        // Con 8 bits y sin luma es la misma tabla que el camino con tablas.
+        fsiv_cbg_process_fixed_into(gray, out, p[0], p[1], p[2], false, &ws);
+        ok &= check_equal("fixed gray", out,
+                          fsiv_cbg_process(gray, p[0], p[1], p[2], false), 1.0);
+        for (int luma = 0; luma < 2; ++luma)
+        {
+            fsiv_cbg_process_fixed_into(bgr, out, p[0], p[1], p[2], luma, &ws);
+            ok &= check_equal("fixed rgb", out, fixed_reference(bgr, p[0], p[1], p[2], luma), 1.0);
+            fsiv_cbg_process_fixed_into(bgr16, out, p[0], p[1], p[2], luma, &ws);
+            ok &= check_equal("fixed rgb16", out, fixed_reference(bgr16, p[0], p[1], p[2], luma), 1.0);
+        }
+        fsiv_cbg_process_fixed_into(gray16, out, p[0], p[1], p[2], true, &ws);
+        ok &= check_equal("fixed gray16", out, fixed_reference(gray16, p[0], p[1], p[2], false), 1.0);
+    }
+    // Si f(V) <= 1 coincide con el camino en float de referencia.
+    fsiv_cbg_process_fixed_into(bgr, out, 0.8, 0.1, 0.5, true, &ws);
+    ok &= check_equal("fixed vs float", out, fsiv_cbg_process(bgr, 0.8, 0.1, 0.5, true), 1.0);
+
+    // table_builds cuenta las tablas que se calculan, no las llamadas.
+    FsivCbgWorkspace counted;
+    fsiv_cbg_process_fixed_into(bgr16, out, 1.3, -0.1, 0.7, false, &counted);
+    fsiv_cbg_process_fixed_into(bgr16, out, 1.3, -0.1, 0.7, false, &counted);
+    const unsigned fixed_builds = counted.table_builds;
+    fsiv_cbg_process_fixed_into(bgr16, out, 1.2, -0.1, 0.7, false, &counted);
+    if (fixed_builds != 1 || counted.table_builds != 2)
+    {
+        std::cerr << "fixed: " << counted.table_builds << " table builds (expected 2)." << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+static bool
+test_half_intermediates()
+{
+    // CV_16F tiene 11 bits de mantisa: error relativo <= 2^-11.
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    cv::Mat half, flt, out;
+
+    fsiv_convert_image_byte_to_float_into(bgr, half, CV_16F);
+    if (half.depth() != CV_16F)
+    {
+        std::cerr << "half: byte_to_float did not produce CV_16F." << std::endl;
+        return false;
+    }
+    half.convertTo(flt, CV_32F);
+    ok &= check_equal("half byte_to_float", flt, fsiv_convert_image_byte_to_float(bgr), 1.0 / 2048);
+    fsiv_convert_image_float_to_byte_into(half, out);
+    ok &= check_equal("half float_to_byte", out, bgr);
+
+    const cv::Mat hsv_ref = fsiv_convert_bgr_to_hsv(fsiv_convert_image_byte_to_float(bgr));
+    cv::Mat hsv;
+    fsiv_convert_bgr_to_hsv_into(half, hsv);
+    hsv.convertTo(flt, CV_32F);
+    ok &= check_equal("half bgr_to_hsv", flt, hsv_ref, 360.0 / 1024);
+    fsiv_convert_hsv_to_bgr_into(hsv, out);
+    out.convertTo(flt, CV_32F);
+    ok &= check_equal("half hsv_to_bgr", flt, fsiv_convert_image_byte_to_float(bgr), 1.0 / 128);
+
+    FsivCbgWorkspace ws;
+    ws.flt_depth = CV_16F;
+    for (int luma = 0; luma < 2; ++luma)
+    {
+        fsiv_cbg_process_into(bgr, out, 1.3, -0.1, 0.7, luma, &ws);
+        ok &= check_equal("half cbg", out, fsiv_cbg_process(bgr, 1.3, -0.1, 0.7, luma), 1.0);
+        if (ws.flt.depth() != CV_16F)
+        {
+            std::cerr << "half: the workspace does not use CV_16F." << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool
+test_cbg_process_channels_into()
+{
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    cv::Mat bgr16(bgr.size(), CV_16UC3);
+    cv::randu(bgr16, cv::Scalar::all(0), cv::Scalar::all(65536));
+    FsivCbgWorkspace ws;
+    cv::Mat out, expected;
+
+    // Con la misma curva en los tres canales es el camino con tablas.
+    fsiv_cbg_process_channels_into(bgr, out, cv::Vec3d::all(1.3), cv::Vec3d::all(-0.1),
+                                   cv::Vec3d::all(0.7), &ws);
+    fsiv_cbg_process_lut_into(bgr, expected, 1.3, -0.1, 0.7, false, &ws);
+    ok &= check_equal("channels same curve", out, expected);
+
+    // Cada canal debe coincidir con procesarlo por separado con su curva.
+    const cv::Vec3d c(1.3, 1.0, 0.6), b(-0.1, 0.0, 0.3), g(0.7, 1.0, 1.8);
+    const cv::Mat inputs[] = {bgr, bgr16};
+    for (const cv::Mat &img : inputs)
+    {
+        fsiv_cbg_process_channels_into(img, out, c, b, g, &ws);
+        for (int i = 0; i < 3; ++i)
+        {
+            cv::Mat in_c, out_c;
+            cv::extractChannel(img, in_c, i);
+            cv::extractChannel(out, out_c, i);
+            fsiv_cbg_process_fixed_into(in_c, expected, c[i], b[i], g[i], false);
+            ok &= check_equal("channels", out_c, expected);
+        }
+    }
+    return ok;
+}
+
+static double
+srgb_to_linear(double x)
+{
+    return x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4);
+}
+
+static double
+linear_to_srgb(double y)
+{
+    return y <= 0.0031308 ? 12.92 * y : 1.055 * std::pow(y, 1.0 / 2.4) - 0.055;
+}
+
+static bool
+test_cbg_process_linear_into()
+{
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    FsivCbgWorkspace ws;
+    cv::Mat out;
+
+    // Las tablas constantes deben coincidir con las fórmulas.
+    fsiv_cbg_process_linear_into(bgr, out, 1.0, 0.0, 1.0, false, &ws);
+    ok &= check_equal("linear identity", out, bgr);
+
+    const double params[][3] = {{1.3, -0.1, 0.7}, {0.6, 0.3, 1.8}, {0.8, 0.1, 0.5}};
+    for (const auto &p : params)
+        for (int luma = 0; luma < 2; ++luma)
+        {
+            cv::Mat expected(bgr.size(), bgr.type());
+            for (int y = 0; y < bgr.rows; ++y)
+                for (int x = 0; x < bgr.cols; ++x)
+                {
+                    const cv::Vec3b &s = bgr.at<cv::Vec3b>(y, x);
+                    cv::Vec3b &d = expected.at<cv::Vec3b>(y, x);
+                    const double v = srgb_to_linear(std::max(s[0], std::max(s[1], s[2])) / 255.0);
+                    const double fv = std::min(1.0, std::max(0.0, p[0] * std::pow(v, p[2]) + p[1]));
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        const double l = srgb_to_linear(s[i] / 255.0);
+                        double f = std::min(1.0, std::max(0.0, p[0] * std::pow(l, p[2]) + p[1]));
+                        if (luma)
+                            f = v > 0.0 ? l * fv / v : fv;
+                        d[i] = cv::saturate_cast<uchar>(255.0 * linear_to_srgb(f));
+                    }
+                }
+            fsiv_cbg_process_linear_into(bgr, out, p[0], p[1], p[2], luma, &ws);
+            ok &= check_equal("linear", out, expected, 1.0);
+        }
+    return ok;
+}
+
+static bool
+test_cbg_renderer()
+{
+    const cv::Mat bgr = make_test_image(CV_8UC3, cv::Size(640, 480));
+    CbgRenderer renderer(bgr, 20, 16);
+    CbgParams p;
+    p.contrast = 1.3;
+    p.luma_is_set = true;
+    renderer.request(p);
+    p.gamma = 0.6; // sólo debe quedar el render de los últimos parámetros.
+    renderer.request(p);
+
+    cv::Mat out;
+    for (int i = 0; i < 500 && !renderer.fetch(out); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (out.empty())
+    {
+        std::cerr << "renderer: no result after 5 s." << std::endl;
+        return false;
+    }
+    cv::Mat expected;
+    fsiv_cbg_process_lut_into(bgr, expected, p.contrast, p.bright, p.gamma, true);
+    return check_equal("renderer", out, expected) && !renderer.fetch(out);
+}
+
+static bool
+test_coalescing_scheduler()
+{
+    // Un render lento y muchos eventos seguidos: sólo se renderiza el primero
+    // y el último, el resto se agrupan.
+    CoalescingScheduler<int, int> scheduler(
+        [](const int &p, int &r)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            r = p;
+        },
+        10);
+    for (int i = 1; i <= 20; ++i)
+        scheduler.post(i);
+
+    int result = 0;
+    for (int i = 0; i < 500 && result != 20; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        scheduler.fetch(result);
+    }
+    const bool ok = result == 20 && scheduler.posted() == 20 &&
+                    scheduler.rendered() + scheduler.coalesced() == 20 &&
+                    scheduler.rendered() <= 2;
+    if (!ok)
+        std::cerr << "scheduler: result " << result << ", posted "
+                  << scheduler.posted() << ", rendered " << scheduler.rendered()
+                  << ", coalesced " << scheduler.coalesced() << std::endl;
+    return ok;
+}
+
+static bool
+test_bounded_queue()
+{
+    // Un productor rápido y un consumidor: llegan todos, en orden, y tras
+    // close() el consumidor vacía la cola antes de terminar.
+    BoundedQueue<int> queue(3);
+    std::thread producer([&queue]()
+    {
+        for (int i = 0; i < 100; ++i)
+            queue.push(int(i));
+        queue.close();
+    });
+    bool ok = true;
+    int expected = 0, v = 0;
+    while (queue.pop(v))
+        ok &= (v == expected++);
+    producer.join();
+    ok &= (expected == 100) && !queue.push(0);
+    if (!ok)
+        std::cerr << "bounded_queue: wrong order or count." << std::endl;
+    return ok;
+}
+
+static bool
+test_cbg_batch()
+{
+    // Se procesa un lote en PNG (sin pérdidas) dado con un fichero de lista
+    // y cada salida debe coincidir con el render de su entrada. Todo va en
+    // un directorio temporal nuevo, que se borra al final.
+    const std::string root = cv::tempfile("_cbg_batch");
+    const std::string in_dir = cv::utils::fs::join(root, "in");
+    const std::string out_dir = cv::utils::fs::join(root, "out");
+    cv::utils::fs::createDirectories(in_dir);
+    const std::string list_name = cv::utils::fs::join(in_dir, "list.txt");
+    std::vector<cv::Mat> images;
+    {
+        std::ofstream list(list_name.c_str());
+        for (int i = 0; i < 6; ++i)
+        {
+            const std::string name = cv::utils::fs::join(in_dir, "img" + std::to_string(i) + ".png");
+            images.push_back(make_test_image(i % 2 ? CV_8UC3 : CV_8UC1, cv::Size(40 + i, 30)));
+            cv::imwrite(name, images.back());
+            list << name << std::endl;
+        }
+    }
+    const std::vector<std::string> inputs = cbg_batch_list_inputs(list_name);
+    if (inputs.size() != images.size())
+    {
+        std::cerr << "cbg_batch: wrong number of inputs in the list file." << std::endl;
+        cv::utils::fs::remove_all(root);
+        return false;
+    }
+    CbgParams p;
+    p.contrast = 1.3;
+    p.bright = -0.1;
+    p.gamma = 0.7;
+    p.luma_is_set = true;
+    CbgBatchOptions opts;
+    opts.threads = 2;
+    opts.queue_size = 2;
+    opts.report_every_s = 0.0;
+    bool ok = cbg_batch_process(inputs, out_dir, p, opts) == 0;
+    FsivCbgWorkspace ws;
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        cv::Mat expected;
+        cbg_render(images[i], expected, p, ws);
+        const cv::Mat result = cv::imread(cv::utils::fs::join(out_dir, "img" + std::to_string(i) + ".png"),
+                                          cv::IMREAD_ANYCOLOR);
+        ok &= check_equal("cbg_batch", result, expected, 0.0);
+    }
+
+    // Mismo nombre en directorios distintos: cada salida mantiene su ruta
+    // relativa al directorio común y no se pisan.
+    const std::string sub_dir = cv::utils::fs::join(in_dir, "sub");
+    cv::utils::fs::createDirectories(sub_dir);
+    const std::string same_name = cv::utils::fs::join(sub_dir, "img0.png");
+    cv::imwrite(same_name, images[1]);
+    const std::string nested_out = cv::utils::fs::join(root, "out_nested");
+    ok &= cbg_batch_process({inputs[0], same_name}, nested_out, p, opts) == 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        cv::Mat expected;
+        cbg_render(images[i], expected, p, ws);
+        const std::string name = i == 0 ? cv::utils::fs::join(nested_out, "img0.png")
+                                        : cv::utils::fs::join(nested_out, "sub/img0.png");
+        ok &= check_equal("cbg_batch " + name, cv::imread(name, cv::IMREAD_ANYCOLOR), expected, 0.0);
+    }
+    // Dos entradas que irían al mismo fichero: error y no se procesa nada.
+    const std::string dup_out = cv::utils::fs::join(root, "out_dup");
+    if (cbg_batch_process({inputs[0], inputs[0]}, dup_out, p, opts) != 2 ||
+        cv::utils::fs::exists(cv::utils::fs::join(dup_out, "img0.png")))
+    {
+        std::cerr << "cbg_batch: colliding outputs were not rejected." << std::endl;
+        ok = false;
+    }
+    cv::utils::fs::remove_all(root);
+    return ok;
+}
+
+static bool
+test_cbg_strips()
+{
+    // Con un presupuesto de pocas filas la imagen se procesa en muchas
+    // franjas; el resultado debe ser el mismo que procesándola entera.
+    bool ok = true;
+    auto remove_files = []()
+    {
+        for (const char *name : {"cbg_strips_in.ppm", "cbg_strips_out.ppm", "cbg_strips_in.pgm",
+                                 "cbg_strips_out.pgm", "cbg_strips_in_1000.pgm", "cbg_strips_out_1000.pgm"})
+            std::remove(name);
+    };
+    cv::Mat bgr16(45, 37, CV_16UC3);
+    cv::randu(bgr16, cv::Scalar::all(0), cv::Scalar::all(65536));
+    const cv::Mat images[] = {make_test_image(CV_8UC3), make_test_image(CV_8UC1), bgr16};
+    CbgParams p;
+    p.contrast = 1.3;
+    p.bright = -0.1;
+    p.gamma = 0.7;
+    FsivCbgWorkspace ws;
+    for (const cv::Mat &img : images)
+        for (int luma = 0; luma < 2; ++luma)
+        {
+            p.luma_is_set = luma;
+            const std::string ext = img.channels() == 3 ? ".ppm" : ".pgm";
+            cv::imwrite("cbg_strips_in" + ext, img);
+            CbgPnmInfo info;
+            info.width = img.cols;
+            info.channels = img.channels();
+            info.depth = img.depth();
+            // 5 franjas de 3 filas: entrada, salida y, en color, el buffer BGR.
+            const size_t budget = 5 * (info.channels == 3 ? 3 : 2) * info.row_bytes() * 3;
+            ok &= cbg_process_strips("cbg_strips_in" + ext, "cbg_strips_out" + ext, p, budget, 3);
+            cv::Mat expected;
+            cbg_render(img, expected, p, ws);
+            ok &= check_equal("cbg_strips", cv::imread("cbg_strips_out" + ext,
+                                                       cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH),
+                              expected, 0.0);
+        }
+
+    // Con maxval 1000 los datos se llevan al rango completo para procesarlos
+    // y se devuelven a [0,1000].
+    cv::Mat gray16(9, 7, CV_16UC1);
+    cv::randu(gray16, cv::Scalar::all(0), cv::Scalar::all(1001));
+    {
+        std::ofstream f("cbg_strips_in_1000.pgm", std::ios::binary);
+        f << "P5\n" << gray16.cols << ' ' << gray16.rows << "\n1000\n";
+        for (int y = 0; y < gray16.rows; ++y)
+            for (int x = 0; x < gray16.cols; ++x)
+            {
+                const ushort v = gray16.at<ushort>(y, x);
+                f.put(char(v >> 8)).put(char(v & 0xff));
+            }
+    }
+    p.luma_is_set = false;
+    ok &= cbg_process_strips("cbg_strips_in_1000.pgm", "cbg_strips_out_1000.pgm", p, 1 << 20, 2);
+    cv::Mat full, expected;
+    gray16.convertTo(full, -1, 65535.0 / 1000.0);
+    cbg_render(full, expected, p, ws);
+    expected.convertTo(expected, -1, 1000.0 / 65535.0);
+    std::ifstream f("cbg_strips_out_1000.pgm", std::ios::binary);
+    CbgPnmInfo info;
+    cv::Mat result(gray16.size(), CV_16UC1);
+    if (!cbg_read_pnm_header(f, info) || info.maxval != 1000 ||
+        !f.read(reinterpret_cast<char *>(result.data), result.total() * 2))
+    {
+        std::cerr << "cbg_strips: could not read the maxval 1000 output." << std::endl;
+        f.close();
+        remove_files();
+        return false;
+    }
+    f.close();
+    remove_files();
+    for (int y = 0; y < result.rows; ++y)
+        for (int x = 0; x < result.cols; ++x)
+        {
+            ushort &v = result.at<ushort>(y, x);
+            v = ushort((v >> 8) | (v << 8)); // PNM es big endian.
+        }
+    ok &= check_equal("cbg_strips maxval", result, expected, 0.0);
+    return ok;
+}
+
+static bool
+test_cbg_sweep()
+{
+    // Cada variante de la pasada única y cada celda de la hoja (sin
+    // reducir) deben coincidir con procesar la imagen con sus parámetros.
+    bool ok = true;
+    CbgSweepGrid grid;
+    ok &= cbg_parse_sweep("0.5:1.5:3,0.6:1.4:2", grid);
+    ok &= grid.nc == 3 && grid.ng == 2 && grid.c1 == 1.5 && grid.g0 == 0.6;
+    ok &= !cbg_parse_sweep("0.5:1.5:3", grid) && !cbg_parse_sweep("0.5:1.5:0,1:1:1", grid);
+    const cv::Mat images[] = {make_test_image(CV_8UC3), make_test_image(CV_8UC1)};
+    FsivCbgWorkspace ws;
+    for (const cv::Mat &img : images)
+        for (int mode = 0; mode < 4; ++mode)
+        {
+            CbgParams base;
+            base.bright = 0.1;
+            base.luma_is_set = (mode & 1) != 0;
+            base.use_float = (mode & 2) != 0;
+            const std::vector<CbgParams> cells = grid.cells(base);
+            std::vector<cv::Mat> outs;
+            cbg_render_sweep(img, cells, outs);
+            cv::Mat sheet;
+            cbg_render_contact_sheet(img, grid, base, grid.nc * img.cols, sheet);
+            ok &= sheet.rows == grid.ng * img.rows && sheet.cols == grid.nc * img.cols;
+            for (size_t i = 0; i < cells.size() && ok; ++i)
+            {
+                cv::Mat expected;
+                cbg_render(img, expected, cells[i], ws);
+                ok &= check_equal("cbg_render_sweep", outs[i], expected, 0.0);
+                // La etiqueta ocupa las primeras filas de cada celda.
+                const cv::Rect below(0, 24, img.cols, img.rows - 24);
+                const cv::Mat cell = sheet(cv::Rect(img.cols * int(i % grid.nc),
+                                                    img.rows * int(i / grid.nc),
+                                                    img.cols, img.rows));
+                ok &= check_equal("cbg_render_contact_sheet", cell(below), expected(below), 0.0);
+            }
+        }
+    return ok;
+}
+
+/**
+ * @brief Imagen gris con niveles lo + (hi - lo) * u^e, u uniforme en [0,1).
+ */
+static cv::Mat
+make_ramp_image(double lo, double hi, double e)
+{
+    cv::Mat img(61, 97, CV_8UC1);
+    cv::RNG rng(0x5EED);
+    for (int y = 0; y < img.rows; ++y)
+        for (int x = 0; x < img.cols; ++x)
+            img.at<uchar>(y, x) = cv::saturate_cast<uchar>(lo + (hi - lo) * std::pow(rng.uniform(0.0, 1.0), e));
+    return img;
+}
+
+static int
+image_percentile(const cv::Mat &img, double pct)
+{
+    cv::Mat sorted;
+    cv::sort(img.reshape(1, 1), sorted, cv::SORT_EVERY_ROW | cv::SORT_ASCENDING);
+    return sorted.at<uchar>(0, int(pct * (sorted.cols - 1)));
+}
+
+static bool
+test_estimate_cbg_params()
+{
+    bool ok = true;
+    double c, b, g;
+    // Niveles uniformes en [40, 200]: basta con estirar y, una vez
+    // procesada, la estimación sobre el resultado es la identidad.
+    const cv::Mat flat = make_ramp_image(40, 200, 1.0);
+    fsiv_estimate_cbg_params(flat, c, b, g);
+    cv::Mat out = fsiv_cbg_process(flat, c, b, g, false);
+    ok &= image_percentile(out, 0.01) <= 5 && image_percentile(out, 0.99) >= 250;
+    fsiv_estimate_cbg_params(out, c, b, g);
+    if (std::abs(c - 1.0) > 0.1 || std::abs(b) > 0.1 || std::abs(g - 1.0) > 0.1)
+    {
+        std::cerr << "estimate_cbg_params: (" << c << ", " << b << ", " << g
+                  << ") is not the identity." << std::endl;
+        ok = false;
+    }
+
+    // Imagen oscura: gamma < 1 y la mediana sube.
+    const cv::Mat dark = make_ramp_image(40, 200, 2.0);
+    fsiv_estimate_cbg_params(dark, c, b, g);
+    out = fsiv_cbg_process(dark, c, b, g, false);
+    ok &= g < 1.0 && image_percentile(out, 0.5) > image_percentile(dark, 0.5);
+    ok &= image_percentile(out, 0.01) <= 5 && image_percentile(out, 0.99) >= 250;
+
+    // Muy oscura (hi < 1): hi^g - lo^g baja al subir g, así que para estirar
+    // todo el rango hay que bajar g, no subirla.
+    const cv::Mat low_key = make_ramp_image(2, 110, 1.0);
+    fsiv_estimate_cbg_params(low_key, c, b, g);
+    out = fsiv_cbg_process(low_key, c, b, g, false);
+    if (image_percentile(out, 0.01) > 5 || image_percentile(out, 0.99) < 250)
+    {
+        std::cerr << "estimate_cbg_params: low key image not stretched (" << c << ", "
+                  << b << ", " << g << ")." << std::endl;
+        ok = false;
+    }
+    fsiv_estimate_cbg_params(dark, c, b, g);
+
+    // En color se usa V = max(B,G,R).
+    cv::Mat bgr;
+    cv::merge(std::vector<cv::Mat>{dark / 2, dark, dark / 3}, bgr);
+    double cc, bc, gc;
+    fsiv_estimate_cbg_params(bgr, cc, bc, gc);
+    ok &= cc == c && bc == b && gc == g;
+
+    // Con estado, un cambio brusco de escena se sigue poco a poco y una
+    // escena fija acaba dando siempre los mismos parámetros.
+    FsivCbgAutoState state;
+    for (int i = 0; i < 100; ++i)
+        fsiv_estimate_cbg_params(flat, c, b, g, &state);
+    fsiv_estimate_cbg_params(dark, c, b, g, &state);
+    double c_dark, b_dark, g_dark, c_flat, b_flat, g_flat;
+    fsiv_estimate_cbg_params(dark, c_dark, b_dark, g_dark);
+    fsiv_estimate_cbg_params(flat, c_flat, b_flat, g_flat);
+    ok &= std::abs(g - g_flat) < std::abs(g - g_dark);
+    for (int i = 0; i < 100; ++i)
+        fsiv_estimate_cbg_params(dark, c, b, g, &state);
+    const cv::Vec3d settled(c, b, g);
+    fsiv_estimate_cbg_params(dark, c, b, g, &state);
+    ok &= cv::Vec3d(c, b, g) == settled;
+    ok &= std::abs(g - g_dark) < 0.05;
+    if (!ok)
+        std::cerr << "estimate_cbg_params: FAILED." << std::endl;
+    return ok;
+}
+
+static bool
+test_hsv_kernels()
+{
+    // Los kernels especializados deben coincidir con cvtColor + split.
+    bool ok = true;
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    cv::Mat flt, hsv, v;
+    bgr.convertTo(flt, CV_32F, 1.0 / 255.0);
+    std::vector<cv::Mat> expected, planes;
+
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    cv::split(hsv, expected);
+    fsiv_convert_bgr_to_v_into(bgr, v);
+    ok &= check_equal("bgr_to_v (8U)", v, expected[2], 0.0);
+
+    cv::cvtColor(flt, hsv, cv::COLOR_BGR2HSV);
+    cv::split(hsv, expected);
+    fsiv_convert_bgr_to_v_into(flt, v);
+    ok &= check_equal("bgr_to_v (32F)", v, expected[2], 0.0);
+    fsiv_convert_bgr_to_hsv_planes_into(flt, planes);
+    ok &= planes.size() == 3;
+    ok &= check_equal("bgr_to_hsv_planes (H)", planes[0], expected[0], 1e-3);
+    ok &= check_equal("bgr_to_hsv_planes (S)", planes[1], expected[1], 1e-5);
+    ok &= check_equal("bgr_to_hsv_planes (V)", planes[2], expected[2], 0.0);
+    return ok;
+}
+
+static bool
+test_fsiv_core_isa()
+{
+    // Todas las variantes disponibles deben dar lo mismo que la base y usar
+    // de verdad vectores de su ancho.
+    bool ok = true;
+    const std::string selected = fsiv_core_isa();
+    const cv::Mat bgr = make_test_image(CV_8UC3);
+    cv::Mat flt;
+    bgr.convertTo(flt, CV_32F, 1.0 / 255.0);
+
+    ok &= fsiv_core_set_isa("baseline");
+#if CV_SIMD
+    const int baseline_lanes = cv::v_uint8::nlanes;
+#else
+    const int baseline_lanes = 0;
+#endif
+    if (fsiv_core_simd_lanes() != baseline_lanes)
+    {
+        std::cerr << "baseline: " << fsiv_core_simd_lanes() << " lanes, expected "
+                  << baseline_lanes << "." << std::endl;
+        ok = false;
+    }
+    cv::Mat hue, v8, v32;
+    std::vector<cv::Mat> planes;
+    fsiv_convert_bgr_to_hue_into(bgr, hue);
+    fsiv_convert_bgr_to_v_into(bgr, v8);
+    fsiv_convert_bgr_to_v_into(flt, v32);
+    fsiv_convert_bgr_to_hsv_planes_into(flt, planes);
+    for (const char *isa : {"avx2", "avx512"})
+    {
+        if (!fsiv_core_set_isa(isa))
+        {
+            std::cout << isa << ": not available, skipped." << std::endl;
+            continue;
+        }
+        cv::Mat h2, v82, v322;
+        std::vector<cv::Mat> p2;
+        fsiv_convert_bgr_to_hue_into(bgr, h2);
+        fsiv_convert_bgr_to_v_into(bgr, v82);
+        fsiv_convert_bgr_to_v_into(flt, v322);
+        fsiv_convert_bgr_to_hsv_planes_into(flt, p2);
+        const std::string name(isa);
+        const int lanes = name == "avx2" ? 32 : 64;
+        if (fsiv_core_simd_lanes() != lanes)
+        {
+            std::cerr << name << ": " << fsiv_core_simd_lanes() << " lanes, expected "
+                      << lanes << "." << std::endl;
+            ok = false;
+        }
+        ok &= check_equal(name + " bgr_to_hue", h2, hue, 0.0);
+        ok &= check_equal(name + " bgr_to_v (8U)", v82, v8, 0.0);
+        ok &= check_equal(name + " bgr_to_v (32F)", v322, v32, 0.0);
+        // Con FMA el compilador puede fusionar productos y sumas.
+        ok &= check_equal(name + " bgr_to_hsv_planes (H)", p2[0], planes[0], 1e-3);
+        ok &= check_equal(name + " bgr_to_hsv_planes (S)", p2[1], planes[1], 1e-5);
+        ok &= check_equal(name + " bgr_to_hsv_planes (V)", p2[2], planes[2], 0.0);
+    }
+    ok &= !fsiv_core_set_isa("sse1");
+    fsiv_core_set_isa(selected);
+    return ok;
+}
+
+int main(int argc, char *const *argv)
+{
+    int retCode = EXIT_SUCCESS;
+    try
+    {
+        if (argc != 2)
+        {
+            std::cerr << "Usage: " << argv[0] << " <test_name>" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const std::string test = argv[1];
+        bool ok = false;
+        if (test == "fsiv_xxx_into")
+            ok = test_into_variants();
+        else if (test == "fsiv_cbg_process_into")
+            ok = test_cbg_process_into();
+        else if (test == "fsiv_cbg_prepare_apply")
+            ok = test_cbg_prepare_apply();
+        else if (test == "fsiv_cbg_process_lut_into")
+            ok = test_cbg_process_lut_into();
+        else if (test == "fsiv_cbg_process_fixed_into")
+            ok = test_cbg_process_fixed_into();
+        else if (test == "half_intermediates")
+            ok = test_half_intermediates();
+        else if (test == "fsiv_cbg_process_channels_into")
+            ok = test_cbg_process_channels_into();
+        else if (test == "fsiv_cbg_process_linear_into")
+            ok = test_cbg_process_linear_into();
+        else if (test == "cbg_renderer")
+            ok = test_cbg_renderer();
+        else if (test == "coalescing_scheduler")
+            ok = test_coalescing_scheduler();
+        else if (test == "bounded_queue")
+            ok = test_bounded_queue();
+        else if (test == "cbg_batch")
+            ok = test_cbg_batch();
+        else if (test == "cbg_strips")
+            ok = test_cbg_strips();
+        else if (test == "cbg_sweep")
+            ok = test_cbg_sweep();
+        else if (test == "fsiv_estimate_cbg_params")
+            ok = test_estimate_cbg_params();
+        else if (test == "hsv_kernels")
+            ok = test_hsv_kernels();
+        else if (test == "fsiv_core_isa")
+            ok = test_fsiv_core_isa();
+        else
+        {
+            std::cerr << "Error: unknown test '" << test << "'." << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << test << ": " << (ok ? "PASSED" : "FAILED") << std::endl;
+        retCode = ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        retCode = EXIT_FAILURE;
+    }
+    return retCode;
+}
@@ -0,0 +1,61 @@
+#include "background_cache.hpp"
+
+BackgroundCache::BackgroundCache(size_t max_entries)
+    : max_entries_(max_entries), resizes_(0)
+{
+    CV_Assert(max_entries > 0);
+}
+
+BackgroundCache::BackgroundCache(const cv::Mat &source, size_t max_entries)
+    : source_(source), max_entries_(max_entries), resizes_(0)
+{
+    CV_Assert(max_entries > 0);
+}
+
+void
+BackgroundCache::set_source(const cv::Mat &source)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    source_ = source;
+    entries_.clear();
+}
+
+cv::Mat
+BackgroundCache::source() const
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return source_;
+}
+
+cv::Mat
+BackgroundCache::resized(cv::Size size, int interpolation)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    CV_Assert(!source_.empty());
+    if (size == source_.size())
+        return source_;
+    for (auto it = entries_.begin(); it != entries_.end(); ++it)
+        if (it->size == size && it->interpolation == interpolation)
+        {
+            Entry e = *it;
+            entries_.erase(it);
+            entries_.push_back(e);
+            return e.img;
+        }
+    Entry e;
+    e.size = size;
+    e.interpolation = interpolation;
+    cv::resize(source_, e.img, size, 0, 0, interpolation);
+    ++resizes_;
+    if (entries_.size() == max_entries_)
+        entries_.pop_front();
+    entries_.push_back(e);
+    return e.img;
+}
+
+size_t
+BackgroundCache::resizes() const
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    return resizes_;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+/**
+ * @brief Imagen de fondo con sus versiones redimensionadas en caché.
+ *
+ * Cada tamaño e interpolación pedidos se redimensiona una sola vez; las
+ * siguientes peticiones devuelven la copia guardada. La caché se vacía al
+ * cambiar la imagen de origen con set_source(). Se puede usar desde varios
+ * hilos a la vez.
+ */
+class BackgroundCache
+{
+public:
+    /**
+     * @param max_entries número máximo de versiones guardadas. Al
+     *        superarlo se descarta la usada hace más tiempo.
+     */
+    explicit BackgroundCache(size_t max_entries = 4);
+
+    /**
+     * @brief Crea la caché con una imagen de origen.
+     */
+    explicit BackgroundCache(const cv::Mat &source, size_t max_entries = 4);
+
+    /**
+     * @brief Cambia la imagen de origen y descarta las versiones guardadas.
+     *
+     * Se guarda una referencia a source (no una copia): si después se
+     * modifican sus píxeles hay que volver a llamar a set_source().
+     */
+    void set_source(const cv::Mat &source);
+
+    /**
+     * @brief La imagen de origen.
+     */
+    cv::Mat source() const;
+
+    /**
+     * @brief El fondo con el tamaño dado.
+     *
+     * Si size es el tamaño del origen se devuelve el origen sin copiarlo.
+     *
+     * @param size tamaño pedido.
+     * @param interpolation interpolación de cv::resize.
+     */
+    cv::Mat resized(cv::Size size, int interpolation = cv::INTER_LINEAR);
+
+    /**
+     * @brief Número de veces que se ha llamado a cv::resize.
+     */
+    size_t resizes() const;
+
+private:
+    struct Entry
+    {
+        cv::Size size;
+        int interpolation;
+        cv::Mat img;
+    };
+
+    mutable std::mutex mtx_;
+    cv::Mat source_;
+    std::deque<Entry> entries_; /*< la usada más recientemente al final.*/
+    size_t max_entries_;
+    size_t resizes_;
+};
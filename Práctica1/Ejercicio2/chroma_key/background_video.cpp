@@ -0,0 +1,160 @@
+#include "background_video.hpp"
+
+BackgroundVideo::BackgroundVideo(const std::string &filename, cv::Size size, bool loop,
+                                 size_t prefetch, size_t pool_size, int interpolation,
+                                 bool wait)
+    : filename_(filename), size_(size), loop_(loop), interpolation_(interpolation),
+      wait_(wait), next_buffer_(0), ready_(prefetch), first_(true), stop_(false), finished_(false),
+      decoded_(0), loops_(0), repeated_(0)
+{
+    CV_Assert(prefetch > 0 && pool_size > prefetch);
+    pool_.resize(pool_size);
+    for (cv::Mat &buffer : pool_)
+        buffer.create(size_, CV_8UC3);
+    cv::Mat decoded;
+    if (!capt_.open(filename_) || !read_frame(decoded))
+        return;
+    // El primer frame se decodifica aquí para que next() siempre tenga uno.
+    cv::resize(decoded, pool_[0], size_, 0, 0, interpolation_);
+    current_ = pool_[0];
+    next_buffer_ = 1;
+    ++decoded_;
+    thread_ = std::thread(&BackgroundVideo::decode_loop, this);
+}
+
+BackgroundVideo::~BackgroundVideo()
+{
+    stop();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void
+BackgroundVideo::stop()
+{
+    stop_ = true;
+}
+
+cv::Mat
+BackgroundVideo::next()
+{
+    CV_Assert(is_opened());
+    if (first_)
+    {
+        first_ = false;
+        return current_;
+    }
+    cv::Mat frame;
+    int spins = 0;
+    while (!ready_.try_pop(frame))
+    {
+        if (finished_ || stop_)
+        {
+            // finished_ se activa tras el último push: si la cola sigue
+            // vacía después de verlo, ya no llegará nada más.
+            if (!ready_.try_pop(frame))
+            {
+                if (finished_ && error_)
+                    std::rethrow_exception(error_);
+                return current_;
+            }
+            break;
+        }
+        if (!wait_)
+        {
+            ++repeated_; // Entrada en directo: no se espera al decodificador.
+            return current_;
+        }
+        spsc_backoff(spins);
+    }
+    current_ = frame;
+    return current_;
+}
+
+bool
+BackgroundVideo::read_frame(cv::Mat &frame)
+{
+    if (capt_.read(frame))
+        return true;
+    if (!loop_ || decoded_ == 0)
+        return false;
+    ++loops_;
+    // Algunos backends no saben volver al principio: entonces se reabre.
+    if (capt_.set(cv::CAP_PROP_POS_FRAMES, 0) && capt_.read(frame))
+        return true;
+    return capt_.open(filename_) && capt_.read(frame);
+}
+
+/**
+ * @brief Un buffer del pool que sólo referencia el pool, o nulo.
+ */
+cv::Mat *
+BackgroundVideo::free_buffer()
+{
+    for (size_t i = 0; i < pool_.size(); ++i)
+    {
+        cv::Mat &buffer = pool_[(next_buffer_ + i) % pool_.size()];
+        // Lectura atómica del contador de referencias: si es 1, los demás
+        // hilos ya soltaron sus cv::Mat y el buffer se puede sobrescribir.
+        if (CV_XADD(&buffer.u->refcount, 0) == 1)
+        {
+            next_buffer_ = (next_buffer_ + i + 1) % pool_.size();
+            return &buffer;
+        }
+    }
+    return nullptr;
+}
+
+void
+BackgroundVideo::decode_loop()
+{
+    try
+    {
+        decode_frames();
+    }
+    catch (...)
+    {
+        // Se relanza desde next(), en el hilo que lo llama.
+        error_ = std::current_exception();
+        finished_ = true;
+    }
+}
+
+void
+BackgroundVideo::decode_frames()
+{
+    cv::Mat decoded;
+    int spins = 0;
+    while (!stop_)
+    {
+        cv::Mat *buffer = free_buffer();
+        if (buffer == nullptr)
+        {
+            spsc_backoff(spins);
+            continue;
+        }
+        if (!read_frame(decoded))
+            break;
+        CV_Assert(decoded.type() == CV_8UC3);
+        // buffer ya tiene el tamaño y tipo de salida: cv::resize no reserva.
+        cv::resize(decoded, *buffer, size_, 0, 0, interpolation_);
+        ++decoded_;
+        cv::Mat frame = *buffer;
+        spins = 0;
+        while (!ready_.try_push(frame))
+        {
+            if (stop_)
+                return;
+            spsc_backoff(spins);
+        }
+        spins = 0;
+    }
+    finished_ = true;
+}
+
+void
+BackgroundVideo::report(std::ostream &out) const
+{
+    out << "  background: " << decoded_ << " frames decoded, " << loops_ << " loops, "
+        << repeated_ << " frames repeated while decoding." << std::endl;
+}
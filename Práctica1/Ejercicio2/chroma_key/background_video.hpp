@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "spsc_queue.hpp"
+
+/**
+ * @brief Vídeo de fondo decodificado por adelantado.
+ *
+ * Un hilo propio decodifica el vídeo y redimensiona cada frame una sola vez,
+ * al tamaño del primer plano, en un buffer de un pool fijo; los frames
+ * listos esperan en una cola SpscQueue. Por defecto next() espera al
+ * decodificador, de modo que el frame n del fondo acompaña siempre al frame
+ * n del primer plano. Con una cámara, que no puede esperar, next() repite el
+ * frame anterior si no hay uno nuevo (wait = false). Un buffer del pool se
+ * reutiliza cuando nadie más tiene una referencia al cv::Mat que devolvió
+ * next(), así que los frames se pueden pasar a otros hilos sin copiarlos.
+ *
+ * Si el fondo es más corto que el primer plano vuelve a empezar (loop) o se
+ * queda en su último frame.
+ *
+ * next() debe llamarse siempre desde el mismo hilo. Quien lo llama ya va
+ * por delante de la combinación (el hilo de captura), así que esperar aquí no
+ * frena a los hilos de combinación mientras el decodificador vaya a su ritmo.
+ */
+class BackgroundVideo
+{
+public:
+    /**
+     * @brief Abre el vídeo, decodifica el primer frame y arranca el hilo.
+     * @param filename vídeo de fondo.
+     * @param size tamaño del primer plano.
+     * @param loop volver al principio al terminar; si es false se repite el
+     *        último frame.
+     * @param prefetch frames decodificados por adelantado.
+     * @param pool_size buffers del pool (> prefetch). Si todos están en uso
+     *        el decodificador espera.
+     * @param interpolation interpolación de cv::resize.
+     * @param wait si es true next() espera al siguiente frame; si es false
+     *        (entrada en directo) repite el anterior cuando no hay uno listo.
+     */
+    BackgroundVideo(const std::string &filename, cv::Size size, bool loop = true,
+                    size_t prefetch = 4, size_t pool_size = 16,
+                    int interpolation = cv::INTER_LINEAR, bool wait = true);
+
+    /**
+     * @brief Detiene el hilo decodificador.
+     */
+    ~BackgroundVideo();
+
+    BackgroundVideo(const BackgroundVideo &) = delete;
+    BackgroundVideo &operator=(const BackgroundVideo &) = delete;
+
+    /** @brief true si se pudo leer el primer frame. */
+    bool is_opened() const { return !current_.empty(); }
+
+    /**
+     * @brief Fondo para el siguiente frame del primer plano.
+     *
+     * Espera al decodificador salvo con wait = false, tras stop() o cuando el
+     * vídeo se ha terminado (sin loop: se repite el último frame). Relanza
+     * la excepción del decodificador, si la hubo.
+     * El resultado comparte datos con el pool: no se debe modificar.
+     */
+    cv::Mat next();
+
+    /**
+     * @brief Detiene el decodificador; next() ya no espera y repite el último
+     * frame. Se puede llamar desde cualquier hilo (p.e. para que un hilo de
+     * captura bloqueado en next() pueda terminar).
+     */
+    void stop();
+
+    /**
+     * @brief Escribe los frames decodificados, las vueltas y las veces que
+     * next() repitió un frame porque el decodificador iba retrasado (sólo
+     * con wait = false).
+     */
+    void report(std::ostream &out) const;
+
+private:
+    bool read_frame(cv::Mat &frame);
+    cv::Mat *free_buffer();
+    void decode_loop();
+    void decode_frames();
+
+    const std::string filename_;
+    const cv::Size size_;
+    const bool loop_;
+    const int interpolation_;
+    const bool wait_;
+    cv::VideoCapture capt_;
+    std::vector<cv::Mat> pool_; /*< sólo lo toca el decodificador.*/
+    size_t next_buffer_;
+    SpscQueue<cv::Mat> ready_;  /*< decodificador -> next().*/
+    cv::Mat current_;           /*< último frame devuelto por next().*/
+    bool first_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> finished_;
+    std::exception_ptr error_; /*< del decodificador; se publica con finished_.*/
+    std::atomic<long> decoded_;
+    std::atomic<long> loops_;
+    std::atomic<long> repeated_;
+    std::thread thread_;
+};
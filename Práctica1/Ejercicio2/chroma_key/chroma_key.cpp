@@ -3,13 +3,20 @@
 //! University of Cordoba
 //! (c) MJMJ/2020 FJMC/2022-
 
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include "common_code.hpp"
+#include "coalescing_scheduler.hpp"
+#include "video_pipeline.hpp"
+#include "video_encoder.hpp"
+#include "background_video.hpp"
 
 const char *keys =
     "{h help usage ? |      | print this message   }"
@@ -17,9 +24,62 @@ const char *keys =
     "{s sensitivity  |  20 | sensitivity. Def. 20}"
     "{v video        |     | the input is a videofile.}"
     "{c camera       |     | the input is a capture device index.}"
+    "{ranges         |     | extra hue ranges 'lo:hi[,lo:hi...]' keyed together with key+-sensitivity (lo > hi wraps around 180).}"
+    "{sv             |     | S and V bounds 'smin:smax,vmin:vmax' (default 0:255,0:255).}"
+    "{w workers      | 2   | video: number of keying threads.}"
+    "{i incremental  |     | video: recompose only the 16x16 blocks that change between frames.}"
+    "{refresh        | 30  | incremental: frames between full recompositions (0: never).}"
+    "{tolerance      | 2   | incremental: mean abs. difference per channel below which a block is unchanged.}"
     "{@input         |<none>| input source (pathname or camera idx).}"
     "{@background    |<none>| pathname of background image.}"
-    "{@output        | | pathname for the output image (it used only when the input is a image too).}";
+    "{codec          | mp4v | video output codec: a fourcc, 'raw' (uncompressed, .avi) or 'lossless' (FFV1, .avi/.mkv).}"
+    "{offline        |     | video: no GUI and no frame pacing, render as fast as possible.}"
+    "{b bvideo       |     | video: @background is a video, played along with the input.}"
+    "{hold           |     | background video: keep its last frame when it is shorter than the input (default: loop).}"
+    "{f falloff      | 0   | soft matte: hue distance over which alpha goes from background to foreground (0: hard key).}"
+    "{refine         |     | narrow-band edge refinement 'open:feather' radii: opening and feathering only near the mask edge (e.g. 1:2).}"
+    "{despill        |     | remove the key colour reflected on the foreground near the mask edge.}"
+    "{@output        | | pathname for the output image or video.}";
+
+/**
+ * @brief Parámetros de la combinación que se pueden cambiar desde la GUI.
+ */
+struct ChromaKeyParams
+{
+    int hue;
+    int sensitivity;
+};
+
+/**
+ * @brief Resultado de la combinación.
+ */
+struct ChromaKeyResult
+{
+    cv::Mat output;
+    cv::Mat mask;
+};
+
+typedef CoalescingScheduler<ChromaKeyParams, ChromaKeyResult> ChromaKeyScheduler;
+
+// Tiempo mínimo entre dos renders en modo imagen.
+const int FRAME_BUDGET_MS = 33;
+
+// Capacidad de las colas del pipeline de vídeo.
+const size_t PIPELINE_QUEUE_SIZE = 4;
+
+// Frames del vídeo de fondo decodificados por adelantado.
+const size_t BACKGROUND_PREFETCH = 4;
+
+/**
+ * @brief Estado de un hilo de combinación en modo vídeo.
+ */
+struct KeyWorker
+{
+    FsivChromaKeyWorkspace ws;     /*< buffers reutilizados entre frames.*/
+    FsivTemporalKeyState temporal; /*< estado de la combinación incremental.*/
+    size_t changed_blocks = 0;     /*< bloques recompuestos en total.*/
+    size_t total_blocks = 0;       /*< bloques vistos en total.*/
+};
 
 /**
  * @brief Estado actual de la aplicación.
@@ -32,26 +92,161 @@ const char *keys =
 struct AppState
 {
     cv::Mat foreg;   /*< La imagen de primer plano*/
-    cv::Mat backg;   /*< La imagen de fondo*/
+    BackgroundCache backg; /*< La imagen de fondo y sus versiones redimensionadas*/
     cv::Mat output;  /*< el resultado de la combinación*/
     cv::Mat mask;    /*< la máscara calculada (si se quiere guardar)*/
-    int hue;         /*< el valor actual del deslizador Hue*/
-    int sensitivity; /*< el valor actual del deslizador sensibilidad.*/
+    std::atomic<int> hue;         /*< el valor actual del deslizador Hue*/
+    std::atomic<int> sensitivity; /*< el valor actual del deslizador sensibilidad.*/
+    FsivChromaKeySpec extra; /*< intervalos de tono adicionales y límites de S/V.*/
+    FsivChromaKeyWorkspace ws; /*< buffers reutilizados entre frames.*/
+    bool incremental; /*< en vídeo, recomponer sólo los bloques que cambian.*/
+    bool gui;         /*< false en modo offline: no se muestra nada.*/
+    int falloff;      /*< anchura de la banda del mate suave (0: clave dura).*/
+    bool refine;      /*< refinar el borde de la máscara en una banda estrecha.*/
+    FsivBandRefineParams refine_params; /*< retoques del borde (despill_hue >= 0: con despill).*/
+    std::vector<KeyWorker> workers; /*< un estado por hilo de combinación (modo vídeo).*/
+    ChromaKeyScheduler *scheduler; /*< render en un hilo (sólo en modo imagen).*/
 };
 
 /**
- * @brief Do the processing.
+ * @brief Lee una lista de intervalos "a:b[,c:d...]".
+ * @return false si el formato es incorrecto.
+ */
+bool parse_ranges(const std::string &text, std::vector<cv::Vec2i> &ranges)
+{
+    std::istringstream in(text);
+    std::vector<cv::Vec2i> parsed;
+    do
+    {
+        cv::Vec2i r;
+        char sep = 0;
+        if (!(in >> r[0] >> sep >> r[1]) || sep != ':')
+            return false;
+        parsed.push_back(r);
+    } while (in.peek() == ',' && in.get());
+    if (!in.eof())
+        return false;
+    ranges = parsed;
+    return true;
+}
+
+/**
+ * @brief La clave completa: hue +- sensitivity (con vuelta por 180) más los
+ * intervalos y límites de S/V dados en la línea de comandos.
+ */
+FsivChromaKeySpec make_spec(const AppState *app_state, int hue, int sensitivity)
+{
+    FsivChromaKeySpec spec = app_state->extra;
+    const FsivChromaKeySpec key = fsiv_chroma_key_spec(hue, sensitivity);
+    spec.hue_ranges.insert(spec.hue_ranges.begin(), key.hue_ranges.begin(),
+                           key.hue_ranges.end());
+    return spec;
+}
+
+/**
+ * @brief Combina con la clave dura, con el mate suave si hay falloff o
+ * refinando el borde de la máscara si se pidió.
+ *
+ * @param app_state the application state.
+ * @param foreg primer plano.
+ * @param bg_frame fondo de este frame; si está vacío se usa app_state->backg.
+ * @param spec clave.
+ * @param out la composición.
+ * @param mask si no es nulo, la máscara o el alfa (255: primer plano).
+ * @param ws espacio de trabajo del hilo que llama.
+ */
+void apply_key(AppState *app_state, const cv::Mat &foreg, const cv::Mat &bg_frame,
+               const FsivChromaKeySpec &spec, cv::Mat &out, cv::Mat *mask,
+               FsivChromaKeyWorkspace &ws)
+{
+    const int falloff = app_state->falloff;
+    if (app_state->refine)
+    {
+        FsivBandRefineParams params = app_state->refine_params;
+        if (params.despill_hue >= 0)
+            params.despill_hue = app_state->hue;
+        const cv::Mat bg = bg_frame.empty() ? app_state->backg.resized(foreg.size()) : bg_frame;
+        fsiv_apply_chroma_key_refined_into(foreg, bg, spec, params, out, mask, ws);
+    }
+    else if (bg_frame.empty() && falloff > 0)
+        fsiv_apply_chroma_key_soft_into(foreg, app_state->backg, spec, falloff, out, mask, ws);
+    else if (bg_frame.empty())
+        fsiv_apply_chroma_key_into(foreg, app_state->backg, spec, out, mask, ws);
+    else if (falloff > 0)
+        fsiv_apply_chroma_key_soft_into(foreg, bg_frame, spec, falloff, out, mask, ws);
+    else
+        fsiv_apply_chroma_key_into(foreg, bg_frame, spec, out, mask, ws);
+}
+
+/**
+ * @brief Do the processing of a video frame.
+ *
+ * Se llama desde los hilos de combinación del pipeline.
  *
  * @param app_state the application state.
+ * @param worker número del hilo que llama.
+ * @param frame frame a combinar.
  */
-void do_the_work(AppState *app_state)
+void do_the_work(AppState *app_state, int worker, PipelineFrame &frame)
 {
-    app_state->output = fsiv_apply_chroma_key(app_state->foreg, app_state->backg,
-                                              app_state->hue,
-                                              app_state->sensitivity,
-                                              &app_state->mask);
-    cv::imshow("OUT", app_state->output);
-    cv::imshow("CHROMA KEY MASK", app_state->mask);
+    KeyWorker &w = app_state->workers[worker];
+    const FsivChromaKeySpec spec = make_spec(app_state, app_state->hue,
+                                             app_state->sensitivity);
+    // Con un vídeo de fondo cambia todo el frame: no hay nada que
+    // reutilizar del anterior. La combinación incremental es sólo dura y
+    // sin refinar el borde.
+    if (app_state->incremental && frame.backg.empty() && app_state->falloff == 0 &&
+        !app_state->refine)
+    {
+        // out y mask son del estado del worker y se sobrescriben en su
+        // siguiente frame, pero éste sigue en vuelo hasta que se muestra.
+        cv::Mat out, mask;
+        fsiv_apply_chroma_key_incremental_into(frame.foreg, app_state->backg, spec,
+                                               out, &mask, w.ws, w.temporal);
+        out.copyTo(frame.output);
+        if (app_state->gui)
+            mask.copyTo(frame.mask);
+        w.changed_blocks += w.temporal.changed_blocks;
+        w.total_blocks += w.temporal.total_blocks;
+    }
+    else
+        apply_key(app_state, frame.foreg, frame.backg, spec, frame.output,
+                  app_state->gui ? &frame.mask : nullptr, w.ws);
+}
+
+/**
+ * @brief Renderiza la combinación con unos parámetros dados.
+ *
+ * Se llama desde el hilo del planificador en modo imagen.
+ *
+ * @param app_state the application state.
+ * @param p los parámetros a usar.
+ * @param result donde dejar la imagen combinada y la máscara.
+ */
+void render_chroma_key(AppState *app_state, const ChromaKeyParams &p,
+                       ChromaKeyResult &result)
+{
+    apply_key(app_state, app_state->foreg, cv::Mat(), make_spec(app_state, p.hue, p.sensitivity),
+              result.output, &result.mask, app_state->ws);
+}
+
+/**
+ * @brief Anota los valores actuales de los deslizadores.
+ *
+ * En modo imagen se pasan al planificador, que renderiza sólo el último
+ * estado. En modo vídeo el bucle principal los usa en el siguiente frame.
+ *
+ * @param app_state the application state.
+ */
+void schedule_work(AppState *app_state)
+{
+    if (app_state->scheduler != nullptr)
+    {
+        ChromaKeyParams p;
+        p.hue = app_state->hue;
+        p.sensitivity = app_state->sensitivity;
+        app_state->scheduler->post(p);
+    }
 }
 
 /**
@@ -63,7 +258,7 @@ void on_change_hue(int v, void *app_state_)
 {
     AppState *app_state = static_cast<AppState *>(app_state_);
     app_state->hue = v;
-    do_the_work(app_state);
+    schedule_work(app_state);
 }
 
 /**
@@ -75,7 +270,7 @@ void on_change_sensitivity(int v, void *app_state_)
 {
     AppState *app_state = static_cast<AppState *>(app_state_);
     app_state->sensitivity = v;
-    do_the_work(app_state);
+    schedule_work(app_state);
 }
 
 /**
@@ -97,9 +292,10 @@ void on_mouse(int event, int x, int y, int flags, void *app_state_)
     if (event == cv::EVENT_LBUTTONDOWN)
     {
         // Click con el botón izquierdo.
-        cv::Mat hsv;
-        cv::cvtColor(app_state->foreg, hsv, cv::COLOR_BGR2HSV);
-        app_state->hue = hsv.at<cv::Vec3b>(y, x)[0]; // Valor del canal H en (x,y).
+        // Sólo hace falta el canal H del píxel pulsado.
+        cv::Mat hue;
+        fsiv_convert_bgr_to_hue_into(app_state->foreg(cv::Rect(x, y, 1, 1)), hue);
+        app_state->hue = hue.at<uchar>(0, 0); // Valor del canal H en (x,y).
         // posicionar el deslizador para en el nuevo valor.
         cv::setTrackbarPos("KEY", "OUT", app_state->hue);
         // do_the_work(app_state);
@@ -124,6 +320,8 @@ int main(int argc, char *argv[])
 
         // Creamos una instancia para representar el estado de la Aplicación.
         AppState app_state;
+        app_state.scheduler = nullptr;
+        std::unique_ptr<ChromaKeyScheduler> scheduler;
 
         // Inicializar los valores de estado con los parámetros dados
         // en la línea de comandos.
@@ -134,52 +332,137 @@ int main(int argc, char *argv[])
         std::string outname = parser.get<std::string>("@output");
         bool is_video = parser.has("video");
         bool is_camidx = parser.has("camera");
+        const bool is_bg_video = parser.has("bvideo");
+        const int n_workers = parser.get<int>("workers");
+        app_state.incremental = parser.has("incremental");
+        app_state.gui = !parser.has("offline");
+        app_state.falloff = parser.get<int>("falloff");
+        app_state.refine = parser.has("refine") || parser.has("despill");
+        if (parser.has("refine"))
+        {
+            std::vector<cv::Vec2i> radii;
+            if (!parse_ranges(parser.get<std::string>("refine"), radii) || radii.size() != 1)
+            {
+                std::cerr << "Error: wrong --refine, expected 'open:feather'." << std::endl;
+                return EXIT_FAILURE;
+            }
+            app_state.refine_params.open_radius = radii[0][0];
+            app_state.refine_params.feather_radius = radii[0][1];
+        }
+        // El tono real se toma del deslizador en cada frame.
+        app_state.refine_params.despill_hue = parser.has("despill") ? 0 : -1;
+        int fourcc = 0;
+        if (!VideoEncoder::codec_fourcc(parser.get<std::string>("codec"), fourcc))
+        {
+            std::cerr << "Error: wrong --codec, expected a fourcc, 'raw' or 'lossless'." << std::endl;
+            return EXIT_FAILURE;
+        }
+        FsivTemporalKeyState temporal;
+        temporal.refresh_period = parser.get<int>("refresh");
+        temporal.tolerance = parser.get<double>("tolerance");
+        if (parser.has("ranges") &&
+            !parse_ranges(parser.get<std::string>("ranges"), app_state.extra.hue_ranges))
+        {
+            std::cerr << "Error: wrong --ranges, expected 'lo:hi[,lo:hi...]'." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (parser.has("sv"))
+        {
+            std::vector<cv::Vec2i> sv;
+            if (!parse_ranges(parser.get<std::string>("sv"), sv) || sv.size() != 2)
+            {
+                std::cerr << "Error: wrong --sv, expected 'smin:smax,vmin:vmax'." << std::endl;
+                return EXIT_FAILURE;
+            }
+            app_state.extra.s_range = sv[0];
+            app_state.extra.v_range = sv[1];
+        }
 
         if (!parser.check())
         {
             parser.printErrors();
             return EXIT_FAILURE;
         }
+        if (temporal.refresh_period < 0 || temporal.tolerance < 0.0)
+        {
+            std::cerr << "Error: --refresh and --tolerance must be >= 0." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (app_state.falloff < 0)
+        {
+            std::cerr << "Error: --falloff must be >= 0." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (app_state.refine_params.open_radius < 0 || app_state.refine_params.feather_radius < 0)
+        {
+            std::cerr << "Error: --refine radii must be >= 0." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (app_state.refine && app_state.falloff > 0)
+        {
+            std::cerr << "Error: --falloff can't be combined with --refine or --despill." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (n_workers < 1)
+        {
+            std::cerr << "Error: --workers must be > 0." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!app_state.gui && !is_video)
+        {
+            std::cerr << "Error: --offline needs a video file (-v)." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (is_bg_video && !(is_video || is_camidx))
+        {
+            std::cerr << "Error: a background video (-b) needs a video input (-v or -c)." << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "fsiv_core: using the " << fsiv_core_isa() << " kernels." << std::endl;
 
-        app_state.backg = cv::imread(bckname, cv::IMREAD_COLOR);
-        if (app_state.backg.empty())
+        if (!is_bg_video)
+            app_state.backg.set_source(cv::imread(bckname, cv::IMREAD_COLOR));
+        if (!is_bg_video && app_state.backg.source().empty())
         {
             std::cerr << "Error reading: " << bckname << std::endl;
             return EXIT_FAILURE;
         }
 
-        // Inicializar la interfaz gráfica.
-        cv::namedWindow("FOREG", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
-        cv::namedWindow("BACKG", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
-        cv::namedWindow("OUT", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
-        cv::namedWindow("CHROMA KEY MASK", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
-        // Fijamos un tamaño de la ventana para prevenir que la imagen tenga un
-        // tamaño demasiado grande.
-        cv::resizeWindow("FOREG", cv::Size(800, 600));
-        cv::resizeWindow("BACKG", cv::Size(800, 600));
-        cv::resizeWindow("OUT", cv::Size(800, 600));
-        cv::resizeWindow("CHROMA KEY MASK", cv::Size(800, 600));
-
-        // Creamos deslizadores y los añadimos a la ventana "OUT".
-        // Cada deslizador tiene asociado un callback que es llamado cuando
-        //   el usuario lo mueve.
-        // El estado de la aplicación se da para que desde
-        //   el callback podamos acceder al mismo.
-        cv::createTrackbar("KEY", "OUT", nullptr, 180, on_change_hue,
-                           &app_state);
-
-        cv::createTrackbar("SENSITIVITY", "OUT", nullptr, 128,
-                           on_change_sensitivity, &app_state);
-        //
-
-        // Añadimos una función para gestionar el ratón en la ventana
-        //   "FOREG" de forma que si el usuario pulsa el botón izquierdo
-        //   en un punto seleccionamos el valor Hue correspondiente de la imagen
-        //   de primer plano como nuevo valor clave (chroma key).
-        // El estado de la aplicación se da para que desde
-        //   el callback podamos acceder al mismo.
-        cv::setMouseCallback("FOREG", on_mouse, &app_state);
-        //
+        if (app_state.gui)
+        {
+            // Inicializar la interfaz gráfica.
+            cv::namedWindow("FOREG", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
+            cv::namedWindow("BACKG", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
+            cv::namedWindow("OUT", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
+            cv::namedWindow("CHROMA KEY MASK", cv::WINDOW_GUI_EXPANDED + cv::WINDOW_NORMAL);
+            // Fijamos un tamaño de la ventana para prevenir que la imagen tenga un
+            // tamaño demasiado grande.
+            cv::resizeWindow("FOREG", cv::Size(800, 600));
+            cv::resizeWindow("BACKG", cv::Size(800, 600));
+            cv::resizeWindow("OUT", cv::Size(800, 600));
+            cv::resizeWindow("CHROMA KEY MASK", cv::Size(800, 600));
+
+            // Creamos deslizadores y los añadimos a la ventana "OUT".
+            // Cada deslizador tiene asociado un callback que es llamado cuando
+            //   el usuario lo mueve.
+            // El estado de la aplicación se da para que desde
+            //   el callback podamos acceder al mismo.
+            cv::createTrackbar("KEY", "OUT", nullptr, 180, on_change_hue,
+                               &app_state);
+
+            cv::createTrackbar("SENSITIVITY", "OUT", nullptr, 128,
+                               on_change_sensitivity, &app_state);
+            //
+
+            // Añadimos una función para gestionar el ratón en la ventana
+            //   "FOREG" de forma que si el usuario pulsa el botón izquierdo
+            //   en un punto seleccionamos el valor Hue correspondiente de la imagen
+            //   de primer plano como nuevo valor clave (chroma key).
+            // El estado de la aplicación se da para que desde
+            //   el callback podamos acceder al mismo.
+            cv::setMouseCallback("FOREG", on_mouse, &app_state);
+            //
+        }
 
         if (is_video || is_camidx)
         {
@@ -207,32 +490,129 @@ int main(int argc, char *argv[])
                 return EXIT_FAILURE;
             }
 
-            if (app_state.foreg.size() != app_state.backg.size())
-                // Para combinar las imágenes deben tener el mismo tamaño.
-                // si ajustamos el tamaño del background ahora evitaremos que
-                // fsiv_apply_chroma_key lo tenga que hacer para cada nuevo
-                // frame de entrada.
-                cv::resize(app_state.backg, app_state.backg, app_state.foreg.size());
+            // El fondo se redimensiona al tamaño de los frames una sola vez,
+            // en la primera llamada a fsiv_apply_chroma_key_into.
 
-            // Inicializar los deslizadores con los valores dados por la cli.
-            // Esto forzará a que se actualice la GUI con la primera imagen.
-            cv::setTrackbarPos("KEY", "OUT", app_state.hue);
-            cv::setTrackbarPos("SENSITIVITY", "OUT", app_state.sensitivity);
-            cv::imshow("BACKG", app_state.backg);
+            if (app_state.gui)
+            {
+                // Inicializar los deslizadores con los valores dados por la cli.
+                // Esto forzará a que se actualice la GUI con la primera imagen.
+                cv::setTrackbarPos("KEY", "OUT", app_state.hue);
+                cv::setTrackbarPos("SENSITIVITY", "OUT", app_state.sensitivity);
+                if (!is_bg_video)
+                    cv::imshow("BACKG", app_state.backg.source());
+            }
+
+            // El vídeo de fondo se decodifica y redimensiona en su propio
+            // hilo. El pool tiene sitio para todos los frames en vuelo en el
+            // pipeline, así que normalmente el decodificador no espera. Con
+            // un vídeo de entrada los dos van sincronizados (next() espera al
+            // decodificador); con una cámara se repite el frame anterior.
+            std::unique_ptr<BackgroundVideo> bg_video;
+            if (is_bg_video)
+            {
+                const size_t pool = BACKGROUND_PREFETCH + 2 +
+                                    n_workers * (2 * PIPELINE_QUEUE_SIZE + 1);
+                bg_video.reset(new BackgroundVideo(bckname, app_state.foreg.size(),
+                                                   !parser.has("hold"),
+                                                   BACKGROUND_PREFETCH, pool,
+                                                   cv::INTER_LINEAR, !is_camidx));
+                if (!bg_video->is_opened())
+                {
+                    std::cerr << "Error reading: " << bckname << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
 
             int key = 0; // La tecla que se pulsa.
             int wait_time = 20;
             if (is_video)
                 wait_time = (1000.0 / 24.0); // 24FPS.
-            do
-            {
-                cv::imshow("FOREG", app_state.foreg); // Mostrar la imagen actual de primer plano.
-                do_the_work(&app_state);              // Procesar la imagen.
-                key = cv::waitKey(wait_time) & 0xff;  // 24FPS.
-                capt >> app_state.foreg;              // Captura/lee una nueva imagen (si hay).
+            double fps = capt.get(cv::CAP_PROP_FPS);
+            if (!(fps > 0.0))
+                fps = 1000.0 / wait_time;
 
-            } // Terminamos cuando no hay nada más que leer o se pulsa la tecla ESC.
-            while (!(app_state.foreg.empty() || key == 27));
+            // El vídeo de salida se codifica en su propio hilo.
+            std::unique_ptr<VideoEncoder> encoder;
+            if (outname != "")
+            {
+                encoder.reset(new VideoEncoder(outname, fourcc, fps, app_state.foreg.size()));
+                if (!encoder->is_opened())
+                {
+                    std::cerr << "Error: could not open the output video: " << outname
+                              << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            app_state.workers.resize(n_workers);
+            for (KeyWorker &w : app_state.workers)
+                w.temporal = temporal;
+            {
+                // Captura, combinación (n_workers hilos) y visualización
+                // (este hilo) se solapan; los frames llegan en orden.
+                // El fondo de cada frame se elige al leerlo, en orden, en el
+                // hilo de captura: si espera al decodificador del fondo, los
+                // hilos de combinación siguen con los frames ya leídos.
+                PipelineFrame first;
+                first.foreg = app_state.foreg;
+                if (bg_video)
+                    first.backg = bg_video->next();
+                VideoPipeline pipeline(first,
+                                       [&capt, &bg_video](PipelineFrame &f)
+                                       {
+                                           if (!capt.read(f.foreg))
+                                               return false;
+                                           if (bg_video)
+                                               f.backg = bg_video->next();
+                                           return true;
+                                       },
+                                       [&app_state](int w, PipelineFrame &f)
+                                       { do_the_work(&app_state, w, f); },
+                                       n_workers, PIPELINE_QUEUE_SIZE);
+                PipelineFrame frame;
+                const int64_t start = cv::getTickCount();
+                long frames = 0;
+                // Terminamos cuando no hay nada más que leer o se pulsa la tecla ESC.
+                while (key != 27 && pipeline.pop(frame))
+                {
+                    ++frames;
+                    if (encoder)
+                        encoder->write(frame.output);
+                    if (app_state.gui)
+                    {
+                        app_state.foreg = frame.foreg; // Para elegir el tono con el ratón.
+                        cv::imshow("FOREG", frame.foreg);
+                        cv::imshow("OUT", frame.output);
+                        cv::imshow("CHROMA KEY MASK", frame.mask);
+                        if (bg_video)
+                            cv::imshow("BACKG", frame.backg);
+                        key = cv::waitKey(wait_time) & 0xff; // 24FPS.
+                    }
+                }
+                pipeline.stop();
+                if (bg_video)
+                    bg_video->stop(); // Que la captura no se quede esperando en next().
+                if (encoder)
+                    encoder->close(); // Esperar a los frames pendientes.
+                const double secs = (cv::getTickCount() - start) / cv::getTickFrequency();
+                pipeline.report(std::cout);
+                if (encoder)
+                    encoder->report(std::cout);
+                if (bg_video)
+                    bg_video->report(std::cout);
+                std::cout << "Rendered " << frames << " frames in " << secs << " s: "
+                          << frames / secs << " FPS, " << frames / fps / secs
+                          << "x real time." << std::endl;
+            }
+            size_t changed_blocks = 0, total_blocks = 0;
+            for (const KeyWorker &w : app_state.workers)
+            {
+                changed_blocks += w.changed_blocks;
+                total_blocks += w.total_blocks;
+            }
+            if (app_state.incremental && total_blocks > 0)
+                std::cout << "Changed blocks: " << 100.0 * changed_blocks / total_blocks
+                          << "%" << std::endl;
         }
         else
         {
@@ -244,18 +624,52 @@ int main(int argc, char *argv[])
             }
 
             cv::imshow("FOREG", app_state.foreg);
-            cv::imshow("BACKG", app_state.backg);
+            cv::imshow("BACKG", app_state.backg.source());
+
+            // Las callbacks sólo anotan los parámetros. Un hilo renderiza el
+            // último estado y aquí se muestra cuando está listo.
+            scheduler.reset(new ChromaKeyScheduler(
+                [&app_state](const ChromaKeyParams &p, ChromaKeyResult &r)
+                { render_chroma_key(&app_state, p, r); },
+                FRAME_BUDGET_MS));
+            app_state.scheduler = scheduler.get();
 
             // Inicializar los deslizadores con los valores dados por la cli.
             // Esto forzará a que se actualice la GUI con la imagen OUT.
             cv::setTrackbarPos("KEY", "OUT", app_state.hue);
             cv::setTrackbarPos("SENSITIVITY", "OUT", app_state.sensitivity);
-            int key = cv::waitKey(0) & 0xff; // Esperar hasta que se pulse una tecla.
+            schedule_work(&app_state);
+
+            ChromaKeyResult shown;
+            int key = -1;
+            while (key == -1) // Esperar hasta que se pulse una tecla.
+            {
+                key = cv::waitKey(FRAME_BUDGET_MS);
+                if (app_state.scheduler->fetch(shown))
+                {
+                    cv::imshow("OUT", shown.output);
+                    cv::imshow("CHROMA KEY MASK", shown.mask);
+                }
+            }
+            key &= 0xff;
+            std::cout << "Trackbar events: " << app_state.scheduler->posted()
+                      << ", renders: " << app_state.scheduler->rendered()
+                      << ", coalesced: " << app_state.scheduler->coalesced() << std::endl;
+            app_state.scheduler = nullptr;
+            scheduler.reset();
+
             if (key != 27 && outname != "")
+            {
+                // Puede que el último estado no se llegara a mostrar.
+                apply_key(&app_state, app_state.foreg, cv::Mat(),
+                          make_spec(&app_state, app_state.hue, app_state.sensitivity),
+                          app_state.output, nullptr, app_state.ws);
                 cv::imwrite(outname, app_state.output);
+            }
         }
 
-        cv::destroyAllWindows();
+        if (app_state.gui)
+            cv::destroyAllWindows();
     }
     catch (std::exception &e)
     {
@@ -0,0 +1,281 @@
+//! \file chroma_key_bench.cpp
+//! Benchmark of the fsiv chroma key functions.
+//! Measures the mean time per frame and the number of cv::Mat allocations.
+//! Usage: chroma_key_bench [-n=<iters>] <bench_name> [<input> [<background>]]
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include "common_code.hpp"
+#include "counting_allocator.hpp"
+
+const char *keys =
+    "{h help usage ? |      | print this message   }"
+    "{n iters        | 100  | number of iterations.}"
+    "{k key          |  60  | Chroma key (hue). Def. 60}"
+    "{s sensitivity  |  20  | sensitivity. Def. 20}"
+    "{@bench         | into | benchmark to run: into, hue, lut, fused, backg, temporal, soft, band.}"
+    "{@input         | data/chromakey.jpg | input image.}"
+    "{@background    | data/background.jpg | background image.}";
+
+static CountingAllocator allocator;
+
+/**
+ * @brief Ejecuta f iters veces e informa de tiempo y reservas por iteración.
+ */
+template <class F>
+static void
+run(const std::string &name, int iters, F f)
+{
+    f(); // calentamiento: la primera llamada puede reservar los buffers.
+    const long allocs0 = allocator.count();
+    cv::TickMeter tm;
+    tm.start();
+    for (int i = 0; i < iters; ++i)
+        f();
+    tm.stop();
+    const double allocs = double(allocator.count() - allocs0) / iters;
+    std::cout << name << ": " << tm.getTimeMilli() / iters << " ms/frame, "
+              << allocs << " allocs/frame." << std::endl;
+}
+
+static void
+bench_into(const cv::Mat &foreg, const cv::Mat &backg, int hue, int sensitivity,
+           int iters)
+{
+    cv::Mat out, mask;
+    FsivChromaKeyWorkspace ws;
+    run("fsiv_apply_chroma_key", iters, [&]()
+        { out = fsiv_apply_chroma_key(foreg, backg, hue, sensitivity, &mask); });
+    run("fsiv_apply_chroma_key_into", iters, [&]()
+        { fsiv_apply_chroma_key_into(foreg, backg, hue, sensitivity, out, &mask, &ws); });
+}
+
+static void
+bench_hue(const cv::Mat &foreg, int hue, int sensitivity, int iters)
+{
+    cv::Mat hsv, h, mask;
+    std::vector<cv::Mat> planes;
+    run("cvtColor BGR2HSV", iters, [&]()
+        { cv::cvtColor(foreg, hsv, cv::COLOR_BGR2HSV); });
+    run("cvtColor BGR2HSV + split", iters, [&]()
+        {
+            cv::cvtColor(foreg, hsv, cv::COLOR_BGR2HSV);
+            cv::split(hsv, planes);
+        });
+    run("fsiv_convert_bgr_to_hue_into", iters, [&]()
+        { fsiv_convert_bgr_to_hue_into(foreg, h); });
+    // La máscara completa antes (HSV + inRange de 3 canales) y ahora.
+    run("cvtColor + inRange (3 channels)", iters, [&]()
+        {
+            cv::cvtColor(foreg, hsv, cv::COLOR_BGR2HSV);
+            cv::inRange(hsv, cv::Scalar(hue - sensitivity, 0, 0),
+                        cv::Scalar(hue + sensitivity, 255, 255), mask);
+        });
+    FsivChromaKeyWorkspace ws;
+    run("fsiv_compute_chroma_key_mask_into", iters, [&]()
+        { fsiv_compute_chroma_key_mask_into(foreg, hue, sensitivity, mask, &ws); });
+}
+
+static void
+bench_lut(const cv::Mat &foreg, int hue, int sensitivity, int iters)
+{
+    cv::Mat mask;
+    FsivChromaKeyWorkspace ws;
+    run("fsiv_compute_chroma_key_mask_into", iters, [&]()
+        { fsiv_compute_chroma_key_mask_into(foreg, hue, sensitivity, mask, &ws); });
+    run("fsiv_compute_chroma_key_mask_lut_into", iters, [&]()
+        { fsiv_compute_chroma_key_mask_lut_into(foreg, hue, sensitivity, mask, ws); });
+    // Coste de reconstruir la tabla: alternamos la clave en cada llamada.
+    int i = 0;
+    run("chroma key table rebuild + mask", std::max(1, iters / 10), [&]()
+        { fsiv_compute_chroma_key_mask_lut_into(foreg, hue + (++i & 1), sensitivity, mask, ws); });
+}
+
+static void
+bench_fused(const cv::Mat &foreg, const cv::Mat &backg, int hue, int sensitivity,
+            int iters)
+{
+    cv::Mat backg_resized, mask, out;
+    cv::resize(backg, backg_resized, foreg.size(), 0, 0, cv::INTER_LINEAR);
+    FsivChromaKeyWorkspace ws;
+    // Lo que hacía fsiv_apply_chroma_key_into antes de fusionar las pasadas.
+    run("mask + bitwise_not + combine", iters, [&]()
+        {
+            fsiv_compute_chroma_key_mask_lut_into(foreg, hue, sensitivity, mask, ws);
+            cv::bitwise_not(mask, mask);
+            fsiv_combine_images_into(foreg, backg_resized, mask, out);
+        });
+    run("fused, with mask_out", iters, [&]()
+        { fsiv_apply_chroma_key_into(foreg, backg_resized, hue, sensitivity, out, &mask, &ws); });
+    run("fused, no mask_out", iters, [&]()
+        { fsiv_apply_chroma_key_into(foreg, backg_resized, hue, sensitivity, out, nullptr, &ws); });
+    run("fused, H channel (no ws)", iters, [&]()
+        { fsiv_apply_chroma_key_into(foreg, backg_resized, hue, sensitivity, out); });
+}
+
+static void
+bench_backg(const cv::Mat &foreg, const cv::Mat &backg, int hue, int sensitivity,
+            int iters)
+{
+    cv::Mat out;
+    FsivChromaKeyWorkspace ws;
+    BackgroundCache cache(backg);
+    run("apply_into, cv::Mat background", iters, [&]()
+        { fsiv_apply_chroma_key_into(foreg, backg, hue, sensitivity, out, nullptr, &ws); });
+    run("apply_into, BackgroundCache", iters, [&]()
+        { fsiv_apply_chroma_key_into(foreg, cache, hue, sensitivity, out, nullptr, &ws); });
+    std::cout << "BackgroundCache resizes: " << cache.resizes() << std::endl;
+}
+
+/**
+ * @brief Vídeo sintético de "busto parlante": dos frames que sólo se
+ * diferencian en un rectángulo central (1/16 del área), alternados.
+ */
+static void
+bench_temporal(const cv::Mat &foreg, const cv::Mat &backg, int hue, int sensitivity,
+               int iters)
+{
+    cv::Mat frames[2] = {foreg, foreg.clone()};
+    const cv::Rect moving(foreg.cols * 3 / 8, foreg.rows * 3 / 8, foreg.cols / 4,
+                          foreg.rows / 4);
+    cv::Mat roi = frames[1](moving);
+    cv::bitwise_not(roi, roi);
+    const FsivChromaKeySpec spec = fsiv_chroma_key_spec(hue, sensitivity);
+    cv::Mat out;
+    FsivChromaKeyWorkspace ws;
+    FsivTemporalKeyState state;
+    BackgroundCache cache(backg);
+    int i = 0;
+    run("apply_into, full frame", iters, [&]()
+        { fsiv_apply_chroma_key_into(frames[i++ & 1], cache, spec, out, nullptr, ws); });
+    size_t changed = 0, total = 0;
+    run("apply_incremental_into", iters, [&]()
+        {
+            fsiv_apply_chroma_key_incremental_into(frames[i++ & 1], cache, spec, out,
+                                                   nullptr, ws, state);
+            changed += state.changed_blocks;
+            total += state.total_blocks;
+        });
+    std::cout << "Changed blocks: " << 100.0 * changed / std::max<size_t>(total, 1)
+              << "%" << std::endl;
+}
+
+static void
+bench_soft(const cv::Mat &foreg, const cv::Mat &backg, int hue, int sensitivity, int iters)
+{
+    const FsivChromaKeySpec spec = fsiv_chroma_key_spec(hue, sensitivity);
+    cv::Mat out, mask;
+    FsivChromaKeyWorkspace ws;
+    BackgroundCache cache(backg);
+    run("hard key (apply_into)", iters, [&]()
+        { fsiv_apply_chroma_key_into(foreg, cache, spec, out, nullptr, ws); });
+    run("hard key + mask + combine_images", iters, [&]()
+        {
+            fsiv_compute_chroma_key_mask_into(foreg, spec, mask, ws);
+            cv::bitwise_not(mask, mask);
+            fsiv_combine_images_into(foreg, cache.resized(foreg.size()), mask, out);
+        });
+    run("soft matte, falloff 10", iters, [&]()
+        { fsiv_apply_chroma_key_soft_into(foreg, cache, spec, 10, out, nullptr, ws); });
+    FsivChromaKeySpec sv = spec;
+    sv.s_range = cv::Vec2i(40, 255);
+    run("soft matte, falloff 10, S/V bounds", iters, [&]()
+        { fsiv_apply_chroma_key_soft_into(foreg, cache, sv, 10, out, nullptr, ws); });
+}
+
+static void
+bench_band(const cv::Mat &foreg, const cv::Mat &backg, int hue, int sensitivity, int iters)
+{
+    const FsivChromaKeySpec spec = fsiv_chroma_key_spec(hue, sensitivity);
+    cv::Mat out, mask, alpha, bg;
+    FsivChromaKeyWorkspace ws;
+    cv::resize(backg, bg, foreg.size());
+    FsivBandRefineParams params;
+    params.open_radius = 1;
+    params.feather_radius = 2;
+    params.despill_hue = hue;
+    const cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+    run("open + blur + blend, full frame", iters, [&]()
+        {
+            fsiv_compute_chroma_key_mask_into(foreg, spec, mask, ws);
+            cv::bitwise_not(mask, alpha);
+            cv::morphologyEx(alpha, alpha, cv::MORPH_OPEN, kernel);
+            cv::blur(alpha, alpha, cv::Size(5, 5));
+            fsiv_blend_images_into(foreg, bg, alpha, out);
+        });
+    run("open + feather + despill, narrow band", iters, [&]()
+        { fsiv_apply_chroma_key_refined_into(foreg, bg, spec, params, out, nullptr, ws); });
+    std::cout << "Band pixels: " << 100.0 * ws.band.pixels() / double(foreg.total())
+              << "% in " << ws.band.runs.size() << " runs." << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int retCode = EXIT_SUCCESS;
+    try
+    {
+        cv::CommandLineParser parser(argc, argv, keys);
+        parser.about("Benchmark the fsiv chroma key functions.");
+        if (parser.has("help"))
+        {
+            parser.printMessage();
+            return 0;
+        }
+        const int iters = parser.get<int>("n");
+        const int hue = parser.get<int>("k");
+        const int sensitivity = parser.get<int>("s");
+        const std::string bench = parser.get<std::string>("@bench");
+        const std::string imgname = parser.get<std::string>("@input");
+        const std::string bckname = parser.get<std::string>("@background");
+        if (!parser.check())
+        {
+            parser.printErrors();
+            return EXIT_FAILURE;
+        }
+
+        cv::Mat::setDefaultAllocator(&allocator);
+        cv::Mat foreg = cv::imread(imgname, cv::IMREAD_COLOR);
+        cv::Mat backg = cv::imread(bckname, cv::IMREAD_COLOR);
+        if (foreg.empty() || backg.empty())
+        {
+            std::cerr << "Error reading: " << imgname << " or " << bckname << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Input: " << imgname << " " << foreg.size()
+                  << ", background " << backg.size() << std::endl;
+
+        if (bench == "into")
+            bench_into(foreg, backg, hue, sensitivity, iters);
+        else if (bench == "hue")
+            bench_hue(foreg, hue, sensitivity, iters);
+        else if (bench == "lut")
+            bench_lut(foreg, hue, sensitivity, iters);
+        else if (bench == "fused")
+            bench_fused(foreg, backg, hue, sensitivity, iters);
+        else if (bench == "backg")
+            bench_backg(foreg, backg, hue, sensitivity, iters);
+        else if (bench == "temporal")
+            bench_temporal(foreg, backg, hue, sensitivity, iters);
+        else if (bench == "soft")
+            bench_soft(foreg, backg, hue, sensitivity, iters);
+        else if (bench == "band")
+            bench_band(foreg, backg, hue, sensitivity, iters);
+        else
+        {
+            std::cerr << "Error: unknown benchmark '" << bench << "'." << std::endl;
+            retCode = EXIT_FAILURE;
+        }
+        cv::Mat::setDefaultAllocator(nullptr);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        retCode = EXIT_FAILURE;
+    }
+    return retCode;
+}
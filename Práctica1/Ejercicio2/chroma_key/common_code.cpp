@@ -1,20 +1,24 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include "common_code.hpp"
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 
-cv::Mat
-fsiv_convert_bgr_to_hsv(const cv::Mat &img)
+void
+fsiv_combine_images_into(const cv::Mat &img1, const cv::Mat &img2,
+                         const cv::Mat &mask, cv::Mat &output)
 {
-    CV_Assert(img.channels() == 3);
-    cv::Mat out;
-    //! TODO
-    // Hint: use cvtColor.
-    // Remember: the input color scheme is assumed to be BGR.
-        cv::cvtColor(img,out, cv::COLOR_BGR2HSV);
-    //
-    CV_Assert(out.channels() == 3);
-    return out;
+    CV_Assert(img2.size() == img1.size());
+    CV_Assert(img2.type() == img1.type());
+    CV_Assert(mask.size() == img1.size());
+    CV_Assert(output.empty() || output.data != img1.data);
+    img2.copyTo(output);
+    img1.copyTo(output, mask);
+    CV_Assert(output.size() == img1.size());
+    CV_Assert(output.type() == img1.type());
 }
 
 cv::Mat
@@ -27,16 +31,269 @@ fsiv_combine_images(const cv::Mat &img1, const cv::Mat &img2,
     cv::Mat output;
     //! TODO
     //  HINT: you can use cv::Mat::copyTo().
-        cv::Mat img2_aux;
-        img2.copyTo(img2_aux);
-        img1.copyTo(img2_aux, mask);
-        output = img2_aux;
+        fsiv_combine_images_into(img1, img2, mask, output);
     //
     CV_Assert(output.size() == img1.size());
     CV_Assert(output.type() == img1.type());
     return output;
 }
 
+void
+fsiv_compute_chroma_key_mask_into(const cv::Mat &bgr_img,
+                                  int chroma_key,
+                                  int sensitivity,
+                                  cv::Mat &mask,
+                                  FsivChromaKeyWorkspace *ws)
+{
+    CV_Assert(bgr_img.type() == CV_8UC3);
+    FsivChromaKeyWorkspace local_ws;
+    if (ws == nullptr)
+        ws = &local_ws;
+    // S y V pueden tomar cualquier valor, así que basta con el canal H.
+    fsiv_convert_bgr_to_hue_into(bgr_img, ws->hue);
+    cv::inRange(ws->hue, cv::Scalar(chroma_key - sensitivity),
+                cv::Scalar(chroma_key + sensitivity), mask);
+}
+
+FsivChromaKeySpec
+fsiv_chroma_key_spec(int hue, int sensitivity)
+{
+    CV_Assert(sensitivity >= 0);
+    FsivChromaKeySpec spec;
+    if (sensitivity >= 90)
+        spec.hue_ranges.push_back(cv::Vec2i(0, 179));
+    else
+    {
+        const int h = ((hue % 180) + 180) % 180;
+        int lo = h - sensitivity, hi = h + sensitivity;
+        if (lo < 0)
+            lo += 180;
+        if (hi > 179)
+            hi -= 180;
+        spec.hue_ranges.push_back(cv::Vec2i(lo, hi));
+    }
+    return spec;
+}
+
+/**
+ * @brief Clave [hue - sensitivity, hue + sensitivity] sin dar la vuelta,
+ * igual que cv::inRange sobre el canal H.
+ */
+static FsivChromaKeySpec
+inrange_spec(int hue, int sensitivity)
+{
+    FsivChromaKeySpec spec;
+    if (sensitivity >= 0)
+        spec.hue_ranges.push_back(cv::Vec2i(hue - sensitivity, hue + sensitivity));
+    return spec;
+}
+
+/**
+ * @brief Rellena una tabla de 2^24 bits, uno por color BGR de 8 bits.
+ *
+ * El bit (b << 16) | (g << 8) | r vale in(p), donde p apunta al color en
+ * HSV (sólo H si hue_only).
+ */
+template <class Predicate>
+static void
+build_color_table(std::vector<uchar> &table, bool hue_only, Predicate in)
+{
+    table.resize(size_t(1) << 21);
+    cv::parallel_for_(cv::Range(0, 256), [&](const cv::Range &r)
+    {
+        // Todos los colores con un mismo B: fila G, columna R.
+        cv::Mat plane(256, 256, CV_8UC3), hsv;
+        for (int b = r.start; b < r.end; ++b)
+        {
+            for (int g = 0; g < 256; ++g)
+            {
+                uchar *p = plane.ptr<uchar>(g);
+                for (int x = 0; x < 256; ++x)
+                {
+                    p[3 * x] = uchar(b);
+                    p[3 * x + 1] = uchar(g);
+                    p[3 * x + 2] = uchar(x);
+                }
+            }
+            if (hue_only)
+                fsiv_convert_bgr_to_hue_into(plane, hsv);
+            else
+                cv::cvtColor(plane, hsv, cv::COLOR_BGR2HSV);
+            const int cn = hsv.channels();
+            uchar *bits = &table[size_t(b) << 13];
+            for (int g = 0; g < 256; ++g)
+            {
+                const uchar *c = hsv.ptr<uchar>(g);
+                for (int x = 0; x < 256; x += 8)
+                {
+                    uchar byte = 0;
+                    for (int k = 0; k < 8; ++k)
+                        byte |= uchar(in(c + cn * (x + k)) << k);
+                    bits[(g << 5) | (x >> 3)] = byte;
+                }
+            }
+        }
+    });
+}
+
+/**
+ * @brief true si spec no limita S ni V.
+ */
+static bool
+full_sv(const FsivChromaKeySpec &spec)
+{
+    return spec.s_range[0] <= 0 && spec.s_range[1] >= 255 &&
+           spec.v_range[0] <= 0 && spec.v_range[1] >= 255;
+}
+
+/**
+ * @brief Reconstruye la tabla de colores de ws si cambió la clave.
+ *
+ * El bit (b << 16) | (g << 8) | r vale 1 si ese color es fondo según spec.
+ */
+static void
+update_chroma_key_table(const FsivChromaKeySpec &spec, FsivChromaKeyWorkspace &ws)
+{
+    if (!ws.key_table.empty() && ws.key_spec == spec)
+        return;
+    // Todos los intervalos de tono se reducen a una tabla de 256 entradas.
+    uchar hue_in[256];
+    for (int h = 0; h < 256; ++h)
+    {
+        hue_in[h] = 0;
+        for (const cv::Vec2i &r : spec.hue_ranges)
+            if (r[0] <= r[1] ? (r[0] <= h && h <= r[1]) : (h >= r[0] || h <= r[1]))
+                hue_in[h] = 1;
+    }
+    // Si S y V no se limitan basta con el canal H, que es más barato.
+    const bool hue_only = full_sv(spec);
+    const cv::Vec2i s = spec.s_range, v = spec.v_range;
+    build_color_table(ws.key_table, hue_only, [&](const uchar *px)
+    {
+        return hue_in[px[0]] != 0 &&
+               (hue_only || (s[0] <= px[1] && px[1] <= s[1] && v[0] <= px[2] && px[2] <= v[1]));
+    });
+    ws.key_spec = spec;
+}
+
+/**
+ * @brief Reconstruye la tabla de S/V de ws si cambiaron los límites.
+ *
+ * El bit (b << 16) | (g << 8) | r vale 1 si la S y la V de ese color están
+ * en los límites de spec.
+ */
+static void
+update_sv_table(const FsivChromaKeySpec &spec, FsivChromaKeyWorkspace &ws)
+{
+    const cv::Vec4i bounds(spec.s_range[0], spec.s_range[1], spec.v_range[0], spec.v_range[1]);
+    if (!ws.sv_table.empty() && ws.sv_bounds == bounds)
+        return;
+    build_color_table(ws.sv_table, false, [&](const uchar *px)
+    {
+        return bounds[0] <= px[1] && px[1] <= bounds[1] && bounds[2] <= px[2] && px[2] <= bounds[3];
+    });
+    ws.sv_bounds = bounds;
+}
+
+/**
+ * @brief Máscara de una fila con la tabla de colores.
+ * @param keep false: 255 en los colores de la clave; true: 255 en los demás.
+ */
+static inline void
+table_mask_row(const uchar *table, const uchar *src, uchar *dst, int cols, bool keep)
+{
+    const uchar flip = keep ? 255 : 0;
+    for (int x = 0; x < cols; ++x)
+    {
+        const unsigned c = (unsigned(src[3 * x]) << 16) |
+                           (unsigned(src[3 * x + 1]) << 8) | src[3 * x + 2];
+        dst[x] = uchar(-int((table[c >> 3] >> (c & 7)) & 1)) ^ flip;
+    }
+}
+
+/**
+ * @brief 255 donde el tono de la fila está fuera de [lo, hi] (píxeles del
+ * primer plano que se conservan) y 0 dentro.
+ */
+static inline void
+hue_keep_row(const uchar *hue, int lo, int hi, uchar *dst, int cols)
+{
+    if (hi < 0 || lo > 255 || lo > hi)
+    {
+        std::memset(dst, 255, cols);
+        return;
+    }
+    const uchar l = uchar(std::max(lo, 0));
+    const uchar h = uchar(std::min(hi, 255));
+    int x = 0;
+#if CV_SIMD
+    const cv::v_uint8 vl = cv::vx_setall_u8(l), vh = cv::vx_setall_u8(h);
+    for (; x <= cols - cv::v_uint8::nlanes; x += cv::v_uint8::nlanes)
+    {
+        const cv::v_uint8 v = cv::vx_load(hue + x);
+        cv::v_store(dst + x, ~((v >= vl) & (v <= vh)));
+    }
+#endif
+    for (; x < cols; ++x)
+        dst[x] = (l <= hue[x] && hue[x] <= h) ? 0 : 255;
+}
+
+/**
+ * @brief Escribe en dst el píxel de fg donde keep es 255 y el de bg donde es 0.
+ */
+static inline void
+select_row(const uchar *fg, const uchar *bg, const uchar *keep, uchar *dst, int cols)
+{
+    int x = 0;
+#if CV_SIMD
+    for (; x <= cols - cv::v_uint8::nlanes; x += cv::v_uint8::nlanes)
+    {
+        cv::v_uint8 f0, f1, f2, b0, b1, b2;
+        cv::v_load_deinterleave(fg + 3 * x, f0, f1, f2);
+        cv::v_load_deinterleave(bg + 3 * x, b0, b1, b2);
+        const cv::v_uint8 m = cv::vx_load(keep + x);
+        cv::v_store_interleave(dst + 3 * x, cv::v_select(m, f0, b0),
+                               cv::v_select(m, f1, b1), cv::v_select(m, f2, b2));
+    }
+#endif
+    for (; x < cols; ++x)
+    {
+        const uchar *src = keep[x] ? fg : bg;
+        dst[3 * x] = src[3 * x];
+        dst[3 * x + 1] = src[3 * x + 1];
+        dst[3 * x + 2] = src[3 * x + 2];
+    }
+}
+
+void
+fsiv_compute_chroma_key_mask_lut_into(const cv::Mat &bgr_img,
+                                      int chroma_key,
+                                      int sensitivity,
+                                      cv::Mat &mask,
+                                      FsivChromaKeyWorkspace &ws)
+{
+    fsiv_compute_chroma_key_mask_into(bgr_img, inrange_spec(chroma_key, sensitivity),
+                                      mask, ws);
+}
+
+void
+fsiv_compute_chroma_key_mask_into(const cv::Mat &bgr_img,
+                                  const FsivChromaKeySpec &spec,
+                                  cv::Mat &mask,
+                                  FsivChromaKeyWorkspace &ws)
+{
+    CV_Assert(bgr_img.type() == CV_8UC3);
+    update_chroma_key_table(spec, ws);
+    mask.create(bgr_img.size(), CV_8UC1);
+    const uchar *table = ws.key_table.data();
+    cv::parallel_for_(cv::Range(0, bgr_img.rows), [&](const cv::Range &rows)
+    {
+        for (int y = rows.start; y < rows.end; ++y)
+            table_mask_row(table, bgr_img.ptr<uchar>(y), mask.ptr<uchar>(y),
+                           bgr_img.cols, false);
+    });
+}
+
 cv::Mat
 fsiv_compute_chroma_key_mask(const cv::Mat &bgr_img,
                              int chroma_key,
@@ -48,41 +305,676 @@ fsiv_compute_chroma_key_mask(const cv::Mat &bgr_img,
     // Hint: use fsiv_xxx defined functions.
     // Hint: use cv::inRange to get the mask.
     // Remember: the use full range for S and V channels ([0,255]).
-        cv::Mat hsv_img;
-        hsv_img = fsiv_convert_bgr_to_hsv(bgr_img);
-        cv::Scalar lower_b(chroma_key - sensitivity, 0, 0);
-        cv::Scalar upper_b(chroma_key + sensitivity, 255, 255);
-        cv::inRange(hsv_img, lower_b, upper_b, mask);
+        fsiv_compute_chroma_key_mask_into(bgr_img, chroma_key, sensitivity, mask);
     //
     return mask;
 }
 
+/**
+ * @brief fsiv_apply_chroma_key_into con el fondo ya al tamaño de foreg.
+ * @param ws espacio de trabajo persistente o nulo.
+ */
+static void
+composite_chroma_key(const cv::Mat &foreg, const cv::Mat &bg,
+                     const FsivChromaKeySpec &spec, cv::Mat &out,
+                     cv::Mat *mask_out, FsivChromaKeyWorkspace *ws)
+{
+    CV_Assert(foreg.type() == CV_8UC3 && bg.type() == CV_8UC3);
+    CV_Assert(bg.size() == foreg.size());
+    // Construir la tabla sólo compensa si ws se reutiliza entre llamadas.
+    // Sin ws se usa el canal H con un único intervalo sin vuelta.
+    const bool use_table = ws != nullptr;
+    if (use_table)
+        update_chroma_key_table(spec, *ws);
+    else
+        CV_Assert(spec.hue_ranges.size() <= 1 &&
+                  (spec.hue_ranges.empty() || spec.hue_ranges[0][0] <= spec.hue_ranges[0][1]) &&
+                  spec.s_range == cv::Vec2i(0, 255) && spec.v_range == cv::Vec2i(0, 255));
+    const int lo = spec.hue_ranges.empty() ? 1 : spec.hue_ranges[0][0];
+    const int hi = spec.hue_ranges.empty() ? 0 : spec.hue_ranges[0][1];
+    out.create(foreg.size(), CV_8UC3);
+    if (mask_out != nullptr)
+        mask_out->create(foreg.size(), CV_8UC1);
+
+    // Una sola pasada por filas: se clasifica cada píxel y se escribe el del
+    // primer plano o el del fondo, sin máscara ni copia del fondo a tamaño
+    // completo. La máscara sólo se guarda si la piden.
+    cv::parallel_for_(cv::Range(0, foreg.rows), [&](const cv::Range &rows)
+    {
+        std::vector<uchar> keep_row(foreg.cols);
+        cv::Mat hue_row;
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            const uchar *fg = foreg.ptr<uchar>(y);
+            uchar *keep = mask_out != nullptr ? mask_out->ptr<uchar>(y) : keep_row.data();
+            if (use_table)
+                table_mask_row(ws->key_table.data(), fg, keep, foreg.cols, true);
+            else
+            {
+                fsiv_convert_bgr_to_hue_into(foreg.row(y), hue_row);
+                hue_keep_row(hue_row.ptr<uchar>(), lo, hi, keep, foreg.cols);
+            }
+            select_row(fg, bg.ptr<uchar>(y), keep, out.ptr<uchar>(y), foreg.cols);
+        }
+    });
+    CV_Assert(out.size() == foreg.size());
+    CV_Assert(out.type() == foreg.type());
+}
+
+void
+fsiv_apply_chroma_key_into(const cv::Mat &foreg, const cv::Mat &backg,
+                           int hue, int sensitivity, cv::Mat &out,
+                           cv::Mat *mask_out, FsivChromaKeyWorkspace *ws)
+{
+    const cv::Mat *backg_resized = &backg;
+    cv::Mat local_backg;
+    if (foreg.size() != backg.size())
+    {
+        cv::Mat &dst = ws != nullptr ? ws->backg : local_backg;
+        cv::resize(backg, dst, foreg.size(), 0, 0, cv::INTER_LINEAR);
+        backg_resized = &dst;
+    }
+    composite_chroma_key(foreg, *backg_resized, inrange_spec(hue, sensitivity), out,
+                         mask_out, ws);
+}
+
+void
+fsiv_apply_chroma_key_into(const cv::Mat &foreg, BackgroundCache &backg,
+                           int hue, int sensitivity, cv::Mat &out,
+                           cv::Mat *mask_out, FsivChromaKeyWorkspace *ws,
+                           int interpolation)
+{
+    composite_chroma_key(foreg, backg.resized(foreg.size(), interpolation),
+                         inrange_spec(hue, sensitivity), out, mask_out, ws);
+}
+
+void
+fsiv_apply_chroma_key_into(const cv::Mat &foreg, BackgroundCache &backg,
+                           const FsivChromaKeySpec &spec, cv::Mat &out,
+                           cv::Mat *mask_out, FsivChromaKeyWorkspace &ws,
+                           int interpolation)
+{
+    composite_chroma_key(foreg, backg.resized(foreg.size(), interpolation), spec, out,
+                         mask_out, &ws);
+}
+
+void
+fsiv_apply_chroma_key_into(const cv::Mat &foreg, const cv::Mat &backg,
+                           const FsivChromaKeySpec &spec, cv::Mat &out,
+                           cv::Mat *mask_out, FsivChromaKeyWorkspace &ws)
+{
+    const cv::Mat *backg_resized = &backg;
+    if (foreg.size() != backg.size())
+    {
+        cv::resize(backg, ws.backg, foreg.size(), 0, 0, cv::INTER_LINEAR);
+        backg_resized = &ws.backg;
+    }
+    composite_chroma_key(foreg, *backg_resized, spec, out, mask_out, &ws);
+}
+
+#if CV_SIMD
+/**
+ * @brief (f * a + b * (255 - a)) / 255 redondeado, en 16 bits.
+ */
+static inline cv::v_uint8
+blend_u8(const cv::v_uint8 &f, const cv::v_uint8 &b, const cv::v_uint16 &a0,
+         const cv::v_uint16 &a1, const cv::v_uint16 &ia0, const cv::v_uint16 &ia1)
+{
+    const cv::v_uint16 half = cv::vx_setall_u16(128);
+    cv::v_uint16 f0, f1, b0, b1;
+    cv::v_expand(f, f0, f1);
+    cv::v_expand(b, b0, b1);
+    // Como mucho 255 * 255 + 128: cabe en 16 bits.
+    cv::v_uint16 t0 = cv::v_mul_wrap(f0, a0) + cv::v_mul_wrap(b0, ia0) + half;
+    cv::v_uint16 t1 = cv::v_mul_wrap(f1, a1) + cv::v_mul_wrap(b1, ia1) + half;
+    // (t + (t >> 8)) >> 8 es t / 255 redondeado sin dividir.
+    t0 = (t0 + (t0 >> 8)) >> 8;
+    t1 = (t1 + (t1 >> 8)) >> 8;
+    return cv::v_pack(t0, t1);
+}
+#endif
+
+/**
+ * @brief dst = fg * alpha + bg * (1 - alpha) con alpha en [0,255] y
+ * aritmética entera de 16 bits.
+ */
+static inline void
+blend_row(const uchar *fg, const uchar *bg, const uchar *alpha, uchar *dst, int cols)
+{
+    int x = 0;
+#if CV_SIMD
+    const cv::v_uint16 v255 = cv::vx_setall_u16(255);
+    for (; x <= cols - cv::v_uint8::nlanes; x += cv::v_uint8::nlanes)
+    {
+        cv::v_uint8 f0, f1, f2, b0, b1, b2;
+        cv::v_load_deinterleave(fg + 3 * x, f0, f1, f2);
+        cv::v_load_deinterleave(bg + 3 * x, b0, b1, b2);
+        cv::v_uint16 a0, a1;
+        cv::v_expand(cv::vx_load(alpha + x), a0, a1);
+        const cv::v_uint16 ia0 = v255 - a0, ia1 = v255 - a1;
+        cv::v_store_interleave(dst + 3 * x, blend_u8(f0, b0, a0, a1, ia0, ia1),
+                               blend_u8(f1, b1, a0, a1, ia0, ia1),
+                               blend_u8(f2, b2, a0, a1, ia0, ia1));
+    }
+#endif
+    for (; x < cols; ++x)
+    {
+        const unsigned a = alpha[x];
+        for (int c = 0; c < 3; ++c)
+        {
+            const unsigned t = fg[3 * x + c] * a + bg[3 * x + c] * (255 - a) + 128;
+            dst[3 * x + c] = uchar((t + (t >> 8)) >> 8);
+        }
+    }
+}
+
+void
+fsiv_blend_images_into(const cv::Mat &foreground, const cv::Mat &background,
+                       const cv::Mat &alpha, cv::Mat &output)
+{
+    CV_Assert(foreground.type() == CV_8UC3 && background.type() == CV_8UC3);
+    CV_Assert(alpha.type() == CV_8UC1);
+    CV_Assert(background.size() == foreground.size() && alpha.size() == foreground.size());
+    output.create(foreground.size(), CV_8UC3);
+    cv::parallel_for_(cv::Range(0, foreground.rows), [&](const cv::Range &rows)
+    {
+        for (int y = rows.start; y < rows.end; ++y)
+            blend_row(foreground.ptr<uchar>(y), background.ptr<uchar>(y),
+                      alpha.ptr<uchar>(y), output.ptr<uchar>(y), foreground.cols);
+    });
+}
+
+/**
+ * @brief Alfa de cada tono: 0 dentro de los intervalos de spec y, fuera,
+ * la distancia circular al intervalo más cercano escalada para llegar a
+ * 255 a falloff tonos (255 directamente si falloff es 0).
+ */
+static void
+hue_alpha_table(const FsivChromaKeySpec &spec, int falloff, uchar table[256])
+{
+    for (int h = 0; h < 256; ++h)
+    {
+        int d = 255;
+        for (const cv::Vec2i &r : spec.hue_ranges)
+        {
+            const bool in = r[0] <= r[1] ? (r[0] <= h && h <= r[1])
+                                         : (h >= r[0] || h <= r[1]);
+            if (in)
+                d = 0;
+            else
+                // Fuera, el punto más cercano del intervalo es un extremo.
+                for (int e = 0; e < 2; ++e)
+                {
+                    const int diff = std::abs(h - r[e]);
+                    d = std::min(d, std::min(diff, 180 - diff));
+                }
+        }
+        if (h >= 180)
+            table[h] = 255;
+        else if (falloff <= 0)
+            table[h] = d > 0 ? 255 : 0;
+        else
+            table[h] = uchar(std::min(255, d * 255 / falloff));
+    }
+}
+
+/**
+ * @brief Mate suave y composición en una pasada por filas.
+ * @param bg fondo ya al tamaño de foreg.
+ */
+static void
+composite_soft(const cv::Mat &foreg, const cv::Mat &bg, const FsivChromaKeySpec &spec,
+               int falloff, cv::Mat &out, cv::Mat *alpha_out, FsivChromaKeyWorkspace &ws)
+{
+    CV_Assert(foreg.type() == CV_8UC3 && bg.type() == CV_8UC3);
+    CV_Assert(bg.size() == foreg.size());
+    CV_Assert(falloff >= 0);
+    uchar hue_alpha[256];
+    hue_alpha_table(spec, falloff, hue_alpha);
+    // Con S/V limitados, los colores fuera de los límites son primer plano.
+    const bool use_sv = !full_sv(spec);
+    if (use_sv)
+        update_sv_table(spec, ws);
+    out.create(foreg.size(), CV_8UC3);
+    if (alpha_out != nullptr)
+        alpha_out->create(foreg.size(), CV_8UC1);
+
+    cv::parallel_for_(cv::Range(0, foreg.rows), [&](const cv::Range &rows)
+    {
+        std::vector<uchar> alpha_row(foreg.cols);
+        cv::Mat hue_row;
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            const uchar *fg = foreg.ptr<uchar>(y);
+            uchar *alpha = alpha_out != nullptr ? alpha_out->ptr<uchar>(y) : alpha_row.data();
+            fsiv_convert_bgr_to_hue_into(foreg.row(y), hue_row);
+            const uchar *h = hue_row.ptr<uchar>();
+            if (use_sv)
+            {
+                const uchar *table = ws.sv_table.data();
+                for (int x = 0; x < foreg.cols; ++x)
+                {
+                    const unsigned c = (unsigned(fg[3 * x]) << 16) |
+                                       (unsigned(fg[3 * x + 1]) << 8) | fg[3 * x + 2];
+                    alpha[x] = ((table[c >> 3] >> (c & 7)) & 1) ? hue_alpha[h[x]] : 255;
+                }
+            }
+            else
+                for (int x = 0; x < foreg.cols; ++x)
+                    alpha[x] = hue_alpha[h[x]];
+            blend_row(fg, bg.ptr<uchar>(y), alpha, out.ptr<uchar>(y), foreg.cols);
+        }
+    });
+}
+
+void
+fsiv_apply_chroma_key_soft_into(const cv::Mat &foreg, BackgroundCache &backg,
+                                const FsivChromaKeySpec &spec, int falloff, cv::Mat &out,
+                                cv::Mat *alpha_out, FsivChromaKeyWorkspace &ws,
+                                int interpolation)
+{
+    composite_soft(foreg, backg.resized(foreg.size(), interpolation), spec, falloff, out,
+                   alpha_out, ws);
+}
+
+void
+fsiv_apply_chroma_key_soft_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                const FsivChromaKeySpec &spec, int falloff, cv::Mat &out,
+                                cv::Mat *alpha_out, FsivChromaKeyWorkspace &ws)
+{
+    const cv::Mat *backg_resized = &backg;
+    if (foreg.size() != backg.size())
+    {
+        cv::resize(backg, ws.backg, foreg.size(), 0, 0, cv::INTER_LINEAR);
+        backg_resized = &ws.backg;
+    }
+    composite_soft(foreg, *backg_resized, spec, falloff, out, alpha_out, ws);
+}
+
+void
+fsiv_find_narrow_band(const cv::Mat &mask, int radius, FsivNarrowBand &band)
+{
+    CV_Assert(mask.type() == CV_8UC1 && radius >= 0);
+    const int cols = mask.cols, rows = mask.rows, win = 2 * radius + 1;
+    band.radius = radius;
+    band.size = mask.size();
+    band.runs.clear();
+    band.row_begin.assign(rows + 1, 0);
+    // count[x]: píxeles de borde de la columna x en las últimas win filas,
+    // que se guardan en un anillo para poder descontarlas.
+    std::vector<int> count(cols, 0);
+    std::vector<uchar> edges(size_t(win) * cols, 0);
+    for (int yy = 0; yy < rows + radius; ++yy)
+    {
+        uchar *e = &edges[size_t(yy % win) * cols];
+        if (yy >= win)
+            for (int x = 0; x < cols; ++x)
+                count[x] -= e[x];
+        if (yy < rows)
+        {
+            const uchar *m = mask.ptr<uchar>(yy);
+            const uchar *up = mask.ptr<uchar>(std::max(yy - 1, 0));
+            const uchar *down = mask.ptr<uchar>(std::min(yy + 1, rows - 1));
+            for (int x = 0; x < cols; ++x)
+            {
+                const uchar v = m[x];
+                const uchar left = m[std::max(x - 1, 0)], right = m[std::min(x + 1, cols - 1)];
+                e[x] = uchar((v != up[x]) | (v != down[x]) | (v != left) | (v != right));
+                count[x] += e[x];
+            }
+        }
+        // Ya están en count las filas [y - radius, y + radius].
+        const int y = yy - radius;
+        if (y < 0)
+            continue;
+        FsivBandRun run = {-1, -1};
+        for (int x = 0; x < cols; ++x)
+        {
+            if (count[x] == 0)
+                continue;
+            const int x0 = std::max(x - radius, 0), x1 = std::min(x + radius + 1, cols);
+            if (run.x0 >= 0 && x0 <= run.x1)
+                run.x1 = x1;
+            else
+            {
+                if (run.x0 >= 0)
+                    band.runs.push_back(run);
+                run.x0 = x0;
+                run.x1 = x1;
+            }
+        }
+        if (run.x0 >= 0)
+            band.runs.push_back(run);
+        band.row_begin[y + 1] = int(band.runs.size());
+    }
+}
+
+/**
+ * @brief Aplica f(y, x0, x1) a los tramos de la banda, por filas en paralelo.
+ */
+template <class Function>
+static void
+for_each_run(const FsivNarrowBand &band, Function f)
+{
+    cv::parallel_for_(cv::Range(0, band.size.height), [&](const cv::Range &rows)
+    {
+        for (int y = rows.start; y < rows.end; ++y)
+            for (int i = band.row_begin[y]; i < band.row_begin[y + 1]; ++i)
+                f(y, band.runs[i].x0, band.runs[i].x1);
+    });
+}
+
+/**
+ * @brief Mínimo (erode) o máximo del alfa en la ventana de radio r de
+ * (y, x). Dentro de la banda se lee src y fuera el alfa de la máscara, que
+ * ahí coincide con src. Los píxeles fuera de la imagen no cuentan.
+ */
+static inline uchar
+band_window_extreme(const cv::Mat &mask, const cv::Mat &in_band, const cv::Mat *src,
+                    int y, int x, int r, bool erode)
+{
+    const int y0 = std::max(y - r, 0), y1 = std::min(y + r, mask.rows - 1);
+    const int x0 = std::max(x - r, 0), x1 = std::min(x + r, mask.cols - 1);
+    int v = erode ? 255 : 0;
+    for (int yy = y0; yy <= y1; ++yy)
+    {
+        const uchar *m = mask.ptr<uchar>(yy);
+        const uchar *b = in_band.ptr<uchar>(yy);
+        const uchar *s = src != nullptr ? src->ptr<uchar>(yy) : nullptr;
+        for (int xx = x0; xx <= x1; ++xx)
+        {
+            const int a = (s != nullptr && b[xx]) ? s[xx] : 255 - m[xx];
+            v = erode ? std::min(v, a) : std::max(v, a);
+        }
+    }
+    return uchar(v);
+}
+
+/**
+ * @brief Canal BGR del color primario más cercano al tono (0..179).
+ */
+static int
+despill_channel(int hue)
+{
+    // 0: rojo, 60: verde, 120: azul.
+    return 2 - ((hue + 30) / 60) % 3;
+}
+
+void
+fsiv_refine_chroma_key_band_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                 const cv::Mat &mask, const FsivBandRefineParams &params,
+                                 cv::Mat &out, cv::Mat *alpha_out,
+                                 FsivChromaKeyWorkspace &ws)
+{
+    CV_Assert(foreg.type() == CV_8UC3 && backg.type() == CV_8UC3);
+    CV_Assert(mask.type() == CV_8UC1 && mask.size() == foreg.size());
+    CV_Assert(params.open_radius >= 0 && params.feather_radius >= 0);
+    CV_Assert(params.despill_hue < 180);
+    const cv::Mat *bg_ptr = &backg;
+    if (foreg.size() != backg.size())
+    {
+        cv::resize(backg, ws.backg, foreg.size(), 0, 0, cv::INTER_LINEAR);
+        bg_ptr = &ws.backg;
+    }
+    const cv::Mat &bg = *bg_ptr;
+    const int k = params.open_radius, f = params.feather_radius;
+
+    // El opening depende de los píxeles a 2k y la media de los que están a
+    // f del resultado: fuera de esta banda la máscara es constante hasta esa
+    // distancia y el alfa refinado es el de la máscara.
+    fsiv_find_narrow_band(mask, std::max(1, 2 * k + f), ws.band);
+    const FsivNarrowBand &band = ws.band;
+    if (ws.in_band.size() != mask.size())
+        ws.in_band = cv::Mat::zeros(mask.size(), CV_8UC1);
+    ws.band_alpha.create(mask.size(), CV_8UC1);
+    for_each_run(band, [&](int y, int x0, int x1)
+    {
+        std::memset(ws.in_band.ptr<uchar>(y) + x0, 1, size_t(x1 - x0));
+    });
+
+    // Opening del alfa (erode y dilate) sólo en la banda.
+    const cv::Mat *alpha = nullptr; // nulo: el alfa de la máscara.
+    if (k > 0)
+    {
+        ws.band_eroded.create(mask.size(), CV_8UC1);
+        ws.band_opened.create(mask.size(), CV_8UC1);
+        for_each_run(band, [&](int y, int x0, int x1)
+        {
+            uchar *dst = ws.band_eroded.ptr<uchar>(y);
+            for (int x = x0; x < x1; ++x)
+                dst[x] = band_window_extreme(mask, ws.in_band, nullptr, y, x, k, true);
+        });
+        for_each_run(band, [&](int y, int x0, int x1)
+        {
+            uchar *dst = ws.band_opened.ptr<uchar>(y);
+            for (int x = x0; x < x1; ++x)
+                dst[x] = band_window_extreme(mask, ws.in_band, &ws.band_eroded, y, x, k,
+                                             false);
+        });
+        alpha = &ws.band_opened;
+    }
+
+    // Media del alfa en la ventana de radio f (sin contar los píxeles de
+    // fuera de la imagen), con sumas por columnas para cada tramo.
+    cv::parallel_for_(cv::Range(0, mask.rows), [&](const cv::Range &rows)
+    {
+        std::vector<int> prefix;
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            uchar *dst = ws.band_alpha.ptr<uchar>(y);
+            const int y0 = std::max(y - f, 0), y1 = std::min(y + f, mask.rows - 1);
+            for (int i = band.row_begin[y]; i < band.row_begin[y + 1]; ++i)
+            {
+                const int x0 = band.runs[i].x0, x1 = band.runs[i].x1;
+                const int c0 = std::max(x0 - f, 0), c1 = std::min(x1 + f, mask.cols);
+                prefix.assign(size_t(c1 - c0 + 1), 0);
+                for (int yy = y0; yy <= y1; ++yy)
+                {
+                    const uchar *m = mask.ptr<uchar>(yy);
+                    const uchar *b = ws.in_band.ptr<uchar>(yy);
+                    const uchar *s = alpha != nullptr ? alpha->ptr<uchar>(yy) : nullptr;
+                    for (int c = c0; c < c1; ++c)
+                        prefix[c - c0 + 1] += (s != nullptr && b[c]) ? s[c] : 255 - m[c];
+                }
+                for (int c = c0; c < c1; ++c)
+                    prefix[c - c0 + 1] += prefix[c - c0];
+                for (int x = x0; x < x1; ++x)
+                {
+                    const int a = std::max(x - f, 0), b = std::min(x + f + 1, mask.cols);
+                    const int n = (y1 - y0 + 1) * (b - a);
+                    dst[x] = uchar((prefix[b - c0] - prefix[a - c0] + n / 2) / n);
+                }
+            }
+        }
+    });
+
+    // Composición: selección directa entre tramos y mezcla en ellos.
+    const int channel = params.despill_hue >= 0 ? despill_channel(params.despill_hue) : -1;
+    out.create(foreg.size(), CV_8UC3);
+    if (alpha_out != nullptr)
+        alpha_out->create(foreg.size(), CV_8UC1);
+    cv::parallel_for_(cv::Range(0, foreg.rows), [&](const cv::Range &rows)
+    {
+        std::vector<uchar> despilled;
+        for (int y = rows.start; y < rows.end; ++y)
+        {
+            const uchar *fg = foreg.ptr<uchar>(y), *b = bg.ptr<uchar>(y);
+            const uchar *m = mask.ptr<uchar>(y), *a = ws.band_alpha.ptr<uchar>(y);
+            uchar *dst = out.ptr<uchar>(y);
+            uchar *a_out = alpha_out != nullptr ? alpha_out->ptr<uchar>(y) : nullptr;
+            int x = 0;
+            for (int i = band.row_begin[y]; i <= band.row_begin[y + 1]; ++i)
+            {
+                const bool last = i == band.row_begin[y + 1];
+                const int x0 = last ? foreg.cols : band.runs[i].x0;
+                // mask es 255 en el fondo: se selecciona con ella al revés.
+                select_row(b + 3 * x, fg + 3 * x, m + x, dst + 3 * x, x0 - x);
+                if (a_out != nullptr)
+                    for (int j = x; j < x0; ++j)
+                        a_out[j] = uchar(255 - m[j]);
+                if (last)
+                    break;
+                const int x1 = band.runs[i].x1, n = x1 - x0;
+                const uchar *src = fg + 3 * x0;
+                if (channel >= 0)
+                {
+                    // Despill: el canal clave no puede superar a los otros dos.
+                    despilled.assign(src, src + 3 * n);
+                    for (int j = 0; j < n; ++j)
+                    {
+                        uchar *p = &despilled[3 * j];
+                        const uchar other = std::max(p[(channel + 1) % 3], p[(channel + 2) % 3]);
+                        p[channel] = std::min(p[channel], other);
+                    }
+                    src = despilled.data();
+                }
+                blend_row(src, b + 3 * x0, a + x0, dst + 3 * x0, n);
+                if (a_out != nullptr)
+                    std::memcpy(a_out + x0, a + x0, size_t(n));
+                x = x1;
+            }
+        }
+    });
+
+    // in_band se deja a 0 para la siguiente llamada.
+    for_each_run(band, [&](int y, int x0, int x1)
+    {
+        std::memset(ws.in_band.ptr<uchar>(y) + x0, 0, size_t(x1 - x0));
+    });
+}
+
+void
+fsiv_apply_chroma_key_refined_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                   const FsivChromaKeySpec &spec,
+                                   const FsivBandRefineParams &params, cv::Mat &out,
+                                   cv::Mat *alpha_out, FsivChromaKeyWorkspace &ws)
+{
+    fsiv_compute_chroma_key_mask_into(foreg, spec, ws.key_mask, ws);
+    fsiv_refine_chroma_key_band_into(foreg, backg, ws.key_mask, params, out, alpha_out, ws);
+}
+
+/**
+ * @brief Suma de diferencias absolutas de n bytes.
+ */
+static inline unsigned
+sad_bytes(const uchar *a, const uchar *b, int n)
+{
+    unsigned sad = 0;
+    int i = 0;
+#if CV_SIMD128
+    for (; i <= n - 16; i += 16)
+        sad += cv::v_reduce_sad(cv::v_load(a + i), cv::v_load(b + i));
+#endif
+    for (; i < n; ++i)
+        sad += std::abs(int(a[i]) - int(b[i]));
+    return sad;
+}
+
+void
+fsiv_apply_chroma_key_incremental_into(const cv::Mat &foreg, BackgroundCache &backg,
+                                       const FsivChromaKeySpec &spec, cv::Mat &out,
+                                       cv::Mat *mask_out, FsivChromaKeyWorkspace &ws,
+                                       FsivTemporalKeyState &state, int interpolation)
+{
+    CV_Assert(foreg.type() == CV_8UC3);
+    CV_Assert(state.refresh_period >= 0 && state.tolerance >= 0.0);
+    const cv::Mat bg = backg.resized(foreg.size(), interpolation);
+    CV_Assert(bg.type() == CV_8UC3);
+    update_chroma_key_table(spec, ws);
+
+    const int B = FSIV_TEMPORAL_BLOCK;
+    const int bcols = (foreg.cols + B - 1) / B;
+    const int brows = (foreg.rows + B - 1) / B;
+    const bool full = state.ref.size() != foreg.size() || state.bg.data != bg.data ||
+                      state.spec != spec ||
+                      (state.refresh_period > 0 &&
+                       state.frames_since_refresh >= state.refresh_period);
+    if (full)
+    {
+        state.ref.create(foreg.size(), CV_8UC3);
+        state.out.create(foreg.size(), CV_8UC3);
+        state.mask.create(foreg.size(), CV_8UC1);
+        state.bg = bg;
+        state.spec = spec;
+        state.frames_since_refresh = 0;
+    }
+    state.changed.assign(size_t(bcols) * brows, full ? 1 : 0);
+
+    const uchar *table = ws.key_table.data();
+    cv::parallel_for_(cv::Range(0, brows), [&](const cv::Range &range)
+    {
+        for (int by = range.start; by < range.end; ++by)
+        {
+            const int y0 = by * B, y1 = std::min(y0 + B, foreg.rows);
+            uchar *changed = &state.changed[size_t(by) * bcols];
+            if (!full)
+            {
+                // Un bloque cambia en cuanto su SAD supera el límite; no hace
+                // falta recorrer el resto de sus filas.
+                for (int bx = 0; bx < bcols; ++bx)
+                {
+                    const int x0 = bx * B, w = std::min(B, foreg.cols - x0);
+                    const double limit = state.tolerance * 3 * w * (y1 - y0);
+                    unsigned sad = 0;
+                    for (int y = y0; y < y1 && !changed[bx]; ++y)
+                    {
+                        sad += sad_bytes(foreg.ptr<uchar>(y) + 3 * x0,
+                                         state.ref.ptr<uchar>(y) + 3 * x0, 3 * w);
+                        changed[bx] = sad > limit;
+                    }
+                }
+            }
+            // Los bloques cambiados contiguos se componen como un solo tramo.
+            for (int bx = 0; bx < bcols;)
+            {
+                if (!changed[bx])
+                {
+                    ++bx;
+                    continue;
+                }
+                const int first = bx;
+                while (bx < bcols && changed[bx])
+                    ++bx;
+                const int x0 = first * B, w = std::min(bx * B, foreg.cols) - x0;
+                for (int y = y0; y < y1; ++y)
+                {
+                    const uchar *fg = foreg.ptr<uchar>(y) + 3 * x0;
+                    uchar *keep = state.mask.ptr<uchar>(y) + x0;
+                    table_mask_row(table, fg, keep, w, true);
+                    select_row(fg, bg.ptr<uchar>(y) + 3 * x0, keep,
+                               state.out.ptr<uchar>(y) + 3 * x0, w);
+                    std::memcpy(state.ref.ptr<uchar>(y) + 3 * x0, fg, 3 * w);
+                }
+            }
+        }
+    });
+
+    state.total_blocks = state.changed.size();
+    state.changed_blocks = std::count(state.changed.begin(), state.changed.end(), 1);
+    ++state.frames_since_refresh;
+    out = state.out;
+    if (mask_out != nullptr)
+        *mask_out = state.mask;
+}
+
 cv::Mat
 fsiv_apply_chroma_key(const cv::Mat &foreg, const cv::Mat &backg, int hue,
                       int sensitivity, cv::Mat *mask_out)
 {
     cv::Mat out;
-    cv::Scalar lower_b, upper_b; // HSV range.
 
     // TODO
     // Hint: use fsiv_xxx defined functions.
     // Hint: use cv::resize if backg img has different size than foreg.
     // Remember: if mask_out is not null, the computed mask must be assigned to *mask_out.
-        cv::Mat mask, backg_resized;
-
-        if(foreg.size() != backg.size()){
-            cv::resize(backg, backg_resized, foreg.size(), 0, 0, cv::INTER_LINEAR);
-        } else {
-            backg_resized = backg;
-        }
-        
-        mask = fsiv_compute_chroma_key_mask(foreg, hue, sensitivity);
-        cv::bitwise_not(mask, mask);
-        if( mask_out != nullptr){
+        if (mask_out != nullptr)
+        {
+            cv::Mat mask;
+            fsiv_apply_chroma_key_into(foreg, backg, hue, sensitivity, out, &mask);
             *mask_out = mask;
         }
-
-        out = fsiv_combine_images(foreg, backg_resized, mask);
+        else
+            fsiv_apply_chroma_key_into(foreg, backg, hue, sensitivity, out);
     //
     CV_Assert(out.size() == foreg.size());
     CV_Assert(out.type() == foreg.type());
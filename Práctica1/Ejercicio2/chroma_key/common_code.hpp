@@ -1,12 +1,143 @@
 #pragma once
+#include <vector>
 #include <opencv2/core.hpp>
 
+#include "fsiv_core.hpp"
+#include "background_cache.hpp"
+
+/**
+ * @brief Colores que se consideran fondo.
+ *
+ * Un color BGR es fondo si su tono está en alguno de los intervalos de
+ * hue_ranges y su S y su V (en [0,255], como en cv::cvtColor para 8 bits)
+ * están en s_range y v_range. Cualquier número de intervalos se compila en
+ * una única tabla (ver fsiv_compute_chroma_key_mask_into con
+ * FsivChromaKeySpec), así que no cuesta más pasadas.
+ */
+struct FsivChromaKeySpec
+{
+    std::vector<cv::Vec2i> hue_ranges; /*< intervalos [lo,hi] de H. Si lo > hi el intervalo da la vuelta por 180: [lo,179] y [0,hi].*/
+    cv::Vec2i s_range = cv::Vec2i(0, 255); /*< intervalo de S.*/
+    cv::Vec2i v_range = cv::Vec2i(0, 255); /*< intervalo de V.*/
+};
+
+inline bool
+operator==(const FsivChromaKeySpec &a, const FsivChromaKeySpec &b)
+{
+    return a.hue_ranges == b.hue_ranges && a.s_range == b.s_range && a.v_range == b.v_range;
+}
+
+inline bool
+operator!=(const FsivChromaKeySpec &a, const FsivChromaKeySpec &b)
+{
+    return !(a == b);
+}
+
+/**
+ * @brief Clave de tono hue +- sensitivity teniendo en cuenta que H es
+ * circular: p.e. hue = 175 y sensitivity = 10 es [165,179] y [0,5].
+ * @param hue tono en [0,180).
+ * @param sensitivity amplitud del intervalo (>= 0).
+ */
+FsivChromaKeySpec fsiv_chroma_key_spec(int hue, int sensitivity);
+
+/**
+ * @brief Un tramo [x0, x1) de una fila.
+ */
+struct FsivBandRun
+{
+    int x0;
+    int x1;
+};
+
 /**
- * @brief Convierte una imagen en color BGR a HSV.
- * @param img imagen de entrada.
- * @return la imagen de salida.
+ * @brief Banda estrecha alrededor del borde de una máscara, como lista de
+ * tramos por filas.
+ *
+ * Los tramos de la fila y son runs[row_begin[y]] ... runs[row_begin[y+1]-1],
+ * ordenados y sin solaparse.
  */
-cv::Mat fsiv_convert_bgr_to_hsv(const cv::Mat &img);
+struct FsivNarrowBand
+{
+    int radius = 0;                /*< distancia (Chebyshev) máxima al borde.*/
+    cv::Size size;                 /*< tamaño de la máscara.*/
+    std::vector<FsivBandRun> runs; /*< tramos de todas las filas.*/
+    std::vector<int> row_begin;    /*< primer tramo de cada fila (rows + 1 entradas).*/
+
+    /** @brief Número de píxeles de la banda. */
+    size_t pixels() const
+    {
+        size_t n = 0;
+        for (const FsivBandRun &r : runs)
+            n += size_t(r.x1 - r.x0);
+        return n;
+    }
+};
+
+/**
+ * @brief Retoques del borde de la máscara que sólo se aplican en la banda.
+ */
+struct FsivBandRefineParams
+{
+    int open_radius = 0;    /*< radio del opening (quita motas de hasta 2*radio+1 píxeles; 0: no).*/
+    int feather_radius = 0; /*< radio de la media que suaviza el borde (0: borde duro).*/
+    int despill_hue = -1;   /*< tono clave que se quita del primer plano en la banda (-1: no).*/
+};
+
+/**
+ * @brief Espacio de trabajo para reutilizar los buffers intermedios.
+ *
+ * Las variantes fsiv_xxx_into() guardan aquí sus imágenes intermedias de
+ * forma que, si se llama de nuevo con imágenes del mismo tamaño y tipo
+ * (p.e. en un bucle de vídeo), no se vuelve a reservar memoria.
+ */
+struct FsivChromaKeyWorkspace
+{
+    cv::Mat hue;   /*< canal H del primer plano.*/
+    cv::Mat backg; /*< fondo redimensionado al tamaño del primer plano.*/
+
+    // Clasificador por tabla (ver fsiv_compute_chroma_key_mask_lut_into).
+    std::vector<uchar> key_table; /*< 2^24 bits, uno por color BGR de 8 bits.*/
+    FsivChromaKeySpec key_spec;   /*< clave con la que se construyó key_table.*/
+
+    // Mate suave con S/V limitados (ver fsiv_apply_chroma_key_soft_into).
+    std::vector<uchar> sv_table; /*< 2^24 bits: S y V del color dentro de los límites.*/
+    cv::Vec4i sv_bounds;         /*< límites (smin, smax, vmin, vmax) de sv_table.*/
+
+    // Refinado en banda estrecha (ver fsiv_refine_chroma_key_band_into).
+    cv::Mat key_mask;     /*< máscara de la clave (255 en el fondo).*/
+    FsivNarrowBand band;  /*< banda del borde de key_mask.*/
+    cv::Mat in_band;      /*< 1 en los píxeles de la banda; 0 fuera (se deja a 0).*/
+    cv::Mat band_eroded;  /*< erosión del alfa (sólo en la banda).*/
+    cv::Mat band_opened;  /*< opening del alfa (sólo en la banda).*/
+    cv::Mat band_alpha;   /*< alfa refinado (sólo en la banda).*/
+};
+
+/** @brief Lado en píxeles de los bloques de fsiv_apply_chroma_key_incremental_into. */
+const int FSIV_TEMPORAL_BLOCK = 16;
+
+/**
+ * @brief Estado de la combinación incremental entre frames de vídeo.
+ *
+ * Guarda la última composición y el primer plano con el que se compuso cada
+ * bloque. Se crea vacío; la primera llamada compone el frame completo.
+ */
+struct FsivTemporalKeyState
+{
+    int refresh_period = 30; /*< cada cuántos frames se recompone todo (0: nunca).*/
+    double tolerance = 0.0;  /*< diferencia media absoluta por canal admitida en un bloque sin recomponerlo.*/
+
+    cv::Mat ref;  /*< primer plano con el que se compuso cada bloque.*/
+    cv::Mat out;  /*< última composición.*/
+    cv::Mat mask; /*< última máscara 255 (primer plano) / 0 (fondo).*/
+    cv::Mat bg;   /*< fondo con el que se compuso.*/
+    FsivChromaKeySpec spec; /*< clave con la que se compuso.*/
+    std::vector<uchar> changed; /*< 1 por bloque a recomponer en el frame actual.*/
+    int frames_since_refresh = 0;
+
+    size_t changed_blocks = 0; /*< bloques recompuestos en el último frame.*/
+    size_t total_blocks = 0;   /*< bloques por frame.*/
+};
 
 /**
  * @brief Realiza una combinación "hard" entre dos imágenes usando una máscara.
@@ -20,6 +151,32 @@ cv::Mat fsiv_convert_bgr_to_hsv(const cv::Mat &img);
 cv::Mat fsiv_combine_images(const cv::Mat &foreground, const cv::Mat &background,
                             const cv::Mat &mask);
 
+/**
+ * @brief Igual que fsiv_combine_images pero escribiendo en output.
+ * @param foreground la primera imagen.
+ * @param background la segunda imagen.
+ * @param mask la máscara 0 (background) / 255 (foreground).
+ * @param output imagen resultante.
+ * @warning output no puede compartir datos con foreground.
+ */
+void fsiv_combine_images_into(const cv::Mat &foreground, const cv::Mat &background,
+                              const cv::Mat &mask, cv::Mat &output);
+
+/**
+ * @brief Combinación "soft": output = foreground * alpha + background * (1 - alpha).
+ *
+ * alpha está en [0,255] (255: foreground) y la mezcla se hace con
+ * aritmética entera de 16 bits y SIMD, redondeando al entero más cercano.
+ * Con alpha 0/255 da lo mismo que fsiv_combine_images_into.
+ *
+ * @param foreground la primera imagen (CV_8UC3).
+ * @param background la segunda imagen (CV_8UC3).
+ * @param alpha peso de foreground en cada píxel (CV_8UC1).
+ * @param output imagen resultante.
+ */
+void fsiv_blend_images_into(const cv::Mat &foreground, const cv::Mat &background,
+                            const cv::Mat &alpha, cv::Mat &output);
+
 /**
  * @brief Crea una máscara activando los píxeles que están dentro de un rango de tonos.
  * El rango de tonos se define en el espacio HSV con H en el
@@ -33,6 +190,61 @@ cv::Mat fsiv_compute_chroma_key_mask(const cv::Mat &bgr_img,
                                      int chroma_key,
                                      int sensitivity);
 
+/**
+ * @brief Igual que fsiv_compute_chroma_key_mask pero escribiendo en mask.
+ * @param bgr_img es la imagen de entrada (BGR 8bits.).
+ * @param chroma_key es el valor del tono (hue) a utilizar como color clave.
+ * @param sensitivity amplía el rango de tonos (hue +- sensitivity).
+ * @param mask la máscara (0/255).
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ */
+void fsiv_compute_chroma_key_mask_into(const cv::Mat &bgr_img,
+                                       int chroma_key,
+                                       int sensitivity,
+                                       cv::Mat &mask,
+                                       FsivChromaKeyWorkspace *ws = nullptr);
+
+/**
+ * @brief Igual que fsiv_compute_chroma_key_mask_into pero con una tabla de
+ * colores.
+ *
+ * (chroma_key, sensitivity) se compila en una tabla de 2^24 bits (2 MB) que
+ * dice si cada color BGR está dentro del rango de tonos (sin dar la vuelta
+ * por 180, como cv::inRange; ver fsiv_chroma_key_spec para eso). La máscara es
+ * entonces una única pasada de consultas a la tabla sobre la imagen
+ * entrelazada, sin calcular H. La tabla se guarda en ws y sólo se
+ * reconstruye si cambian chroma_key o sensitivity. Da la misma máscara que
+ * fsiv_compute_chroma_key_mask_into.
+ *
+ * @param bgr_img es la imagen de entrada (BGR 8bits.).
+ * @param chroma_key es el valor del tono (hue) a utilizar como color clave.
+ * @param sensitivity amplía el rango de tonos (hue +- sensitivity).
+ * @param mask la máscara (0/255).
+ * @param ws espacio de trabajo con la tabla.
+ */
+void fsiv_compute_chroma_key_mask_lut_into(const cv::Mat &bgr_img,
+                                           int chroma_key,
+                                           int sensitivity,
+                                           cv::Mat &mask,
+                                           FsivChromaKeyWorkspace &ws);
+
+/**
+ * @brief Máscara de una clave con varios intervalos de tono y límites de S/V.
+ *
+ * Igual que fsiv_compute_chroma_key_mask_lut_into: la clave se compila en
+ * la tabla de colores de ws (sólo si cambia) y la máscara es una pasada de
+ * consultas, tenga los intervalos que tenga.
+ *
+ * @param bgr_img es la imagen de entrada (BGR 8bits.).
+ * @param spec colores que forman el fondo.
+ * @param mask la máscara (255 en el fondo).
+ * @param ws espacio de trabajo con la tabla.
+ */
+void fsiv_compute_chroma_key_mask_into(const cv::Mat &bgr_img,
+                                       const FsivChromaKeySpec &spec,
+                                       cv::Mat &mask,
+                                       FsivChromaKeyWorkspace &ws);
+
 /**
  * @brief Sustituye en fondo de una imagen por otra usando un color clave.
  * @param foreg imagen que representa el primer plano.
@@ -44,3 +256,205 @@ cv::Mat fsiv_compute_chroma_key_mask(const cv::Mat &bgr_img,
  */
 cv::Mat fsiv_apply_chroma_key(const cv::Mat &foreg, const cv::Mat &backg, int hue,
                               int sensitivity, cv::Mat *mask_out = nullptr);
+
+/**
+ * @brief Igual que fsiv_apply_chroma_key pero escribiendo en out.
+ *
+ * Clasifica y compone en una sola pasada SIMD por filas: cada píxel de out
+ * se toma del primer plano o del fondo según su color, sin máscara ni copia
+ * del fondo a tamaño completo. El fondo redimensionado y la tabla de colores
+ * de fsiv_compute_chroma_key_mask_lut_into se guardan en ws; sin ws se
+ * clasifica con el canal H, ya que la tabla no se amortizaría. Si hay que
+ * redimensionar el fondo se hace en cada llamada; para evitarlo, ver la
+ * versión con BackgroundCache.
+ *
+ * @param foreg imagen que representa el primer plano.
+ * @param backg imagen que representa el fondo con el que rellenar.
+ * @param hue tono del color usado como color clave.
+ * @param sensitivity permite ampliar el rango de tono con hue +- sensitivity.
+ * @param out la imagen con la composición.
+ * @param mask_out si no es nulo, se escribe en *mask_out la máscara 255
+ *        (primer plano) / 0 (fondo). Si es nulo no se genera.
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ */
+void fsiv_apply_chroma_key_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                int hue, int sensitivity, cv::Mat &out,
+                                cv::Mat *mask_out = nullptr,
+                                FsivChromaKeyWorkspace *ws = nullptr);
+
+/**
+ * @brief Igual que fsiv_apply_chroma_key_into pero con un fondo en caché.
+ *
+ * Si el tamaño de foreg no coincide con el del fondo, el fondo
+ * redimensionado se toma de backg, que sólo llama a cv::resize la primera
+ * vez para cada tamaño e interpolación.
+ *
+ * @param foreg imagen que representa el primer plano.
+ * @param backg fondo con sus versiones redimensionadas.
+ * @param hue tono del color usado como color clave.
+ * @param sensitivity permite ampliar el rango de tono con hue +- sensitivity.
+ * @param out la imagen con la composición.
+ * @param mask_out si no es nulo, se escribe en *mask_out la máscara 255
+ *        (primer plano) / 0 (fondo).
+ * @param ws espacio de trabajo. Si es nulo se usa uno temporal.
+ * @param interpolation interpolación al redimensionar el fondo.
+ */
+void fsiv_apply_chroma_key_into(const cv::Mat &foreg, BackgroundCache &backg,
+                                int hue, int sensitivity, cv::Mat &out,
+                                cv::Mat *mask_out = nullptr,
+                                FsivChromaKeyWorkspace *ws = nullptr,
+                                int interpolation = cv::INTER_LINEAR);
+
+/**
+ * @brief Igual que fsiv_apply_chroma_key_into con BackgroundCache pero con
+ * una clave de varios intervalos (ver FsivChromaKeySpec).
+ *
+ * @param foreg imagen que representa el primer plano.
+ * @param backg fondo con sus versiones redimensionadas.
+ * @param spec colores que forman el fondo.
+ * @param out la imagen con la composición.
+ * @param mask_out si no es nulo, se escribe en *mask_out la máscara 255
+ *        (primer plano) / 0 (fondo).
+ * @param ws espacio de trabajo con la tabla de la clave.
+ * @param interpolation interpolación al redimensionar el fondo.
+ */
+void fsiv_apply_chroma_key_into(const cv::Mat &foreg, BackgroundCache &backg,
+                                const FsivChromaKeySpec &spec, cv::Mat &out,
+                                cv::Mat *mask_out, FsivChromaKeyWorkspace &ws,
+                                int interpolation = cv::INTER_LINEAR);
+
+/**
+ * @brief Igual que fsiv_apply_chroma_key_into con FsivChromaKeySpec pero con
+ * un fondo que no se guarda en caché (p.e. un frame de un vídeo de fondo).
+ *
+ * Si el tamaño de backg no coincide con el de foreg se redimensiona en
+ * ws.backg en cada llamada.
+ *
+ * @param foreg imagen que representa el primer plano.
+ * @param backg imagen que representa el fondo con el que rellenar.
+ * @param spec colores que forman el fondo.
+ * @param out la imagen con la composición.
+ * @param mask_out si no es nulo, se escribe en *mask_out la máscara 255
+ *        (primer plano) / 0 (fondo).
+ * @param ws espacio de trabajo con la tabla de la clave.
+ */
+void fsiv_apply_chroma_key_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                const FsivChromaKeySpec &spec, cv::Mat &out,
+                                cv::Mat *mask_out, FsivChromaKeyWorkspace &ws);
+
+/**
+ * @brief Igual que fsiv_apply_chroma_key_into con FsivChromaKeySpec pero
+ * recomponiendo sólo lo que cambia entre frames consecutivos.
+ *
+ * El frame se divide en bloques de FSIV_TEMPORAL_BLOCK x FSIV_TEMPORAL_BLOCK
+ * y cada uno se compara (SAD) con el primer plano con el que se compuso por
+ * última vez. Sólo se clasifican y componen los bloques cuya diferencia media
+ * por canal supera state.tolerance; el resto conserva la salida anterior. Con
+ * tolerance = 0 el resultado es idéntico al de la versión sin estado. Se
+ * recompone todo en el primer frame, cada state.refresh_period frames y
+ * cuando cambian el tamaño, la clave o el fondo.
+ *
+ * @param foreg imagen que representa el primer plano.
+ * @param backg fondo con sus versiones redimensionadas.
+ * @param spec colores que forman el fondo.
+ * @param out la imagen con la composición. Comparte datos con state.out, así
+ *        que no se debe modificar y se sobrescribe en la siguiente llamada.
+ * @param mask_out si no es nulo, se le asigna la máscara 255 (primer plano) /
+ *        0 (fondo), que comparte datos con state.mask.
+ * @param ws espacio de trabajo con la tabla de la clave.
+ * @param state estado entre frames. state.changed_blocks y
+ *        state.total_blocks dicen cuánto se ha recompuesto.
+ * @param interpolation interpolación al redimensionar el fondo.
+ */
+void fsiv_apply_chroma_key_incremental_into(const cv::Mat &foreg, BackgroundCache &backg,
+                                            const FsivChromaKeySpec &spec, cv::Mat &out,
+                                            cv::Mat *mask_out, FsivChromaKeyWorkspace &ws,
+                                            FsivTemporalKeyState &state,
+                                            int interpolation = cv::INTER_LINEAR);
+
+/**
+ * @brief Sustituye el fondo con un mate suave en lugar de una máscara 0/255.
+ *
+ * El alfa de cada píxel sale de la distancia circular de su tono al
+ * intervalo de spec más cercano: 0 (fondo) dentro, y creciendo linealmente
+ * hasta 255 (primer plano) a falloff tonos de distancia. Los colores con S o
+ * V fuera de los límites de spec son primer plano. El cálculo del alfa va en
+ * la misma pasada por filas que la mezcla (ver fsiv_blend_images_into), así
+ * que no hay máscara intermedia. Con falloff = 0 da lo mismo que
+ * fsiv_apply_chroma_key_into con spec.
+ *
+ * @param foreg imagen que representa el primer plano.
+ * @param backg fondo con sus versiones redimensionadas.
+ * @param spec colores que forman el fondo.
+ * @param falloff anchura, en tonos, de la banda de transición (>= 0).
+ * @param out la imagen con la composición.
+ * @param alpha_out si no es nulo, se escribe en *alpha_out el alfa (255:
+ *        primer plano).
+ * @param ws espacio de trabajo (tabla de S/V si spec los limita).
+ * @param interpolation interpolación al redimensionar el fondo.
+ */
+void fsiv_apply_chroma_key_soft_into(const cv::Mat &foreg, BackgroundCache &backg,
+                                     const FsivChromaKeySpec &spec, int falloff,
+                                     cv::Mat &out, cv::Mat *alpha_out,
+                                     FsivChromaKeyWorkspace &ws,
+                                     int interpolation = cv::INTER_LINEAR);
+
+/**
+ * @brief Igual que fsiv_apply_chroma_key_soft_into pero con un fondo sin
+ * caché (se redimensiona en ws.backg si hace falta).
+ */
+void fsiv_apply_chroma_key_soft_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                     const FsivChromaKeySpec &spec, int falloff,
+                                     cv::Mat &out, cv::Mat *alpha_out,
+                                     FsivChromaKeyWorkspace &ws);
+
+/**
+ * @brief Calcula en una pasada la banda de los píxeles a distancia
+ * (Chebyshev) radius o menos de un borde de la máscara.
+ *
+ * Un píxel es de borde si es distinto de alguno de sus cuatro vecinos. Las
+ * filas se recorren una vez: se cuentan los bordes de cada columna en una
+ * ventana de 2*radius+1 filas y los tramos salen de dilatar horizontalmente
+ * esas cuentas. Fuera de la banda la máscara es constante en un entorno de
+ * radio radius.
+ *
+ * @param mask máscara CV_8UC1 (p.e. de fsiv_compute_chroma_key_mask).
+ * @param radius anchura de la banda a cada lado del borde (>= 0).
+ * @param band la banda como lista de tramos.
+ */
+void fsiv_find_narrow_band(const cv::Mat &mask, int radius, FsivNarrowBand &band);
+
+/**
+ * @brief Compone con una máscara dura refinando sólo el borde.
+ *
+ * Busca la banda del borde de mask (fsiv_find_narrow_band) con la anchura
+ * justa para que el resultado sea el mismo que aplicar el opening y la
+ * media a toda la imagen, y sólo dentro de ella hace el opening, la media y
+ * el despill y mezcla con alfa. El resto de píxeles, normalmente la
+ * inmensa mayoría, se copian del primer plano o del fondo sin más.
+ *
+ * @param foreg imagen que representa el primer plano (CV_8UC3).
+ * @param backg fondo (se redimensiona en ws.backg si hace falta).
+ * @param mask máscara 255 (fondo) / 0 (primer plano), como la de
+ *        fsiv_compute_chroma_key_mask.
+ * @param params retoques del borde.
+ * @param out la imagen con la composición.
+ * @param alpha_out si no es nulo, se escribe en *alpha_out el alfa (255:
+ *        primer plano).
+ * @param ws espacio de trabajo.
+ */
+void fsiv_refine_chroma_key_band_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                      const cv::Mat &mask,
+                                      const FsivBandRefineParams &params,
+                                      cv::Mat &out, cv::Mat *alpha_out,
+                                      FsivChromaKeyWorkspace &ws);
+
+/**
+ * @brief fsiv_compute_chroma_key_mask_into (en ws.key_mask) seguido de
+ * fsiv_refine_chroma_key_band_into.
+ */
+void fsiv_apply_chroma_key_refined_into(const cv::Mat &foreg, const cv::Mat &backg,
+                                        const FsivChromaKeySpec &spec,
+                                        const FsivBandRefineParams &params,
+                                        cv::Mat &out, cv::Mat *alpha_out,
+                                        FsivChromaKeyWorkspace &ws);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Cola acotada sin cerrojos para un único productor y un único
+ * consumidor.
+ *
+ * Un anillo de capacity + 1 huecos con dos índices atómicos: sólo el
+ * productor escribe tail_ y sólo el consumidor escribe head_, así que basta
+ * con acquire/release. Ninguna operación bloquea; si la cola está llena o
+ * vacía se devuelve false y el hilo decide cómo esperar.
+ *
+ * @tparam T tipo de los elementos (se mueven, no se copian).
+ */
+template <class T>
+class SpscQueue
+{
+public:
+    /**
+     * @param capacity número máximo de elementos en la cola (> 0).
+     */
+    explicit SpscQueue(size_t capacity)
+        : slots_(capacity + 1), head_(0), tail_(0)
+    {
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /**
+     * @brief Añade item al final. Sólo desde el hilo productor.
+     * @return false si la cola está llena (item no se toca).
+     */
+    bool try_push(T &item)
+    {
+        const size_t t = tail_.load(std::memory_order_relaxed);
+        const size_t next = (t + 1) % slots_.size();
+        if (next == head_.load(std::memory_order_acquire))
+            return false;
+        slots_[t] = std::move(item);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Saca el primer elemento. Sólo desde el hilo consumidor.
+     * @return false si la cola está vacía.
+     */
+    bool try_pop(T &item)
+    {
+        const size_t h = head_.load(std::memory_order_relaxed);
+        if (h == tail_.load(std::memory_order_acquire))
+            return false;
+        item = std::move(slots_[h]);
+        head_.store((h + 1) % slots_.size(), std::memory_order_release);
+        return true;
+    }
+
+    /** @brief Número máximo de elementos. */
+    size_t capacity() const { return slots_.size() - 1; }
+
+private:
+    std::vector<T> slots_;
+    std::atomic<size_t> head_;
+    // Separa los índices en líneas de caché distintas para que productor y
+    // consumidor no se invaliden mutuamente (sin alignas, que en C++11 no
+    // se respeta con new).
+    char pad_[64];
+    std::atomic<size_t> tail_;
+};
+
+/**
+ * @brief Espera a una cola: primero cede la CPU y, si la espera se alarga,
+ * duerme en intervalos cortos para no ocupar un núcleo.
+ * @param spins intentos fallidos seguidos (empezar en 0).
+ */
+inline void
+spsc_backoff(int &spins)
+{
+    if (++spins < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
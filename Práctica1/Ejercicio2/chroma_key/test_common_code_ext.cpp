@@ -0,0 +1,876 @@
+/*!
+  Tests de las extensiones de common_code que no cubre test_common_code.
+
+  Cada test compara la versión rápida de una función con la versión de
+  referencia sobre imágenes sintéticas, por lo que no depende de ficheros.
+
+  Uso: test_common_code_ext <nombre_del_test>
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <set>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "common_code.hpp"
+#include "video_pipeline.hpp"
+#include "video_encoder.hpp"
+#include "background_video.hpp"
+
+static cv::Mat
+make_test_image(int type, cv::Size size = cv::Size(97, 61))
+{
+    cv::Mat img(size, type);
+    cv::theRNG() = cv::RNG(0x5EED);
+    cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(256));
+    return img;
+}
+
+/**
+ * @brief Comprueba que dos imágenes son iguales salvo una tolerancia.
+ */
+static bool
+check_equal(const std::string &what, const cv::Mat &result,
+            const cv::Mat &expected, double tolerance = 0.0)
+{
+    if (result.size() != expected.size() || result.type() != expected.type())
+    {
+        std::cerr << what << ": wrong size or type." << std::endl;
+        return false;
+    }
+    const double err = cv::norm(result, expected, cv::NORM_INF);
+    if (err > tolerance)
+    {
+        std::cerr << what << ": max. error " << err << " > " << tolerance
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool
+test_into_variants()
+{
+    bool ok = true;
+    const cv::Mat fg = make_test_image(CV_8UC3);
+    const cv::Mat bg = make_test_image(CV_8UC3, cv::Size(50, 40));
+    FsivChromaKeyWorkspace ws;
+    cv::Mat out, mask;
+
+    fsiv_convert_bgr_to_hsv_into(fg, out);
+    ok &= check_equal("bgr_to_hsv", out, fsiv_convert_bgr_to_hsv(fg));
+    fsiv_compute_chroma_key_mask_into(fg, 60, 20, mask, &ws);
+    ok &= check_equal("mask", mask, fsiv_compute_chroma_key_mask(fg, 60, 20));
+    const cv::Mat bg2(fg.size(), CV_8UC3, cv::Scalar(255, 0, 0));
+    fsiv_combine_images_into(fg, bg2, mask, out);
+    ok &= check_equal("combine", out, fsiv_combine_images(fg, bg2, mask));
+
+    cv::Mat expected_mask;
+    const cv::Mat expected = fsiv_apply_chroma_key(fg, bg, 60, 20, &expected_mask);
+    fsiv_apply_chroma_key_into(fg, bg, 60, 20, out, &mask, &ws);
+    ok &= check_equal("apply", out, expected);
+    ok &= check_equal("apply mask", mask, expected_mask);
+    const uchar *data = out.data;
+    fsiv_apply_chroma_key_into(fg, bg, 90, 10, out, nullptr, &ws);
+    ok &= check_equal("apply no mask", out, fsiv_apply_chroma_key(fg, bg, 90, 10));
+    if (out.data != data)
+    {
+        std::cerr << "apply: the output buffer was reallocated." << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * @brief Imagen 4096x4096 con todos los colores BGR de 8 bits, el color
+ * (b << 16) | (g << 8) | r en la posición y * 4096 + x.
+ */
+static cv::Mat
+make_all_colors_image()
+{
+    cv::Mat all(4096, 4096, CV_8UC3);
+    for (int y = 0; y < all.rows; ++y)
+    {
+        cv::Vec3b *row = all.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < all.cols; ++x)
+        {
+            const int c = y * all.cols + x;
+            row[x] = cv::Vec3b(uchar(c >> 16), uchar(c >> 8), uchar(c));
+        }
+    }
+    return all;
+}
+
+static bool
+test_hue_kernel()
+{
+    // Todos los colores BGR de 8 bits: el canal H debe ser idéntico al de
+    // cvtColor.
+    const cv::Mat all = make_all_colors_image();
+    cv::Mat hsv, hue;
+    std::vector<cv::Mat> planes;
+    cv::cvtColor(all, hsv, cv::COLOR_BGR2HSV);
+    cv::split(hsv, planes);
+    fsiv_convert_bgr_to_hue_into(all, hue);
+    bool ok = check_equal("bgr_to_hue", hue, planes[0], 0.0);
+    // Y con filas que no son múltiplo del ancho SIMD.
+    const cv::Mat odd = make_test_image(CV_8UC3);
+    cv::cvtColor(odd, hsv, cv::COLOR_BGR2HSV);
+    cv::split(hsv, planes);
+    fsiv_convert_bgr_to_hue_into(odd, hue);
+    ok &= check_equal("bgr_to_hue (97 cols)", hue, planes[0], 0.0);
+    return ok;
+}
+
+static bool
+test_chroma_key_lut()
+{
+    // La tabla debe dar la misma máscara que el canal H para todos los
+    // colores, y reconstruirse sólo al cambiar la clave.
+    bool ok = true;
+    const cv::Mat all = make_all_colors_image();
+    FsivChromaKeyWorkspace ws, hue_ws;
+    cv::Mat expected, mask;
+    const int keys[][2] = {{60, 20}, {60, 20}, {120, 0}, {0, 15}, {170, 30}};
+    for (const auto &k : keys)
+    {
+        const std::string what = "mask_lut (" + std::to_string(k[0]) + "," +
+                                 std::to_string(k[1]) + ")";
+        const uchar *table = ws.key_table.data();
+        fsiv_compute_chroma_key_mask_into(all, k[0], k[1], expected, &hue_ws);
+        fsiv_compute_chroma_key_mask_lut_into(all, k[0], k[1], mask, ws);
+        ok &= check_equal(what, mask, expected, 0.0);
+        if (ws.key_spec.hue_ranges != std::vector<cv::Vec2i>{cv::Vec2i(k[0] - k[1], k[0] + k[1])})
+        {
+            std::cerr << what << ": wrong table parameters." << std::endl;
+            ok = false;
+        }
+        if (&k != &keys[0] && ws.key_table.data() != table)
+        {
+            std::cerr << what << ": the table was reallocated." << std::endl;
+            ok = false;
+        }
+    }
+    // Filas que no son múltiplo del ancho SIMD.
+    const cv::Mat odd = make_test_image(CV_8UC3);
+    fsiv_compute_chroma_key_mask_into(odd, 90, 40, expected, &hue_ws);
+    fsiv_compute_chroma_key_mask_lut_into(odd, 90, 40, mask, ws);
+    ok &= check_equal("mask_lut (97 cols)", mask, expected, 0.0);
+    return ok;
+}
+
+static bool
+test_fused_chroma_key()
+{
+    // La composición en una pasada debe coincidir con máscara + bitwise_not
+    // + fsiv_combine_images, con tabla (ws) y con el canal H (sin ws).
+    bool ok = true;
+    const cv::Mat fg = make_test_image(CV_8UC3);
+    const cv::Mat bg = make_test_image(CV_8UC3, cv::Size(50, 40));
+    cv::Mat bg_resized, mask, expected, out;
+    cv::resize(bg, bg_resized, fg.size(), 0, 0, cv::INTER_LINEAR);
+    const int keys[][2] = {{60, 20}, {0, 10}, {175, 20}, {90, 0}, {-30, 10}};
+    for (const auto &k : keys)
+    {
+        const std::string what = "fused (" + std::to_string(k[0]) + "," +
+                                 std::to_string(k[1]) + ")";
+        fsiv_compute_chroma_key_mask_into(fg, k[0], k[1], mask);
+        cv::bitwise_not(mask, mask);
+        fsiv_combine_images_into(fg, bg_resized, mask, expected);
+
+        FsivChromaKeyWorkspace ws;
+        cv::Mat out_mask;
+        fsiv_apply_chroma_key_into(fg, bg, k[0], k[1], out, &out_mask, &ws);
+        ok &= check_equal(what + " table", out, expected, 0.0);
+        ok &= check_equal(what + " table mask", out_mask, mask, 0.0);
+        fsiv_apply_chroma_key_into(fg, bg, k[0], k[1], out, &out_mask);
+        ok &= check_equal(what + " hue", out, expected, 0.0);
+        ok &= check_equal(what + " hue mask", out_mask, mask, 0.0);
+        fsiv_apply_chroma_key_into(fg, bg, k[0], k[1], out, nullptr, &ws);
+        ok &= check_equal(what + " no mask", out, expected, 0.0);
+    }
+    return ok;
+}
+
+static bool
+test_background_cache()
+{
+    bool ok = true;
+    const cv::Mat fg = make_test_image(CV_8UC3);
+    const cv::Mat bg = make_test_image(CV_8UC3, cv::Size(50, 40));
+    BackgroundCache cache(bg, 2);
+    cv::Mat expected;
+
+    // Cada tamaño e interpolación se redimensiona una sola vez.
+    cv::resize(bg, expected, fg.size(), 0, 0, cv::INTER_LINEAR);
+    ok &= check_equal("resized", cache.resized(fg.size()), expected);
+    ok &= check_equal("resized (hit)", cache.resized(fg.size()), expected);
+    cv::resize(bg, expected, fg.size(), 0, 0, cv::INTER_NEAREST);
+    ok &= check_equal("resized nearest", cache.resized(fg.size(), cv::INTER_NEAREST), expected);
+    ok &= cache.resized(bg.size()).data == bg.data;
+    if (cache.resizes() != 2)
+    {
+        std::cerr << "cache: " << cache.resizes() << " resizes, expected 2." << std::endl;
+        ok = false;
+    }
+    // Con dos entradas como máximo, un tercer tamaño descarta la más antigua
+    // (la lineal se usó antes que la nearest).
+    cache.resized(cv::Size(10, 10));
+    cache.resized(fg.size(), cv::INTER_NEAREST);
+    cache.resized(fg.size());
+    ok &= cache.resizes() == 4;
+
+    // La composición con la caché es la misma que con el cv::Mat.
+    FsivChromaKeyWorkspace ws;
+    cv::Mat out, mask;
+    fsiv_apply_chroma_key_into(fg, cache, 60, 20, out, &mask, &ws);
+    ok &= check_equal("apply cache", out, fsiv_apply_chroma_key(fg, bg, 60, 20));
+    const size_t resizes = cache.resizes();
+    fsiv_apply_chroma_key_into(fg, cache, 60, 20, out, nullptr, &ws);
+    ok &= cache.resizes() == resizes;
+
+    // Cambiar el origen vacía la caché.
+    const cv::Mat bg2(bg.size(), CV_8UC3, cv::Scalar(255, 0, 0));
+    cache.set_source(bg2);
+    fsiv_apply_chroma_key_into(fg, cache, 60, 20, out);
+    ok &= check_equal("apply new source", out, fsiv_apply_chroma_key(fg, bg2, 60, 20));
+    ok &= cache.resizes() == resizes + 1;
+    return ok;
+}
+
+/**
+ * @brief Máscara de referencia de spec con cvtColor + un inRange por
+ * intervalo (dos si da la vuelta).
+ */
+static cv::Mat
+reference_spec_mask(const cv::Mat &bgr, const FsivChromaKeySpec &spec)
+{
+    cv::Mat hsv, part;
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    cv::Mat mask = cv::Mat::zeros(bgr.size(), CV_8UC1);
+    const cv::Vec2i &s = spec.s_range, &v = spec.v_range;
+    for (const cv::Vec2i &r : spec.hue_ranges)
+    {
+        const cv::Vec2i parts[2] = {r[0] <= r[1] ? r : cv::Vec2i(r[0], 255),
+                                    r[0] <= r[1] ? cv::Vec2i(1, 0) : cv::Vec2i(0, r[1])};
+        for (const cv::Vec2i &h : parts)
+        {
+            cv::inRange(hsv, cv::Scalar(h[0], s[0], v[0]), cv::Scalar(h[1], s[1], v[1]), part);
+            cv::bitwise_or(mask, part, mask);
+        }
+    }
+    return mask;
+}
+
+static bool
+test_chroma_key_spec()
+{
+    bool ok = true;
+    // Intervalos que dan la vuelta por 180.
+    const std::vector<cv::Vec2i> red = {cv::Vec2i(165, 5)};
+    ok &= fsiv_chroma_key_spec(175, 10).hue_ranges == red;
+    ok &= fsiv_chroma_key_spec(-5, 10).hue_ranges == std::vector<cv::Vec2i>{cv::Vec2i(165, 5)};
+    ok &= fsiv_chroma_key_spec(5, 10).hue_ranges == std::vector<cv::Vec2i>{cv::Vec2i(175, 15)};
+    ok &= fsiv_chroma_key_spec(60, 20).hue_ranges == std::vector<cv::Vec2i>{cv::Vec2i(40, 80)};
+    ok &= fsiv_chroma_key_spec(60, 90).hue_ranges == std::vector<cv::Vec2i>{cv::Vec2i(0, 179)};
+    if (!ok)
+        std::cerr << "fsiv_chroma_key_spec: wrong ranges." << std::endl;
+
+    // Todos los colores contra cvtColor + inRange por intervalo.
+    const cv::Mat all = make_all_colors_image();
+    FsivChromaKeyWorkspace ws;
+    cv::Mat mask;
+    FsivChromaKeySpec spec = fsiv_chroma_key_spec(175, 10);
+    fsiv_compute_chroma_key_mask_into(all, spec, mask, ws);
+    ok &= check_equal("spec red", mask, reference_spec_mask(all, spec), 0.0);
+
+    spec.hue_ranges = {cv::Vec2i(20, 30), cv::Vec2i(100, 110), cv::Vec2i(170, 10)};
+    spec.s_range = cv::Vec2i(50, 255);
+    spec.v_range = cv::Vec2i(30, 200);
+    fsiv_compute_chroma_key_mask_into(all, spec, mask, ws);
+    ok &= check_equal("spec 3 ranges + S/V", mask, reference_spec_mask(all, spec), 0.0);
+
+    // Composición: fondo donde la máscara es 255.
+    const cv::Mat fg = make_test_image(CV_8UC3);
+    const cv::Mat bg = make_test_image(CV_8UC3, cv::Size(50, 40));
+    BackgroundCache cache(bg);
+    cv::Mat out, keep, expected;
+    fsiv_apply_chroma_key_into(fg, cache, spec, out, &keep, ws);
+    cv::bitwise_not(reference_spec_mask(fg, spec), mask);
+    ok &= check_equal("apply spec mask", keep, mask, 0.0);
+    fsiv_combine_images_into(fg, cache.resized(fg.size()), mask, expected);
+    ok &= check_equal("apply spec", out, expected, 0.0);
+    return ok;
+}
+
+static bool
+test_temporal_chroma_key()
+{
+    bool ok = true;
+    // Tamaño que no es múltiplo del bloque.
+    cv::Mat fg = make_test_image(CV_8UC3, cv::Size(100, 70));
+    const cv::Mat bg = make_test_image(CV_8UC3, cv::Size(50, 40));
+    BackgroundCache cache(bg);
+    FsivChromaKeySpec spec = fsiv_chroma_key_spec(60, 40);
+    FsivChromaKeyWorkspace ws, ref_ws;
+    FsivTemporalKeyState state;
+    state.refresh_period = 4;
+    cv::Mat out, mask, expected, expected_mask;
+    const size_t blocks = 7 * 5;
+
+    // El primer frame se compone entero.
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    fsiv_apply_chroma_key_into(fg, cache, spec, expected, &expected_mask, ref_ws);
+    ok &= check_equal("first frame", out, expected);
+    ok &= check_equal("first frame mask", mask, expected_mask);
+    ok &= state.total_blocks == blocks && state.changed_blocks == blocks;
+
+    // Sin cambios no se recompone nada.
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    ok &= state.changed_blocks == 0;
+    ok &= check_equal("static frame", out, expected);
+
+    // Un rectángulo que toca cuatro bloques.
+    fg(cv::Rect(10, 10, 10, 10)).setTo(cv::Scalar(0, 255, 0));
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    fsiv_apply_chroma_key_into(fg, cache, spec, expected, &expected_mask, ref_ws);
+    ok &= state.changed_blocks == 4;
+    ok &= check_equal("changed blocks", out, expected);
+    ok &= check_equal("changed blocks mask", mask, expected_mask);
+
+    // Cada refresh_period frames se recompone todo.
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    ok &= state.changed_blocks == 0;
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    ok &= state.changed_blocks == blocks;
+
+    // Un cambio por debajo de la tolerancia no recompone el bloque.
+    state.tolerance = 1.0;
+    fg.at<cv::Vec3b>(50, 90)[1] ^= 1;
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    ok &= state.changed_blocks == 0;
+    state.tolerance = 0.0;
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    ok &= state.changed_blocks == 1;
+
+    // Cambiar la clave o el fondo recompone todo.
+    spec = fsiv_chroma_key_spec(120, 30);
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    fsiv_apply_chroma_key_into(fg, cache, spec, expected, nullptr, ref_ws);
+    ok &= state.changed_blocks == blocks;
+    ok &= check_equal("new spec", out, expected);
+    cache.set_source(cv::Mat(bg.size(), CV_8UC3, cv::Scalar(255, 0, 0)));
+    fsiv_apply_chroma_key_incremental_into(fg, cache, spec, out, &mask, ws, state);
+    fsiv_apply_chroma_key_into(fg, cache, spec, expected, nullptr, ref_ws);
+    ok &= state.changed_blocks == blocks;
+    ok &= check_equal("new background", out, expected);
+    if (!ok)
+        std::cerr << "temporal: last frame " << state.changed_blocks << "/"
+                  << state.total_blocks << " blocks." << std::endl;
+    return ok;
+}
+
+static bool
+test_video_pipeline()
+{
+    bool ok = true;
+    // Cola: FIFO y acotada.
+    SpscQueue<int> q(2);
+    int a = 1, b = 2, c = 3, v = 0;
+    ok &= q.try_push(a) && q.try_push(b) && !q.try_push(c);
+    ok &= q.try_pop(v) && v == 1 && q.try_push(c);
+    ok &= q.try_pop(v) && v == 2 && q.try_pop(v) && v == 3 && !q.try_pop(v);
+    if (!ok)
+        std::cerr << "SpscQueue: wrong order or capacity." << std::endl;
+
+    // Pipeline: los frames salen en orden aunque los workers tarden tiempos
+    // distintos.
+    const int n_frames = 40;
+    int read = 1;
+    auto make_frame = [](int i) { return cv::Mat(4, 4, CV_8UC3, cv::Scalar::all(i)); };
+    PipelineFrame first;
+    first.foreg = make_frame(0);
+    VideoPipeline pipeline(first,
+                           [&](PipelineFrame &f)
+                           {
+                               if (read == n_frames)
+                                   return false;
+                               f.foreg = make_frame(read++);
+                               return true;
+                           },
+                           [](int w, PipelineFrame &f)
+                           {
+                               std::this_thread::sleep_for(
+                                   std::chrono::milliseconds((f.index * 7 + w) % 3));
+                               cv::bitwise_not(f.foreg, f.output);
+                           },
+                           3, 2);
+    PipelineFrame frame;
+    int popped = 0;
+    while (pipeline.pop(frame))
+    {
+        if (frame.index != popped ||
+            frame.output.at<cv::Vec3b>(0, 0)[0] != 255 - popped)
+        {
+            std::cerr << "pipeline: frame " << frame.index << " at position "
+                      << popped << "." << std::endl;
+            ok = false;
+        }
+        ++popped;
+    }
+    ok &= popped == n_frames;
+    ok &= !pipeline.pop(frame);
+    if (popped != n_frames)
+        std::cerr << "pipeline: " << popped << " frames, expected " << n_frames << "." << std::endl;
+
+    // Una excepción en una etapa llega a pop() en vez de terminar el programa.
+    for (int stage = 0; stage < 2; ++stage)
+    {
+        int n = 1;
+        VideoPipeline failing(first,
+                              [&](PipelineFrame &f)
+                              {
+                                  if (stage == 0 && n == 5)
+                                      throw std::runtime_error("read failed");
+                                  f.foreg = make_frame(n++);
+                                  return true;
+                              },
+                              [&](int, PipelineFrame &f)
+                              {
+                                  if (stage == 1 && f.index == 5)
+                                      throw std::runtime_error("key failed");
+                                  f.output = f.foreg;
+                              },
+                              2, 2);
+        bool thrown = false;
+        try
+        {
+            while (failing.pop(frame))
+                ;
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        if (!thrown)
+        {
+            std::cerr << "pipeline: exception in stage " << stage << " lost." << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool
+test_video_encoder()
+{
+    bool ok = true;
+    int fourcc = -1;
+    ok &= VideoEncoder::codec_fourcc("raw", fourcc) && fourcc == 0;
+    ok &= VideoEncoder::codec_fourcc("lossless", fourcc) &&
+          fourcc == cv::VideoWriter::fourcc('F', 'F', 'V', '1');
+    ok &= VideoEncoder::codec_fourcc("MJPG", fourcc) &&
+          fourcc == cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+    ok &= !VideoEncoder::codec_fourcc("mp4", fourcc);
+    if (!ok)
+        std::cerr << "codec_fourcc: wrong fourcc." << std::endl;
+
+    // MJPG en AVI lo escribe y lee OpenCV sin depender de FFmpeg.
+    const std::string filename = "test_video_encoder.avi";
+    const cv::Size size(64, 48);
+    const int n_frames = 12;
+    std::vector<cv::Mat> frames;
+    {
+        VideoEncoder encoder(filename, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 24.0,
+                             size, 2);
+        if (!encoder.is_opened())
+        {
+            std::cerr << "encoder: could not open " << filename << "." << std::endl;
+            return false;
+        }
+        for (int i = 0; i < n_frames; ++i)
+        {
+            frames.push_back(cv::Mat(size, CV_8UC3, cv::Scalar(20 * i, 128, 255 - 20 * i)));
+            encoder.write(frames.back());
+        }
+        encoder.close();
+        ok &= encoder.frames() == n_frames;
+    }
+    cv::VideoCapture capt(filename);
+    cv::Mat frame;
+    int read = 0;
+    while (capt.read(frame))
+    {
+        if (read < n_frames)
+            ok &= check_equal("encoded frame", frame, frames[read], 16.0);
+        ++read;
+    }
+    capt.release();
+    std::remove(filename.c_str());
+    if (read != n_frames)
+    {
+        std::cerr << "encoder: read " << read << " frames, expected " << n_frames << "."
+                  << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+static bool
+test_background_video()
+{
+    bool ok = true;
+    const std::string filename = "test_background_video.avi";
+    const int n_frames = 5;
+    std::vector<cv::Scalar> colors;
+    {
+        cv::VideoWriter writer(filename, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 24.0,
+                               cv::Size(32, 24));
+        if (!writer.isOpened())
+        {
+            std::cerr << "background video: could not write " << filename << "." << std::endl;
+            return false;
+        }
+        for (int i = 0; i < n_frames; ++i)
+        {
+            colors.push_back(cv::Scalar(40 * i, 200 - 40 * i, 128));
+            writer.write(cv::Mat(24, 32, CV_8UC3, colors.back()));
+        }
+    }
+
+    // next() espera al decodificador: el frame i del fondo es siempre el i.
+    const cv::Size size(64, 48);
+    {
+        // Con loop vuelve a empezar; con un pool de 3 buffers no se reserva
+        // memoria para cada frame.
+        BackgroundVideo bg(filename, size, true, 1, 3);
+        ok &= bg.is_opened();
+        std::set<const uchar *> buffers;
+        for (int i = 0; ok && i < 2 * n_frames + 2; ++i)
+        {
+            const cv::Mat frame = bg.next();
+            buffers.insert(frame.data);
+            ok &= check_equal("loop frame " + std::to_string(i), frame,
+                              cv::Mat(size, CV_8UC3, colors[i % n_frames]), 16.0);
+        }
+        if (buffers.size() > 3)
+        {
+            std::cerr << "background video: " << buffers.size() << " buffers." << std::endl;
+            ok = false;
+        }
+    }
+    {
+        // Sin loop se queda en el último frame.
+        BackgroundVideo bg(filename, size, false, 2, 4);
+        for (int i = 0; ok && i < n_frames + 3; ++i)
+            ok &= check_equal("hold frame " + std::to_string(i), bg.next(),
+                              cv::Mat(size, CV_8UC3, colors[std::min(i, n_frames - 1)]),
+                              16.0);
+    }
+    {
+        // Tras stop() next() no espera: repite el último frame.
+        BackgroundVideo bg(filename, size, true, 1, 3);
+        bg.next();
+        bg.stop();
+        for (int i = 0; i < n_frames + 2; ++i)
+            bg.next();
+        ok &= bg.is_opened();
+    }
+    std::remove(filename.c_str());
+    BackgroundVideo missing("missing_background_video.avi", size);
+    ok &= !missing.is_opened();
+    return ok;
+}
+
+/**
+ * @brief Alfa de referencia: distancia a los intervalos de spec por fuerza
+ * bruta sobre todos los tonos de cada intervalo, con cvtColor.
+ */
+static cv::Mat
+reference_soft_alpha(const cv::Mat &bgr, const FsivChromaKeySpec &spec, int falloff)
+{
+    cv::Mat hsv;
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    int dist[180];
+    for (int h = 0; h < 180; ++h)
+    {
+        dist[h] = 255;
+        for (const cv::Vec2i &r : spec.hue_ranges)
+            for (int k = r[0]; k != (r[1] + 1) % 180; k = (k + 1) % 180)
+            {
+                const int diff = std::abs(h - k);
+                dist[h] = std::min(dist[h], std::min(diff, 180 - diff));
+            }
+    }
+    cv::Mat alpha(bgr.size(), CV_8UC1);
+    for (int y = 0; y < bgr.rows; ++y)
+        for (int x = 0; x < bgr.cols; ++x)
+        {
+            const cv::Vec3b p = hsv.at<cv::Vec3b>(y, x);
+            const bool sv = spec.s_range[0] <= p[1] && p[1] <= spec.s_range[1] &&
+                            spec.v_range[0] <= p[2] && p[2] <= spec.v_range[1];
+            const int d = dist[p[0]];
+            int a = falloff > 0 ? std::min(255, d * 255 / falloff) : (d > 0 ? 255 : 0);
+            alpha.at<uchar>(y, x) = uchar(sv ? a : 255);
+        }
+    return alpha;
+}
+
+static bool
+test_soft_chroma_key()
+{
+    bool ok = true;
+    // Mezcla: redondeo exacto de fg * a / 255 + bg * (255 - a) / 255.
+    const cv::Mat fg = make_test_image(CV_8UC3);
+    const cv::Mat bg = make_test_image(CV_8UC3, cv::Size(50, 40));
+    cv::Mat bg_resized, alpha(fg.size(), CV_8UC1), out, expected;
+    cv::resize(bg, bg_resized, fg.size());
+    cv::randu(alpha, 0, 256);
+    fsiv_blend_images_into(fg, bg_resized, alpha, out);
+    expected.create(fg.size(), CV_8UC3);
+    for (int y = 0; y < fg.rows; ++y)
+        for (int x = 0; x < fg.cols; ++x)
+            for (int c = 0; c < 3; ++c)
+            {
+                const int a = alpha.at<uchar>(y, x);
+                const int v = fg.at<cv::Vec3b>(y, x)[c] * a + bg_resized.at<cv::Vec3b>(y, x)[c] * (255 - a);
+                expected.at<cv::Vec3b>(y, x)[c] = uchar((2 * v + 255) / 510);
+            }
+    ok &= check_equal("blend", out, expected);
+
+    // Con falloff 0 es la clave dura.
+    BackgroundCache cache(bg);
+    FsivChromaKeyWorkspace ws;
+    FsivChromaKeySpec spec = fsiv_chroma_key_spec(60, 20);
+    cv::Mat hard, mask;
+    fsiv_apply_chroma_key_soft_into(fg, cache, spec, 0, out, &alpha, ws);
+    fsiv_apply_chroma_key_into(fg, cache, spec, hard, &mask, ws);
+    ok &= check_equal("falloff 0", out, hard);
+    ok &= check_equal("falloff 0 alpha", alpha, mask);
+
+    // Alfa de todos los colores, con vuelta por 180 y límites de S/V.
+    const cv::Mat all = make_all_colors_image();
+    const cv::Mat black = cv::Mat::zeros(all.size(), CV_8UC3);
+    spec.hue_ranges = {cv::Vec2i(40, 80), cv::Vec2i(170, 5)};
+    for (int sv = 0; sv < 2; ++sv)
+    {
+        if (sv)
+        {
+            spec.s_range = cv::Vec2i(40, 255);
+            spec.v_range = cv::Vec2i(20, 230);
+        }
+        const std::string what = sv ? "soft alpha S/V" : "soft alpha";
+        fsiv_apply_chroma_key_soft_into(all, black, spec, 12, out, &alpha, ws);
+        const cv::Mat expected_alpha = reference_soft_alpha(all, spec, 12);
+        ok &= check_equal(what, alpha, expected_alpha);
+        fsiv_blend_images_into(all, black, expected_alpha, expected);
+        ok &= check_equal(what + " output", out, expected);
+    }
+    return ok;
+}
+
+/**
+ * @brief Máscara con manchas grandes y motas sueltas de un píxel.
+ */
+static cv::Mat
+make_blob_mask(cv::Size size)
+{
+    cv::Mat coarse(9, 12, CV_8UC1), mask;
+    cv::theRNG() = cv::RNG(0xB10B);
+    cv::randu(coarse, 0, 256);
+    cv::resize(coarse, mask, size, 0, 0, cv::INTER_LINEAR);
+    cv::threshold(mask, mask, 127, 255, cv::THRESH_BINARY);
+    for (int i = 0; i < 40; ++i)
+        mask.at<uchar>(cv::theRNG().uniform(0, size.height),
+                       cv::theRNG().uniform(0, size.width)) ^= 255;
+    return mask;
+}
+
+/**
+ * @brief Banda de referencia: píxeles distintos de un vecino dilatados con
+ * un cuadrado de lado 2 * radius + 1.
+ */
+static cv::Mat
+reference_band(const cv::Mat &mask, int radius)
+{
+    cv::Mat edges = cv::Mat::zeros(mask.size(), CV_8UC1), band;
+    for (int y = 0; y < mask.rows; ++y)
+        for (int x = 0; x < mask.cols; ++x)
+        {
+            const uchar v = mask.at<uchar>(y, x);
+            bool edge = false;
+            if (y > 0) edge |= mask.at<uchar>(y - 1, x) != v;
+            if (y + 1 < mask.rows) edge |= mask.at<uchar>(y + 1, x) != v;
+            if (x > 0) edge |= mask.at<uchar>(y, x - 1) != v;
+            if (x + 1 < mask.cols) edge |= mask.at<uchar>(y, x + 1) != v;
+            edges.at<uchar>(y, x) = edge ? 255 : 0;
+        }
+    cv::dilate(edges, band, cv::getStructuringElement(cv::MORPH_RECT,
+               cv::Size(2 * radius + 1, 2 * radius + 1)));
+    return band;
+}
+
+/**
+ * @brief Los tramos de la banda pintados en una imagen (255 en la banda).
+ */
+static cv::Mat
+band_image(const FsivNarrowBand &band)
+{
+    cv::Mat img = cv::Mat::zeros(band.size, CV_8UC1);
+    for (int y = 0; y < band.size.height; ++y)
+        for (int i = band.row_begin[y]; i < band.row_begin[y + 1]; ++i)
+            img.row(y).colRange(band.runs[i].x0, band.runs[i].x1).setTo(255);
+    return img;
+}
+
+static bool
+test_narrow_band()
+{
+    bool ok = true;
+    const cv::Mat fg = make_test_image(CV_8UC3, cv::Size(123, 77));
+    const cv::Mat bg = make_test_image(CV_8UC3, cv::Size(50, 40));
+    const cv::Mat mask = make_blob_mask(fg.size());
+
+    // Banda: la misma que dilatando los bordes de toda la imagen.
+    FsivNarrowBand band;
+    for (int radius : {0, 1, 3})
+    {
+        fsiv_find_narrow_band(mask, radius, band);
+        const std::string what = "band radius " + std::to_string(radius);
+        const cv::Mat expected = reference_band(mask, radius);
+        ok &= check_equal(what, band_image(band), expected);
+        ok &= band.pixels() == size_t(cv::countNonZero(expected));
+        for (int y = 0; y < mask.rows; ++y)
+            for (int i = band.row_begin[y] + 1; i < band.row_begin[y + 1]; ++i)
+                ok &= band.runs[i - 1].x1 < band.runs[i].x0;
+    }
+
+    // Refinado en la banda: el mismo resultado que opening, media y
+    // composición sobre toda la imagen.
+    cv::Mat bg_resized;
+    cv::resize(bg, bg_resized, fg.size());
+    FsivChromaKeyWorkspace ws;
+    const int cases[][3] = {{0, 0, -1}, {1, 2, 60}, {2, 0, -1}, {0, 3, 120}, {1, 1, 0}};
+    for (const auto &c : cases)
+    {
+        FsivBandRefineParams params;
+        params.open_radius = c[0];
+        params.feather_radius = c[1];
+        params.despill_hue = c[2];
+        const std::string what = "refine " + std::to_string(c[0]) + ":" +
+                                 std::to_string(c[1]) + ":" + std::to_string(c[2]);
+        cv::Mat out, alpha;
+        fsiv_refine_chroma_key_band_into(fg, bg, mask, params, out, &alpha, ws);
+
+        cv::Mat expected_alpha = 255 - mask;
+        if (c[0] > 0)
+        {
+            const cv::Mat k = cv::getStructuringElement(cv::MORPH_RECT,
+                                                        cv::Size(2 * c[0] + 1, 2 * c[0] + 1));
+            cv::erode(expected_alpha, expected_alpha, k);
+            cv::dilate(expected_alpha, expected_alpha, k);
+        }
+        const cv::Mat opened = expected_alpha.clone();
+        const int f = c[1];
+        for (int y = 0; y < fg.rows; ++y)
+            for (int x = 0; x < fg.cols; ++x)
+            {
+                const cv::Rect win = cv::Rect(x - f, y - f, 2 * f + 1, 2 * f + 1) &
+                                     cv::Rect(0, 0, fg.cols, fg.rows);
+                const int sum = int(cv::sum(opened(win))[0]);
+                expected_alpha.at<uchar>(y, x) = uchar((sum + win.area() / 2) / win.area());
+            }
+        ok &= check_equal(what + " alpha", alpha, expected_alpha);
+
+        cv::Mat despilled = fg.clone(), expected;
+        if (c[2] >= 0)
+        {
+            const int ch = 2 - ((c[2] + 30) / 60) % 3;
+            const cv::Mat in_band = reference_band(mask, std::max(1, 2 * c[0] + c[1]));
+            for (int y = 0; y < fg.rows; ++y)
+                for (int x = 0; x < fg.cols; ++x)
+                    if (in_band.at<uchar>(y, x))
+                    {
+                        cv::Vec3b &p = despilled.at<cv::Vec3b>(y, x);
+                        p[ch] = std::min(p[ch], std::max(p[(ch + 1) % 3], p[(ch + 2) % 3]));
+                    }
+        }
+        fsiv_blend_images_into(despilled, bg_resized, expected_alpha, expected);
+        ok &= check_equal(what + " output", out, expected);
+        ok &= cv::countNonZero(ws.in_band) == 0;
+    }
+
+    // Con la máscara de la clave.
+    const FsivChromaKeySpec spec = fsiv_chroma_key_spec(60, 20);
+    FsivBandRefineParams params;
+    params.feather_radius = 2;
+    cv::Mat out, expected, key_mask;
+    fsiv_apply_chroma_key_refined_into(fg, bg, spec, params, out, nullptr, ws);
+    fsiv_compute_chroma_key_mask_into(fg, spec, key_mask, ws);
+    fsiv_refine_chroma_key_band_into(fg, bg, key_mask, params, expected, nullptr, ws);
+    ok &= check_equal("refined chroma key", out, expected);
+    return ok;
+}
+
+int main(int argc, char *const *argv)
+{
+    int retCode = EXIT_SUCCESS;
+    try
+    {
+        if (argc != 2)
+        {
+            std::cerr << "Usage: " << argv[0] << " <test_name>" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const std::string test = argv[1];
+        bool ok = false;
+        if (test == "fsiv_xxx_into")
+            ok = test_into_variants();
+        else if (test == "hue_kernel")
+            ok = test_hue_kernel();
+        else if (test == "chroma_key_lut")
+            ok = test_chroma_key_lut();
+        else if (test == "fused_chroma_key")
+            ok = test_fused_chroma_key();
+        else if (test == "background_cache")
+            ok = test_background_cache();
+        else if (test == "chroma_key_spec")
+            ok = test_chroma_key_spec();
+        else if (test == "temporal_chroma_key")
+            ok = test_temporal_chroma_key();
+        else if (test == "video_pipeline")
+            ok = test_video_pipeline();
+        else if (test == "video_encoder")
+            ok = test_video_encoder();
+        else if (test == "background_video")
+            ok = test_background_video();
+        else if (test == "soft_chroma_key")
+            ok = test_soft_chroma_key();
+        else if (test == "narrow_band")
+            ok = test_narrow_band();
+        else
+        {
+            std::cerr << "Error: unknown test '" << test << "'." << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << test << ": " << (ok ? "PASSED" : "FAILED") << std::endl;
+        retCode = ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        retCode = EXIT_FAILURE;
+    }
+    return retCode;
+}
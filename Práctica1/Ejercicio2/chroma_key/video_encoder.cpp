@@ -0,0 +1,88 @@
+#include "video_encoder.hpp"
+
+bool
+VideoEncoder::codec_fourcc(const std::string &name, int &fourcc)
+{
+    if (name == "raw")
+        fourcc = 0;
+    else if (name == "lossless")
+        fourcc = cv::VideoWriter::fourcc('F', 'F', 'V', '1');
+    else if (name.size() == 4)
+        fourcc = cv::VideoWriter::fourcc(name[0], name[1], name[2], name[3]);
+    else
+        return false;
+    return true;
+}
+
+VideoEncoder::VideoEncoder(const std::string &filename, int fourcc, double fps,
+                           cv::Size size, size_t queue_size)
+    : queue_(queue_size), closing_(false), frames_(0), busy_ticks_(0), end_(0)
+{
+    CV_Assert(fps > 0.0 && queue_size > 0);
+    start_ = cv::getTickCount();
+    if (writer_.open(filename, fourcc, fps, size, true))
+        thread_ = std::thread(&VideoEncoder::encoder_loop, this);
+}
+
+VideoEncoder::~VideoEncoder()
+{
+    close();
+}
+
+void
+VideoEncoder::write(const cv::Mat &frame)
+{
+    CV_Assert(!closing_ && is_opened());
+    cv::Mat item = frame;
+    int spins = 0;
+    while (!queue_.try_push(item))
+        spsc_backoff(spins);
+}
+
+void
+VideoEncoder::close()
+{
+    closing_ = true;
+    if (thread_.joinable())
+    {
+        thread_.join();
+        end_ = cv::getTickCount();
+    }
+    writer_.release();
+}
+
+void
+VideoEncoder::encoder_loop()
+{
+    int spins = 0;
+    cv::Mat frame;
+    while (true)
+    {
+        if (!queue_.try_pop(frame))
+        {
+            if (!closing_)
+            {
+                spsc_backoff(spins);
+                continue;
+            }
+            // closing_ se activa después del último write(), así que si la
+            // cola sigue vacía tras verlo ya no llegará nada más.
+            if (!queue_.try_pop(frame))
+                break;
+        }
+        spins = 0;
+        const int64_t t0 = cv::getTickCount();
+        writer_.write(frame);
+        busy_ticks_ += cv::getTickCount() - t0;
+        ++frames_;
+        frame.release();
+    }
+}
+
+void
+VideoEncoder::report(std::ostream &out) const
+{
+    const int64_t end = end_ != 0 ? end_ : cv::getTickCount();
+    out << "  encoder: " << frames_ << " frames, "
+        << 100.0 * busy_ticks_ / double(end - start_) << "% busy." << std::endl;
+}
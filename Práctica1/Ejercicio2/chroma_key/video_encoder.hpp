@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "spsc_queue.hpp"
+
+/**
+ * @brief cv::VideoWriter con la codificación en un hilo propio.
+ *
+ * write() sólo deja el frame en una cola SpscQueue acotada; el hilo
+ * codificador los escribe en orden, de modo que la codificación se solapa
+ * con la combinación de los siguientes frames. write() sólo espera si la
+ * cola está llena (el codificador es el cuello de botella).
+ *
+ * write() debe llamarse siempre desde el mismo hilo.
+ */
+class VideoEncoder
+{
+public:
+    /**
+     * @brief Traduce el nombre de un códec a su fourcc.
+     *
+     * "raw" es vídeo sin comprimir (fourcc 0, con extensión .avi),
+     * "lossless" es FFV1 (sin pérdidas, .avi o .mkv) y cualquier otro nombre
+     * de cuatro caracteres se usa como fourcc (p.e. "mp4v", "MJPG").
+     *
+     * @return false si el nombre no es válido.
+     */
+    static bool codec_fourcc(const std::string &name, int &fourcc);
+
+    /**
+     * @brief Abre el fichero de salida y arranca el hilo codificador.
+     * @param filename fichero de salida.
+     * @param fourcc códec (ver codec_fourcc).
+     * @param fps frames por segundo del vídeo de salida.
+     * @param size tamaño de los frames.
+     * @param queue_size frames que pueden esperar a ser codificados.
+     */
+    VideoEncoder(const std::string &filename, int fourcc, double fps, cv::Size size,
+                 size_t queue_size = 8);
+
+    /**
+     * @brief Codifica los frames pendientes y cierra el fichero.
+     */
+    ~VideoEncoder();
+
+    VideoEncoder(const VideoEncoder &) = delete;
+    VideoEncoder &operator=(const VideoEncoder &) = delete;
+
+    /** @brief true si se pudo abrir el fichero de salida. */
+    bool is_opened() const { return writer_.isOpened(); }
+
+    /**
+     * @brief Encola un frame BGR del tamaño dado al abrir.
+     *
+     * No se copia: frame no debe modificarse después.
+     */
+    void write(const cv::Mat &frame);
+
+    /**
+     * @brief Espera a que se codifiquen los frames pendientes y cierra el
+     * fichero. No se puede volver a llamar a write().
+     */
+    void close();
+
+    /** @brief Número de frames codificados. */
+    long frames() const { return frames_; }
+
+    /**
+     * @brief Escribe los frames codificados y el porcentaje de tiempo que el
+     * hilo codificador ha estado ocupado.
+     */
+    void report(std::ostream &out) const;
+
+private:
+    void encoder_loop();
+
+    cv::VideoWriter writer_;
+    SpscQueue<cv::Mat> queue_;
+    std::atomic<bool> closing_;
+    std::atomic<long> frames_;
+    std::atomic<int64_t> busy_ticks_;
+    int64_t start_;
+    int64_t end_;
+    std::thread thread_;
+};
@@ -0,0 +1,179 @@
+#include <string>
+#include "video_pipeline.hpp"
+
+VideoPipeline::VideoPipeline(const PipelineFrame &first, ReadFunction read, KeyFunction key,
+                             int workers, size_t queue_size)
+    : read_(read), key_(key), stop_(false), next_(0)
+{
+    CV_Assert(workers > 0 && queue_size > 0);
+    start_ = last_pop_ = cv::getTickCount();
+    for (int w = 0; w < workers; ++w)
+        workers_.emplace_back(new Worker(queue_size));
+    for (int w = 0; w < workers; ++w)
+        workers_[w]->thread = std::thread(&VideoPipeline::worker_loop, this, w);
+    capture_thread_ = std::thread(&VideoPipeline::capture_loop, this, first);
+}
+
+VideoPipeline::~VideoPipeline()
+{
+    stop();
+    capture_thread_.join();
+    for (auto &w : workers_)
+        w->thread.join();
+}
+
+void
+VideoPipeline::stop()
+{
+    stop_ = true;
+}
+
+/**
+ * @brief Guarda la excepción de una etapa (sólo la primera) para pop() y
+ * detiene el pipeline.
+ */
+void
+VideoPipeline::fail(std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_)
+            error_ = error;
+    }
+    stop();
+}
+
+bool
+VideoPipeline::push(SpscQueue<PipelineFrame> &q, PipelineFrame &frame)
+{
+    int spins = 0;
+    while (!q.try_push(frame))
+    {
+        if (stop_)
+            return false;
+        spsc_backoff(spins);
+    }
+    return true;
+}
+
+void
+VideoPipeline::capture_loop(PipelineFrame frame)
+{
+    const size_t n = workers_.size();
+    long index = 0;
+    while (!stop_ && !frame.foreg.empty())
+    {
+        // El frame n-ésimo va al worker n % workers; pop() los recoge en
+        // el mismo orden.
+        frame.index = index;
+        if (!push(workers_[index % n]->in, frame))
+            return;
+        ++index;
+        ++capture_.frames;
+
+        // Cada frame en buffers nuevos: los anteriores siguen en vuelo.
+        const int64_t t0 = cv::getTickCount();
+        frame = PipelineFrame();
+        try
+        {
+            if (!read_(frame))
+                frame.foreg.release();
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+            return;
+        }
+        capture_.busy_ticks += cv::getTickCount() - t0;
+    }
+    // Fin del vídeo: una marca para cada worker.
+    for (auto &w : workers_)
+    {
+        PipelineFrame end;
+        if (!push(w->in, end))
+            return;
+    }
+}
+
+void
+VideoPipeline::worker_loop(int w)
+{
+    Worker &worker = *workers_[w];
+    int spins = 0;
+    while (!stop_)
+    {
+        PipelineFrame frame;
+        if (!worker.in.try_pop(frame))
+        {
+            spsc_backoff(spins);
+            continue;
+        }
+        spins = 0;
+        const bool end = frame.index < 0;
+        if (!end)
+        {
+            const int64_t t0 = cv::getTickCount();
+            try
+            {
+                key_(w, frame);
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+                return;
+            }
+            worker.stage.busy_ticks += cv::getTickCount() - t0;
+            ++worker.stage.frames;
+        }
+        if (!push(worker.out, frame) || end)
+            return;
+    }
+}
+
+bool
+VideoPipeline::pop(PipelineFrame &frame)
+{
+    consumer_.busy_ticks += cv::getTickCount() - last_pop_;
+    Worker &worker = *workers_[next_ % workers_.size()];
+    bool ok = false;
+    int spins = 0;
+    while (!stop_)
+    {
+        if (worker.out.try_pop(frame))
+        {
+            ok = frame.index >= 0;
+            break;
+        }
+        spsc_backoff(spins);
+    }
+    if (ok)
+    {
+        ++next_;
+        ++consumer_.frames;
+    }
+    else
+    {
+        stop(); // Fin del vídeo: que terminen las demás etapas.
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+    last_pop_ = cv::getTickCount();
+    return ok;
+}
+
+void
+VideoPipeline::report(std::ostream &out) const
+{
+    const double total = double(cv::getTickCount() - start_);
+    auto line = [&](const std::string &name, const Stage &s)
+    {
+        out << "  " << name << ": " << s.frames << " frames, "
+            << 100.0 * s.busy_ticks / total << "% busy." << std::endl;
+    };
+    out << "Pipeline stages:" << std::endl;
+    line("capture", capture_);
+    for (size_t w = 0; w < workers_.size(); ++w)
+        line("key[" + std::to_string(w) + "]", workers_[w]->stage);
+    line("display", consumer_);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "spsc_queue.hpp"
+
+/**
+ * @brief Un frame que recorre el pipeline.
+ */
+struct PipelineFrame
+{
+    long index = -1; /*< posición en el vídeo; -1 marca el final.*/
+    cv::Mat foreg;   /*< frame leído.*/
+    cv::Mat backg;   /*< fondo para este frame, si cambia con cada frame.*/
+    cv::Mat output;  /*< composición.*/
+    cv::Mat mask;    /*< máscara (si la función de combinación la da).*/
+};
+
+/**
+ * @brief Pipeline captura -> combinación -> consumidor para vídeo.
+ *
+ * Un hilo lee los frames y los reparte por turno entre N hilos de
+ * combinación; el consumidor (el hilo de la GUI, que es el único que puede
+ * llamar a cv::imshow) los recoge con pop() en el orden original. Cada
+ * etapa se comunica con la siguiente mediante colas SpscQueue acotadas (una
+ * de entrada y otra de salida por hilo de combinación), de modo que no hay
+ * cerrojos y la lectura del siguiente frame se solapa con la combinación y
+ * con la espera de la GUI.
+ *
+ * Cada etapa cuenta el tiempo que pasa trabajando (no esperando a una
+ * cola); report() lo da como porcentaje del tiempo total para ver cuál es
+ * el cuello de botella. Para el consumidor es el tiempo entre dos llamadas
+ * a pop(), así que incluye la espera de cv::waitKey.
+ *
+ * Si la lectura o la combinación lanzan una excepción, el pipeline se
+ * detiene y pop() la relanza en el hilo del consumidor.
+ */
+class VideoPipeline
+{
+public:
+    /**
+     * @brief Lee el siguiente frame en frame.foreg (y, si hace falta, su
+     * fondo en frame.backg); false al terminar el vídeo.
+     */
+    typedef std::function<bool(PipelineFrame &frame)> ReadFunction;
+    /** @brief Combina frame.foreg en frame.output desde el hilo worker. */
+    typedef std::function<void(int worker, PipelineFrame &frame)> KeyFunction;
+
+    /**
+     * @brief Arranca los hilos.
+     * @param first primer frame (ya leído para comprobar la fuente).
+     * @param read lectura de los siguientes frames, desde el hilo de captura.
+     * @param key combinación de un frame. Se llama desde varios hilos a la
+     *        vez, cada uno con su número de worker en [0, workers).
+     * @param workers número de hilos de combinación (> 0).
+     * @param queue_size capacidad de cada cola.
+     */
+    VideoPipeline(const PipelineFrame &first, ReadFunction read, KeyFunction key,
+                  int workers = 2, size_t queue_size = 4);
+
+    /**
+     * @brief Detiene los hilos (ver stop()) y espera a que terminen.
+     */
+    ~VideoPipeline();
+
+    VideoPipeline(const VideoPipeline &) = delete;
+    VideoPipeline &operator=(const VideoPipeline &) = delete;
+
+    /**
+     * @brief Siguiente frame combinado, en orden. Sólo desde un hilo.
+     *
+     * Espera a que esté listo. Relanza la primera excepción de la lectura
+     * o de la combinación.
+     * @return false si el vídeo ha terminado o se ha llamado a stop().
+     */
+    bool pop(PipelineFrame &frame);
+
+    /**
+     * @brief Pide a todas las etapas que terminen sin procesar más frames.
+     */
+    void stop();
+
+    /** @brief Número de hilos de combinación. */
+    int workers() const { return int(workers_.size()); }
+
+    /**
+     * @brief Escribe el porcentaje de tiempo ocupado de cada etapa.
+     */
+    void report(std::ostream &out) const;
+
+private:
+    struct Stage
+    {
+        std::atomic<int64_t> busy_ticks{0}; /*< tiempo trabajando (cv::getTickCount).*/
+        std::atomic<long> frames{0};
+    };
+
+    struct Worker
+    {
+        Worker(size_t queue_size) : in(queue_size), out(queue_size) {}
+        SpscQueue<PipelineFrame> in;  /*< captura -> worker.*/
+        SpscQueue<PipelineFrame> out; /*< worker -> consumidor.*/
+        Stage stage;
+        std::thread thread;
+    };
+
+    void capture_loop(PipelineFrame frame);
+    void worker_loop(int w);
+    bool push(SpscQueue<PipelineFrame> &q, PipelineFrame &frame);
+    void fail(std::exception_ptr error);
+
+    ReadFunction read_;
+    KeyFunction key_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    Stage capture_;
+    Stage consumer_;
+    std::thread capture_thread_;
+    std::atomic<bool> stop_;
+    std::mutex error_mutex_;
+    std::exception_ptr error_; /*< primera excepción de una etapa.*/
+    long next_;        /*< siguiente frame que devolverá pop().*/
+    int64_t start_;    /*< inicio del pipeline.*/
+    int64_t last_pop_; /*< fin de la última llamada a pop().*/
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+/**
+ * @brief Planificador que agrupa los eventos de la GUI en un único hilo.
+ *
+ * Las callbacks de los deslizadores sólo anotan los últimos parámetros con
+ * post(). Un hilo renderiza siempre el estado más reciente y descarta los
+ * intermedios que llegaron mientras estaba ocupado. Entre dos renders pasa
+ * al menos frame_budget_ms, de modo que el hilo de la GUI (que es el único
+ * que puede llamar a cv::imshow) recoge el resultado con fetch() sin
+ * quedarse bloqueado.
+ *
+ * @tparam Params tipo de los parámetros del render.
+ * @tparam Result tipo del resultado del render.
+ */
+template <class Params, class Result>
+class CoalescingScheduler
+{
+public:
+    typedef std::function<void(const Params &, Result &)> RenderFunction;
+
+    /**
+     * @brief Arranca el hilo de render.
+     * @param render función que renderiza unos parámetros en un resultado.
+     *        Se llama siempre desde el hilo del planificador.
+     * @param frame_budget_ms tiempo mínimo entre el inicio de dos renders.
+     */
+    CoalescingScheduler(RenderFunction render, int frame_budget_ms = 33)
+        : render_(render), budget_(frame_budget_ms), pending_(false),
+          ready_(false), stop_(false), posted_(0), rendered_(0), coalesced_(0)
+    {
+        thread_ = std::thread(&CoalescingScheduler::run, this);
+    }
+
+    /**
+     * @brief Detiene el hilo de render tras terminar el render en curso.
+     */
+    ~CoalescingScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        thread_.join();
+    }
+
+    CoalescingScheduler(const CoalescingScheduler &) = delete;
+    CoalescingScheduler &operator=(const CoalescingScheduler &) = delete;
+
+    /**
+     * @brief Anota los últimos parámetros. No bloquea.
+     */
+    void post(const Params &p)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (pending_)
+                ++coalesced_; // los parámetros anteriores no llegaron a renderizarse.
+            params_ = p;
+            pending_ = true;
+            ++posted_;
+        }
+        cond_.notify_all();
+    }
+
+    /**
+     * @brief Recoge el último resultado, si hay uno nuevo.
+     * @param out recibe el resultado. Su contenido anterior pasa al
+     *        planificador para reutilizarlo, así que no se deben guardar
+     *        otras referencias a sus buffers.
+     * @return true si había un resultado nuevo.
+     */
+    bool fetch(Result &out)
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!ready_)
+            return false;
+        std::swap(result_, out);
+        ready_ = false;
+        return true;
+    }
+
+    /** @brief Número de eventos recibidos. */
+    unsigned posted()
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return posted_;
+    }
+
+    /** @brief Número de renders realizados. */
+    unsigned rendered()
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return rendered_;
+    }
+
+    /** @brief Número de eventos descartados por llegar otro más reciente. */
+    unsigned coalesced()
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return coalesced_;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lk(mtx_);
+        while (true)
+        {
+            cond_.wait(lk, [this]() { return stop_ || pending_; });
+            if (stop_)
+                break;
+            const Params p = params_;
+            pending_ = false;
+            const auto start = std::chrono::steady_clock::now();
+            lk.unlock();
+            render_(p, work_);
+            lk.lock();
+            std::swap(work_, result_);
+            ready_ = true;
+            ++rendered_;
+            // Respetamos el presupuesto por frame: lo que llegue mientras
+            // tanto se agrupa en un único render.
+            cond_.wait_until(lk, start + budget_, [this]() { return stop_; });
+        }
+    }
+
+    RenderFunction render_;
+    const std::chrono::milliseconds budget_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    Params params_;
+    bool pending_;
+    bool ready_;
+    bool stop_;
+    unsigned posted_;
+    unsigned rendered_;
+    unsigned coalesced_;
+    Result work_;   /*< render en curso (sólo lo toca el hilo).*/
+    Result result_; /*< último render sin recoger.*/
+    std::thread thread_;
+};
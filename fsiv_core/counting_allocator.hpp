@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Asignador de cv::Mat que cuenta las reservas de memoria.
+ *
+ * Delega en el asignador estándar de OpenCV; sólo lleva la cuenta. Los
+ * benchmarks lo instalan con cv::Mat::setDefaultAllocator para medir las
+ * reservas por llamada.
+ */
+class CountingAllocator : public cv::MatAllocator
+{
+public:
+    CountingAllocator() : std_(cv::Mat::getStdAllocator()), count_(0) {}
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+                           size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override
+    {
+        if (data == nullptr)
+            ++count_;
+        return std_->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessflags,
+                  cv::UMatUsageFlags usageFlags) const override
+    {
+        return std_->allocate(data, accessflags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData *data) const override
+    {
+        std_->deallocate(data);
+    }
+
+    long count() const { return count_; }
+
+private:
+    cv::MatAllocator *std_;
+    mutable std::atomic<long> count_;
+};
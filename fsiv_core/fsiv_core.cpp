@@ -0,0 +1,194 @@
+#include "fsiv_core.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <opencv2/imgproc.hpp>
+
+#include "fsiv_core_kernels.hpp"
+#include "fsiv_half.hpp"
+
+namespace
+{
+
+/**
+ * @brief Variante compilada con el nombre dado si la CPU la soporta.
+ * @return nullptr si no existe o no está soportada.
+ */
+const FsivCoreKernels *
+find_kernels(const std::string &isa)
+{
+#ifdef FSIV_CORE_HAVE_AVX512
+    if (isa == fsiv_core_kernels_avx512.name)
+        return cv::checkHardwareSupport(CV_CPU_AVX512_SKX) ? &fsiv_core_kernels_avx512 : nullptr;
+#endif
+#ifdef FSIV_CORE_HAVE_AVX2
+    if (isa == fsiv_core_kernels_avx2.name)
+        return cv::checkHardwareSupport(CV_CPU_AVX2) && cv::checkHardwareSupport(CV_CPU_FMA3)
+                   ? &fsiv_core_kernels_avx2 : nullptr;
+#endif
+    if (isa == fsiv_core_kernels_baseline.name)
+        return &fsiv_core_kernels_baseline;
+    return nullptr;
+}
+
+/**
+ * @brief La mejor variante soportada, o la indicada en FSIV_CORE_ISA.
+ */
+const FsivCoreKernels *
+select_kernels()
+{
+    const char *forced = std::getenv("FSIV_CORE_ISA");
+    if (forced != nullptr)
+    {
+        if (const FsivCoreKernels *k = find_kernels(forced))
+            return k;
+        std::cerr << "Warning: FSIV_CORE_ISA='" << forced
+                  << "' is not available on this CPU/build; ignored." << std::endl;
+    }
+    for (const char *isa : {"avx512", "avx2"})
+        if (const FsivCoreKernels *k = find_kernels(isa))
+            return k;
+    return &fsiv_core_kernels_baseline;
+}
+
+std::atomic<const FsivCoreKernels *> &
+current_kernels()
+{
+    static std::atomic<const FsivCoreKernels *> kernels(select_kernels());
+    return kernels;
+}
+
+// La variante se elige al cargar el programa y no en la primera llamada
+// a un kernel, que podría caer dentro de una medida de tiempos.
+const bool kernels_selected_at_load = current_kernels().load() != nullptr;
+
+const FsivCoreKernels &
+kernels()
+{
+    return *current_kernels().load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief cvtColor para CV_32F o CV_16F (cvtColor no admite CV_16F).
+ */
+void
+convert_color(const cv::Mat &img, cv::Mat &out, int code)
+{
+    if (img.depth() != CV_16F)
+    {
+        cv::cvtColor(img, out, code);
+        return;
+    }
+    out.create(img.size(), img.type());
+    fsiv_for_each_half_block(img, out, [code](cv::Mat &flt, cv::Mat &dst)
+    {
+        cv::cvtColor(flt, flt, code);
+        flt.convertTo(dst, CV_16F);
+    });
+}
+
+} // namespace
+
+const char *
+fsiv_core_isa()
+{
+    return kernels().name;
+}
+
+int
+fsiv_core_simd_lanes()
+{
+    return kernels().simd_lanes;
+}
+
+bool
+fsiv_core_set_isa(const std::string &isa)
+{
+    const FsivCoreKernels *k = find_kernels(isa);
+    if (k == nullptr)
+        return false;
+    current_kernels().store(k);
+    return true;
+}
+
+void
+fsiv_convert_bgr_to_hsv_into(const cv::Mat &img, cv::Mat &out)
+{
+    CV_Assert(img.channels() == 3);
+    convert_color(img, out, cv::COLOR_BGR2HSV);
+    CV_Assert(out.channels() == 3);
+}
+
+cv::Mat
+fsiv_convert_bgr_to_hsv(const cv::Mat &img)
+{
+    CV_Assert(img.channels() == 3);
+    cv::Mat out;
+    fsiv_convert_bgr_to_hsv_into(img, out);
+    CV_Assert(out.channels() == 3);
+    return out;
+}
+
+void
+fsiv_convert_hsv_to_bgr_into(const cv::Mat &img, cv::Mat &out)
+{
+    CV_Assert(img.channels() == 3);
+    convert_color(img, out, cv::COLOR_HSV2BGR);
+    CV_Assert(out.channels() == 3);
+}
+
+cv::Mat
+fsiv_convert_hsv_to_bgr(const cv::Mat &img)
+{
+    CV_Assert(img.channels() == 3);
+    cv::Mat out;
+    fsiv_convert_hsv_to_bgr_into(img, out);
+    CV_Assert(out.channels() == 3);
+    return out;
+}
+
+void
+fsiv_convert_bgr_to_hue_into(const cv::Mat &img, cv::Mat &hue)
+{
+    CV_Assert(img.type() == CV_8UC3);
+    hue.create(img.size(), CV_8UC1);
+    const FsivCoreKernels &k = kernels();
+    cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range &rows)
+    {
+        for (int y = rows.start; y < rows.end; ++y)
+            k.bgr_to_hue_row(img.ptr<uchar>(y), hue.ptr<uchar>(y), img.cols);
+    });
+}
+
+void
+fsiv_convert_bgr_to_v_into(const cv::Mat &img, cv::Mat &v)
+{
+    CV_Assert(img.type() == CV_8UC3 || img.type() == CV_32FC3);
+    v.create(img.size(), img.depth());
+    const FsivCoreKernels &k = kernels();
+    cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range &rows)
+    {
+        for (int y = rows.start; y < rows.end; ++y)
+            if (img.depth() == CV_8U)
+                k.bgr_to_v_row_8u(img.ptr<uchar>(y), v.ptr<uchar>(y), img.cols);
+            else
+                k.bgr_to_v_row_32f(img.ptr<float>(y), v.ptr<float>(y), img.cols);
+    });
+}
+
+void
+fsiv_convert_bgr_to_hsv_planes_into(const cv::Mat &img, std::vector<cv::Mat> &planes)
+{
+    CV_Assert(img.type() == CV_32FC3);
+    planes.resize(3);
+    for (cv::Mat &p : planes)
+        p.create(img.size(), CV_32FC1);
+    const FsivCoreKernels &k = kernels();
+    cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range &rows)
+    {
+        for (int y = rows.start; y < rows.end; ++y)
+            k.bgr_to_hsv_planes_row(img.ptr<float>(y), planes[0].ptr<float>(y),
+                                    planes[1].ptr<float>(y), planes[2].ptr<float>(y),
+                                    img.cols);
+    });
+}
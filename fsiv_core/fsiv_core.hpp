@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Variante de los kernels en uso: "baseline", "avx2" o "avx512".
+ *
+ * La variante se elige al cargar el programa según la CPU. La variable de
+ * entorno FSIV_CORE_ISA permite forzar una variante soportada (p.e. para
+ * comparar tiempos).
+ */
+const char *fsiv_core_isa();
+
+/**
+ * @brief Bytes de un vector de la variante en uso (cv::v_uint8::nlanes con
+ * que se compiló: 16, 32 o 64; 0 sin SIMD).
+ */
+int fsiv_core_simd_lanes();
+
+/**
+ * @brief Fuerza una variante de los kernels.
+ * @param isa "baseline", "avx2" o "avx512".
+ * @return false si no se compiló o la CPU no la soporta (no cambia nada).
+ */
+bool fsiv_core_set_isa(const std::string &isa);
+
+/**
+ * @brief Convierte una imagen en color BGR a HSV.
+ * @param img imagen de entrada.
+ * @return la imagen de salida.
+ */
+cv::Mat fsiv_convert_bgr_to_hsv(const cv::Mat &img);
+
+/**
+ * @brief Igual que fsiv_convert_bgr_to_hsv pero escribiendo en out.
+ *
+ * Admite también CV_16F: se convierte por bloques de filas a float, de modo
+ * que la imagen completa nunca existe en CV_32F.
+ *
+ * @param img imagen de entrada.
+ * @param out imagen de salida (misma profundidad que img). Sólo se reserva
+ *        memoria si cambia el tamaño o el tipo.
+ */
+void fsiv_convert_bgr_to_hsv_into(const cv::Mat &img, cv::Mat &out);
+
+/**
+ * @brief Convierte una imagen en color HSV a BGR.
+ * @param img imagen de entrada.
+ * @return la imagen de salida.
+ */
+cv::Mat fsiv_convert_hsv_to_bgr(const cv::Mat &img);
+
+/**
+ * @brief Igual que fsiv_convert_hsv_to_bgr pero escribiendo en out.
+ *
+ * Admite también CV_16F (ver fsiv_convert_bgr_to_hsv_into).
+ *
+ * @param img imagen de entrada.
+ * @param out imagen de salida (misma profundidad que img).
+ */
+void fsiv_convert_hsv_to_bgr_into(const cv::Mat &img, cv::Mat &out);
+
+/**
+ * @brief Calcula sólo el canal H de una imagen BGR de 8 bits.
+ *
+ * Da el mismo valor que el canal H de cv::cvtColor(COLOR_BGR2HSV), en
+ * [0,180), sin calcular S y V ni la imagen HSV de tres canales.
+ *
+ * @param img imagen de entrada (CV_8UC3).
+ * @param hue canal H de salida (CV_8UC1).
+ */
+void fsiv_convert_bgr_to_hue_into(const cv::Mat &img, cv::Mat &hue);
+
+/**
+ * @brief Calcula sólo el canal V = max(B,G,R) de una imagen BGR.
+ *
+ * Es lo único que necesita el proceso de la luma; evita calcular H y S y
+ * la imagen HSV completa.
+ *
+ * @param img imagen BGR CV_8UC3 o CV_32FC3.
+ * @param v plano V de salida (CV_8UC1 o CV_32FC1).
+ */
+void fsiv_convert_bgr_to_v_into(const cv::Mat &img, cv::Mat &v);
+
+/**
+ * @brief Convierte BGR a HSV escribiendo directamente los planos H, S y V.
+ *
+ * Da el mismo resultado que fsiv_convert_bgr_to_hsv_into() seguido de
+ * cv::split, pero en una sola pasada y sin la imagen HSV entrelazada.
+ *
+ * @param img imagen BGR CV_32FC3 en [0,1].
+ * @param planes planos de salida CV_32FC1: H en [0,360), S y V en [0,1].
+ */
+void fsiv_convert_bgr_to_hsv_planes_into(const cv::Mat &img,
+                                         std::vector<cv::Mat> &planes);
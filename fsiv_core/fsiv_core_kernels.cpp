@@ -0,0 +1,256 @@
+// Se compila una vez por variante con FSIV_CORE_VARIANT = baseline, avx2 o
+// avx512 (ver CMakeLists.txt). Las variantes avx2 y avx512 definen, como los
+// ficheros *.simd.hpp de OpenCV, CV_CPU_DISPATCH_MODE y los
+// CV_CPU_COMPILE_* de sus extensiones: intrin.hpp mete entonces los
+// intrínsecos en un espacio de nombres propio de la variante (hal_AVX2...)
+// y usa vectores de 256 o 512 bits. La base es la de OpenCV (hal_baseline).
+#ifndef FSIV_CORE_VARIANT
+#define FSIV_CORE_VARIANT baseline
+#endif
+
+#define FSIV_CAT_(a, b) a##b
+#define FSIV_CAT(a, b) FSIV_CAT_(a, b)
+#define FSIV_STR_(a) #a
+#define FSIV_STR(a) FSIV_STR_(a)
+
+// Fuera de la compilación de OpenCV, cv_cpu_dispatch.h sólo deduce del
+// compilador las extensiones de la base (__SSE2__, NEON). Las de la variante
+// se marcan aquí a partir de sus CV_CPU_COMPILE_*; si la cabecera también
+// las define, la definición es idéntica.
+#ifdef CV_CPU_DISPATCH_MODE
+#include <immintrin.h>
+#if defined(CV_CPU_COMPILE_SSE2) && !defined(CV_SSE2)
+#define CV_MMX 1
+#define CV_SSE 1
+#define CV_SSE2 1
+#endif
+#if defined(CV_CPU_COMPILE_SSE3) && !defined(CV_SSE3)
+#define CV_SSE3 1
+#endif
+#if defined(CV_CPU_COMPILE_SSSE3) && !defined(CV_SSSE3)
+#define CV_SSSE3 1
+#endif
+#if defined(CV_CPU_COMPILE_SSE4_1) && !defined(CV_SSE4_1)
+#define CV_SSE4_1 1
+#endif
+#if defined(CV_CPU_COMPILE_SSE4_2) && !defined(CV_SSE4_2)
+#define CV_SSE4_2 1
+#endif
+#if defined(CV_CPU_COMPILE_POPCNT) && !defined(CV_POPCNT)
+#define CV_POPCNT 1
+#endif
+#if defined(CV_CPU_COMPILE_FP16) && !defined(CV_FP16)
+#define CV_FP16 1
+#endif
+#if defined(CV_CPU_COMPILE_AVX) && !defined(CV_AVX)
+#define CV_AVX 1
+#endif
+#if defined(CV_CPU_COMPILE_FMA3) && !defined(CV_FMA3)
+#define CV_FMA3 1
+#endif
+#if defined(CV_CPU_COMPILE_AVX2) && !defined(CV_AVX2)
+#define CV_AVX2 1
+#endif
+#if defined(CV_CPU_COMPILE_AVX_512F) && !defined(CV_AVX_512F)
+#define CV_AVX_512F 1
+#endif
+#if defined(CV_CPU_COMPILE_AVX512_COMMON) && !defined(CV_AVX512_COMMON)
+#define CV_AVX_512CD 1
+#define CV_AVX512_COMMON 1
+#endif
+#if defined(CV_CPU_COMPILE_AVX512_SKX) && !defined(CV_AVX512_SKX)
+#define CV_AVX_512BW 1
+#define CV_AVX_512DQ 1
+#define CV_AVX_512VL 1
+#define CV_AVX512_SKX 1
+#endif
+#endif
+
+#include <cfloat>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include "fsiv_core_kernels.hpp"
+
+namespace
+{
+
+// Bits de la aritmética en punto fijo de cvtColor para 8 bits.
+const int HSV_SHIFT = 12;
+
+// Sin std::max/std::min/std::abs: sus instancias no inline compiladas aquí
+// podrían acabar usándose desde código de la variante base.
+template <class T>
+inline T max3(T a, T b, T c)
+{
+    const T m = a > b ? a : b;
+    return m > c ? m : c;
+}
+
+template <class T>
+inline T min3(T a, T b, T c)
+{
+    const T m = a < b ? a : b;
+    return m < c ? m : c;
+}
+
+/**
+ * @brief H de un píxel con la misma aritmética entera que cvtColor.
+ *
+ * hdiv = round((180 << 12) / (6 * diff)) es la tabla de OpenCV; el
+ * cociente en float redondea igual para todo diff en [1, 255].
+ */
+inline unsigned char
+hue180(int b, int g, int r)
+{
+    const int v = max3(b, g, r);
+    const int diff = v - min3(b, g, r);
+    if (diff == 0)
+        return 0;
+    int h = v == r ? g - b : v == g ? b - r + 2 * diff : r - g + 4 * diff;
+    const int hdiv = cvRound((180 << HSV_SHIFT) / (6.0 * diff));
+    h = (h * hdiv + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+    return (unsigned char)(h < 0 ? h + 180 : h);
+}
+
+#if CV_SIMD
+/**
+ * @brief hue180 para un vector de píxeles en 32 bits.
+ */
+inline cv::v_int32
+hue180(const cv::v_int32 &b, const cv::v_int32 &g, const cv::v_int32 &r)
+{
+    const cv::v_int32 zero = cv::vx_setzero_s32();
+    const cv::v_int32 v = cv::v_max(b, cv::v_max(g, r));
+    const cv::v_int32 diff = v - cv::v_min(b, cv::v_min(g, r));
+    cv::v_int32 h = cv::v_select(v == r, g - b,
+                                 cv::v_select(v == g, b - r + diff + diff,
+                                              r - g + (diff << 2)));
+    const cv::v_int32 hdiv = cv::v_select(diff == zero, zero,
+        cv::v_round(cv::vx_setall_f32(float(180 << HSV_SHIFT) / 6.f) / cv::v_cvt_f32(diff)));
+    h = (h * hdiv + cv::vx_setall_s32(1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+    return cv::v_select(h < zero, h + cv::vx_setall_s32(180), h);
+}
+#endif
+
+void
+bgr_to_hue_row(const unsigned char *src, unsigned char *dst, int cols)
+{
+    int x = 0;
+#if CV_SIMD
+    const int n = cv::v_uint8::nlanes;
+    for (; x <= cols - n; x += n)
+    {
+        cv::v_uint8 c8[3];
+        cv::v_load_deinterleave(src + 3 * x, c8[0], c8[1], c8[2]);
+        // Cada cuarto del vector se procesa en 32 bits.
+        cv::v_int32 c32[3][4];
+        for (int j = 0; j < 3; ++j)
+        {
+            cv::v_uint16 lo, hi;
+            cv::v_uint32 q0, q1, q2, q3;
+            cv::v_expand(c8[j], lo, hi);
+            cv::v_expand(lo, q0, q1);
+            cv::v_expand(hi, q2, q3);
+            c32[j][0] = cv::v_reinterpret_as_s32(q0);
+            c32[j][1] = cv::v_reinterpret_as_s32(q1);
+            c32[j][2] = cv::v_reinterpret_as_s32(q2);
+            c32[j][3] = cv::v_reinterpret_as_s32(q3);
+        }
+        cv::v_int32 h[4];
+        for (int k = 0; k < 4; ++k)
+            h[k] = hue180(c32[0][k], c32[1][k], c32[2][k]);
+        cv::v_store(dst + x, cv::v_pack_u(cv::v_pack(h[0], h[1]), cv::v_pack(h[2], h[3])));
+    }
+#endif
+    for (; x < cols; ++x)
+        dst[x] = hue180(src[3 * x], src[3 * x + 1], src[3 * x + 2]);
+}
+
+void
+bgr_to_v_row_8u(const unsigned char *src, unsigned char *dst, int cols)
+{
+    int x = 0;
+#if CV_SIMD
+    for (; x <= cols - cv::v_uint8::nlanes; x += cv::v_uint8::nlanes)
+    {
+        cv::v_uint8 b, g, r;
+        cv::v_load_deinterleave(src + 3 * x, b, g, r);
+        cv::v_store(dst + x, cv::v_max(b, cv::v_max(g, r)));
+    }
+#endif
+    for (; x < cols; ++x)
+        dst[x] = max3(src[3 * x], src[3 * x + 1], src[3 * x + 2]);
+}
+
+void
+bgr_to_v_row_32f(const float *src, float *dst, int cols)
+{
+    int x = 0;
+#if CV_SIMD
+    for (; x <= cols - cv::v_float32::nlanes; x += cv::v_float32::nlanes)
+    {
+        cv::v_float32 b, g, r;
+        cv::v_load_deinterleave(src + 3 * x, b, g, r);
+        cv::v_store(dst + x, cv::v_max(b, cv::v_max(g, r)));
+    }
+#endif
+    for (; x < cols; ++x)
+        dst[x] = max3(src[3 * x], src[3 * x + 1], src[3 * x + 2]);
+}
+
+void
+bgr_to_hsv_planes_row(const float *src, float *ph, float *ps, float *pv, int cols)
+{
+    int x = 0;
+#if CV_SIMD
+    // Mismas fórmulas que cvtColor(COLOR_BGR2HSV) para float.
+    const cv::v_float32 eps = cv::vx_setall_f32(FLT_EPSILON), k60 = cv::vx_setall_f32(60.f);
+    const cv::v_float32 k120 = cv::vx_setall_f32(120.f), k240 = cv::vx_setall_f32(240.f);
+    const cv::v_float32 k360 = cv::vx_setall_f32(360.f), zero = cv::vx_setzero_f32();
+    for (; x <= cols - cv::v_float32::nlanes; x += cv::v_float32::nlanes)
+    {
+        cv::v_float32 b, g, r;
+        cv::v_load_deinterleave(src + 3 * x, b, g, r);
+        const cv::v_float32 v = cv::v_max(b, cv::v_max(g, r));
+        const cv::v_float32 diff = v - cv::v_min(b, cv::v_min(g, r));
+        const cv::v_float32 s = diff / (cv::v_abs(v) + eps);
+        const cv::v_float32 k = k60 / (diff + eps);
+        cv::v_float32 h = cv::v_select(v == r, (g - b) * k,
+                                       cv::v_select(v == g, (b - r) * k + k120,
+                                                    (r - g) * k + k240));
+        h = cv::v_select(h < zero, h + k360, h);
+        cv::v_store(ph + x, h);
+        cv::v_store(ps + x, s);
+        cv::v_store(pv + x, v);
+    }
+#endif
+    for (; x < cols; ++x)
+    {
+        const float b = src[3 * x], g = src[3 * x + 1], r = src[3 * x + 2];
+        const float v = max3(b, g, r);
+        const float diff = v - min3(b, g, r);
+        const float k = 60.f / (diff + FLT_EPSILON);
+        float h = v == r ? (g - b) * k : v == g ? (b - r) * k + 120.f : (r - g) * k + 240.f;
+        if (h < 0.f)
+            h += 360.f;
+        ph[x] = h;
+        ps[x] = diff / ((v < 0.f ? -v : v) + FLT_EPSILON);
+        pv[x] = v;
+    }
+}
+
+} // namespace
+
+extern const FsivCoreKernels FSIV_CAT(fsiv_core_kernels_, FSIV_CORE_VARIANT) =
+{
+    FSIV_STR(FSIV_CORE_VARIANT),
+#if CV_SIMD
+    cv::v_uint8::nlanes,
+#else
+    0,
+#endif
+    bgr_to_hue_row,
+    bgr_to_v_row_8u,
+    bgr_to_v_row_32f,
+    bgr_to_hsv_planes_row
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+/**
+ * @brief Kernels por fila de una variante de ISA (uso interno de fsiv_core).
+ *
+ * fsiv_core_kernels.cpp se compila una vez por variante y cada compilación
+ * exporta sólo su tabla. Los kernels trabajan con punteros a filas para que
+ * las unidades compiladas con AVX2/AVX-512 no instancien código de cv::Mat
+ * que el enlazador pudiera compartir con el resto del programa.
+ */
+struct FsivCoreKernels
+{
+    const char *name; /*< "baseline", "avx2" o "avx512".*/
+    int simd_lanes;   /*< bytes de un vector (v_uint8::nlanes; 0 sin SIMD).*/
+    void (*bgr_to_hue_row)(const unsigned char *src, unsigned char *dst, int cols);
+    void (*bgr_to_v_row_8u)(const unsigned char *src, unsigned char *dst, int cols);
+    void (*bgr_to_v_row_32f)(const float *src, float *dst, int cols);
+    void (*bgr_to_hsv_planes_row)(const float *src, float *h, float *s, float *v,
+                                  int cols);
+};
+
+extern const FsivCoreKernels fsiv_core_kernels_baseline;
+#ifdef FSIV_CORE_HAVE_AVX2
+extern const FsivCoreKernels fsiv_core_kernels_avx2;
+#endif
+#ifdef FSIV_CORE_HAVE_AVX512
+extern const FsivCoreKernels fsiv_core_kernels_avx512;
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+
+/**
+ * @brief Filas por bloque al procesar imágenes CV_16F con funciones que
+ * sólo admiten CV_32F. Un bloque de 3 canales en float de una imagen de 8K
+ * ocupa unos 3 MB.
+ */
+static const int FSIV_HALF_BLOCK_ROWS = 32;
+
+/**
+ * @brief Aplica f a img por bloques de filas convertidos a CV_32F.
+ *
+ * Con CV_16F la imagen completa sólo existe a media precisión; la copia en
+ * float de cada bloque es local al hilo y cabe en caché.
+ *
+ * @param img imagen de entrada CV_16F.
+ * @param out imagen de salida ya reservada, con las mismas filas que img.
+ * @param f recibe el bloque en float y las filas correspondientes de out.
+ */
+template <class F>
+void
+fsiv_for_each_half_block(const cv::Mat &img, cv::Mat &out, F f)
+{
+    CV_Assert(img.depth() == CV_16F && out.rows == img.rows);
+    const int blocks = (img.rows + FSIV_HALF_BLOCK_ROWS - 1) / FSIV_HALF_BLOCK_ROWS;
+    cv::parallel_for_(cv::Range(0, blocks), [&](const cv::Range &r)
+    {
+        cv::Mat flt;
+        for (int i = r.start; i < r.end; ++i)
+        {
+            const int y0 = i * FSIV_HALF_BLOCK_ROWS;
+            const int y1 = std::min(img.rows, y0 + FSIV_HALF_BLOCK_ROWS);
+            img.rowRange(y0, y1).convertTo(flt, CV_32F);
+            cv::Mat dst = out.rowRange(y0, y1);
+            f(flt, dst);
+        }
+    });
+}